@@ -0,0 +1,283 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Check that a vidDisplay-style filter chain stops allocating once its FilterContext has been warmed up.
+//
+// Usage: alloc.exe [frames]
+//
+// Runs the chain over random 640x480 frames through one FilterContext: denoise, sharpen, point operations, the planar
+// chain, the interleaved filters, face-region blurring and the Sobel gradients. After a few warm-up frames it counts
+// the buffers the context allocates, every cv::Mat allocation and every call to operator new, and exits with -1 if any
+// count grows. The chain runs twice: on OpenCV's thread pool, where the pool workers must not allocate, and with the
+// pool turned off but the filters still split into bands, where no allocation at all is allowed. The second run is
+// needed because OpenCV's own pool allocates a job on the calling thread for every parallel_for_ call.
+
+#include "opencv2/opencv.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "filter.h"
+
+/**
+ * @brief A cv::Mat allocator that counts allocations and hands them to the standard allocator.
+ */
+class CountingAllocator : public cv::MatAllocator
+{
+  public:
+    CountingAllocator() : count(0)
+    {
+    }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const CV_OVERRIDE
+    {
+        count++;
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const CV_OVERRIDE
+    {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData *data) const CV_OVERRIDE
+    {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+
+    /**
+     * @brief Get the number of cv::Mat buffers allocated so far.
+     *
+     * @return The allocation count.
+     */
+    long allocations() const
+    {
+        return count;
+    }
+
+  private:
+    mutable std::atomic<long> count;
+};
+
+// Calls to operator new, in total and from threads other than the one running main, e.g. OpenCV's pool workers
+static std::atomic<long> heapAllocations(0);
+static std::atomic<long> workerHeapAllocations(0);
+static thread_local bool mainThread = false;
+
+/**
+ * @brief Count a heap allocation and hand it to malloc. Replaces the global operator new for the whole program.
+ */
+void *operator new(size_t size)
+{
+    heapAllocations++;
+    if (!mainThread)
+    {
+        workerHeapAllocations++;
+    }
+
+    void *memory = malloc(size > 0 ? size : 1);
+    if (memory == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+/**
+ * @brief Release memory allocated by the counting operator new.
+ */
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+// Frames run before the counts are taken, so every buffer has reached its final size
+static const int WARM_UP_FRAMES = 2;
+
+// Bands the filters split each image into when OpenCV's pool is turned off, so the per-band scratch is still used
+static const int SERIAL_BANDS = 4;
+
+/**
+ * @brief Allocation counts of one run of the filter chain.
+ */
+struct AllocationCounts
+{
+    long context;    // buffers allocated by the FilterContext
+    long mats;       // cv::Mat buffers
+    long heap;       // operator new calls from any thread
+    long workerHeap; // operator new calls from threads other than main's
+};
+
+/**
+ * @brief Run the filter chain over one frame.
+ *
+ * @param capture The captured frame. Left unchanged.
+ * @param frame Set to the filtered frame, one of the context's buffers.
+ * @param planarFrames The two planar frames the planar chain alternates between.
+ * @param faces The regions to blur.
+ * @param ctx The context the whole chain runs through.
+ * @return 0 if successful, -1 if a stage failed.
+ */
+static int filterFrame(cv::Mat &capture, cv::Mat &frame, PlanarImage planarFrames[2],
+                       const std::vector<cv::Rect> &faces, FilterContext &ctx)
+{
+    frame = capture;
+
+    // Each stage writes into the output buffer that does not hold frame, then makes it the new frame
+    auto stage = [&](int (*filter)(cv::Mat &, cv::Mat &, FilterContext *)) {
+        cv::Mat &output = ctx.output(frame);
+        if (filter(frame, output, &ctx) != 0)
+        {
+            return -1;
+        }
+        frame = output;
+        return 0;
+    };
+
+    // Denoise and sharpen
+    int status = stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return medianFilter(src, dst, 2, c); });
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return unsharpMask(src, dst, 1.0, 4, c); });
+
+    // Point operations, composed and applied in place
+    PointOp pointOps = PointOp::negative().then(PointOp::quantize(10));
+    status |= pointOps.apply(frame, frame);
+
+    // Planar chain: emboss, blur, gradient magnitude and sepia, then the point operations on the planes
+    status |= deinterleave(frame, planarFrames[0]);
+    status |= embossEffectPlanar(planarFrames[0], planarFrames[1], &ctx);
+    status |= blur5x5Planar(planarFrames[1], planarFrames[0], cv::BORDER_REFLECT_101, &ctx);
+    status |= magnitudePlanar(planarFrames[0], planarFrames[1], MAGNITUDE_L2, &ctx);
+    status |= ColorMatrix::sepia().apply(planarFrames[1], planarFrames[0]);
+    status |= pointOps.apply(planarFrames[0], planarFrames[0]);
+    cv::Mat &mergedFrame = ctx.output(frame);
+    status |= interleave(planarFrames[0], mergedFrame);
+    frame = mergedFrame;
+
+    // The same filters on the interleaved frame, then the bilateral and cartoon effects
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return embossEffect(src, dst, c); });
+    status |= stage(
+        [](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return blur5x5_5(src, dst, cv::BORDER_REFLECT_101, c); });
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return magnitude(src, dst, MAGNITUDE_L2, c); });
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *) { return sepiaTone(src, dst); });
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return bilateralGrid(src, dst, 8, 25, c); });
+    status |= stage([](cv::Mat &src, cv::Mat &dst, FilterContext *c) { return cartoonize(src, dst, 10, 100, c); });
+
+    // Blur the face regions only
+    int radius = std::max(1, frame.cols / 40);
+    auto faceBlur = [&](cv::Mat &src, cv::Mat &dst) { return boxBlur(src, dst, radius, &ctx); };
+    status |= filterRegions(frame, faces, radius, faceBlur, &ctx);
+
+    // Sobel gradients, kept in scratch slots and scaled back to 8 bits
+    int gradientType = CV_16SC(frame.channels());
+    cv::Mat &sx = ctx.scratch(FilterContext::SCRATCH_USER + 1, frame.rows, frame.cols, gradientType);
+    cv::Mat &sy = ctx.scratch(FilterContext::SCRATCH_USER + 2, frame.rows, frame.cols, gradientType);
+    status |= sobelX3x3(frame, sx);
+    cv::Mat &sobelXFrame = ctx.output(frame);
+    cv::convertScaleAbs(sx, sobelXFrame, 1, 0);
+    frame = sobelXFrame;
+    status |= sobelY3x3(frame, sy);
+    cv::Mat &sobelYFrame = ctx.output(frame);
+    cv::convertScaleAbs(sy, sobelYFrame, 1, 0);
+    frame = sobelYFrame;
+    status |= sobelXY3x3(frame, sx, sy);
+    cv::Mat &magnitudeFrame = ctx.output(frame);
+    status |= magnitude(sx, sy, magnitudeFrame, MAGNITUDE_L2);
+    frame = magnitudeFrame;
+
+    // Brightness
+    status |= PointOp::brightness(1.2).apply(frame, frame);
+
+    return status == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Run the filter chain over random frames and count the allocations made after the warm-up frames.
+ *
+ * @param frames The number of frames counted, after WARM_UP_FRAMES.
+ * @param ctx The context the chain runs through.
+ * @param matAllocator The allocator counting cv::Mat allocations.
+ * @param growth Set to the allocations made after the warm-up frames.
+ * @return 0 if successful, -1 if the chain failed.
+ */
+static int runChain(int frames, FilterContext &ctx, const CountingAllocator &matAllocator, AllocationCounts &growth)
+{
+    PlanarImage planarFrames[2];
+    cv::Mat capture(480, 640, CV_8UC3), frame;
+    std::vector<cv::Rect> faces = {cv::Rect(100, 80, 120, 150), cv::Rect(400, 200, 160, 180), cv::Rect(600, 0, 80, 60)};
+
+    // Only the calls to filterFrame are counted, so whatever cv::randu allocates is left out
+    growth = AllocationCounts();
+    for (int i = 0; i < WARM_UP_FRAMES + frames; i++)
+    {
+        cv::randu(capture, cv::Scalar::all(0), cv::Scalar::all(256));
+
+        long context = ctx.allocations();
+        long mats = matAllocator.allocations();
+        long heap = heapAllocations;
+        long workerHeap = workerHeapAllocations;
+        if (filterFrame(capture, frame, planarFrames, faces, ctx) != 0)
+        {
+            printf("Filter chain failed on frame %d\n", i);
+            return -1;
+        }
+
+        if (i >= WARM_UP_FRAMES)
+        {
+            growth.context += ctx.allocations() - context;
+            growth.mats += matAllocator.allocations() - mats;
+            growth.heap += heapAllocations - heap;
+            growth.workerHeap += workerHeapAllocations - workerHeap;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    mainThread = true;
+
+    int frames = argc > 1 ? atoi(argv[1]) : 20;
+    if (frames < 1)
+    {
+        printf("Usage %s [frames]\n", argv[0]);
+        exit(-1);
+    }
+
+    static CountingAllocator matAllocator;
+    cv::Mat::setDefaultAllocator(&matAllocator);
+
+    // On OpenCV's thread pool. Its jobs are allocated on the main thread, so only the workers' heap use is checked.
+    FilterContext poolContext;
+    AllocationCounts pool;
+    if (runChain(frames, poolContext, matAllocator, pool) != 0)
+    {
+        exit(-1);
+    }
+    printf("%d frames on %d threads after warm-up: %ld context, %ld cv::Mat and %ld worker heap allocations\n", frames,
+           getFilterThreads(), pool.context, pool.mats, pool.workerHeap);
+
+    // On the main thread alone, with the images still split into bands, where nothing may allocate
+    setFilterThreads(SERIAL_BANDS);
+    cv::setNumThreads(1);
+    FilterContext serialContext;
+    AllocationCounts serial;
+    if (runChain(frames, serialContext, matAllocator, serial) != 0)
+    {
+        exit(-1);
+    }
+    printf("%d frames in %d serial bands after warm-up: %ld context, %ld cv::Mat and %ld heap allocations\n", frames,
+           SERIAL_BANDS, serial.context, serial.mats, serial.heap);
+
+    if (pool.context != 0 || pool.mats != 0 || pool.workerHeap != 0 || serial.context != 0 || serial.mats != 0 ||
+        serial.heap != 0)
+    {
+        printf("The filter chain allocated in its steady state\n");
+        exit(-1);
+    }
+
+    return 0;
+}
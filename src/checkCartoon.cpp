@@ -0,0 +1,165 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Check cartoonize against a brute-force cartoon effect.
+//
+// Usage: checkcartoon.exe
+//
+// Runs cartoonize over random 1- to 4-channel images of odd and even sizes, several quantization levels and edge
+// thresholds, and tile cache budgets from whole rows down to narrow strips, and compares every byte with a direct
+// implementation of the effect: the 1-2-4-2-1 blur with reflected borders, the quantization table, and the 3x3 Sobel
+// test on the blurred intensity with replicated borders. Exits with -1 on the first difference. The check runs on the
+// best instruction set of the CPU; run it again with OPENCV_CPU_DISABLE=AVX2 and OPENCV_CPU_DISABLE=AVX2,SSE4_1 to
+// cover the other paths.
+
+#include "opencv2/opencv.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "filter.h"
+#include "simd.h"
+
+/**
+ * @brief Brute-force cartoon effect, one pixel at a time.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param levels The number of quantization levels.
+ * @param edgeThreshold The Sobel gradient norm above which a pixel is an edge.
+ */
+static void cartoonReference(const cv::Mat &src, cv::Mat &dst, int levels, int edgeThreshold)
+{
+    static const int kernel[5] = {1, 2, 4, 2, 1};
+    int rows = src.rows;
+    int cols = src.cols;
+    int cn = src.channels();
+
+    cv::Mat blurred(rows, cols, src.type());
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            for (int c = 0; c < cn; c++)
+            {
+                int sum = 0;
+                for (int i = 0; i < 5; i++)
+                {
+                    int row = cv::borderInterpolate(y + i - 2, rows, cv::BORDER_REFLECT_101);
+                    for (int j = 0; j < 5; j++)
+                    {
+                        int col = cv::borderInterpolate(x + j - 2, cols, cv::BORDER_REFLECT_101);
+                        sum += kernel[i] * kernel[j] * src.ptr<uchar>(row)[col * cn + c];
+                    }
+                }
+                blurred.ptr<uchar>(y)[x * cn + c] = static_cast<uchar>(sum / 100);
+            }
+        }
+    }
+
+    cv::Mat intensity(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            const uchar *pixel = blurred.ptr<uchar>(y) + x * cn;
+            intensity.ptr<uchar>(y)[x] =
+                static_cast<uchar>(cn < 3 ? pixel[0] : (29 * pixel[0] + 150 * pixel[1] + 77 * pixel[2]) >> 8);
+        }
+    }
+
+    PointOp quantize = PointOp::quantize(levels);
+    dst.create(src.size(), src.type());
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            // I(dy, dx) is the intensity at the offset, with the rows and columns past the edges replicated
+            auto I = [&](int dy, int dx) {
+                int row = std::min(std::max(y + dy, 0), rows - 1);
+                int col = std::min(std::max(x + dx, 0), cols - 1);
+                return static_cast<int>(intensity.ptr<uchar>(row)[col]);
+            };
+            int gx = (I(-1, 1) + 2 * I(0, 1) + I(1, 1)) - (I(-1, -1) + 2 * I(0, -1) + I(1, -1));
+            int gy = (I(1, -1) + 2 * I(1, 0) + I(1, 1)) - (I(-1, -1) + 2 * I(-1, 0) + I(-1, 1));
+            bool edge = std::abs(gx) + std::abs(gy) > edgeThreshold;
+            for (int c = 0; c < cn; c++)
+            {
+                dst.ptr<uchar>(y)[x * cn + c] = edge ? 0 : quantize.table[blurred.ptr<uchar>(y)[x * cn + c]];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Find the first byte where two images differ.
+ *
+ * @return true if the images are the same.
+ */
+static bool sameImage(const cv::Mat &a, const cv::Mat &b, int &row, int &col)
+{
+    int width = a.cols * a.channels();
+    for (row = 0; row < a.rows; row++)
+    {
+        for (col = 0; col < width; col++)
+        {
+            if (a.ptr<uchar>(row)[col] != b.ptr<uchar>(row)[col])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *levelNames[3] = {"scalar", "SSE4.1", "AVX2"};
+    printf("Checking cartoonize on the %s path\n", levelNames[simdLevel()]);
+
+    // Sizes around the 32-pixel SIMD blocks and the narrowest tile strip, and a few odd ones
+    const int sizes[][2] = {{1, 1}, {2, 3}, {17, 9}, {33, 31}, {40, 70}, {64, 40}, {97, 53}, {100, 200}, {1921, 37}};
+    const int levelCounts[4] = {2, 5, 16, 40};
+    const int thresholds[3] = {0, 100, 2040};
+    const int tileCaches[3] = {0, getFilterTileCache(), 1000};
+    int defaultTileCache = getFilterTileCache();
+    int checks = 0;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (int cn = 1; cn <= 4; cn++)
+        {
+            cv::Mat src(sizes[s][1], sizes[s][0], CV_8UC(cn));
+            cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+            blur5x5_5(src, src); // smooth enough that some pixels are not edges
+
+            for (int l = 0; l < 4; l++)
+            {
+                for (int t = 0; t < 3; t++)
+                {
+                    cv::Mat expected;
+                    cartoonReference(src, expected, levelCounts[l], thresholds[t]);
+                    for (int k = 0; k < 3; k++)
+                    {
+                        cv::Mat dst;
+                        setFilterTileCache(tileCaches[k]);
+                        int row = 0, col = 0;
+                        if (cartoonize(src, dst, levelCounts[l], thresholds[t]) != 0 ||
+                            !sameImage(dst, expected, row, col))
+                        {
+                            printf("Mismatch: %dx%d, %d channels, %d levels, threshold %d, tile cache %d, row %d "
+                                   "byte %d\n",
+                                   src.cols, src.rows, cn, levelCounts[l], thresholds[t], tileCaches[k], row, col);
+                            exit(-1);
+                        }
+                        checks++;
+                    }
+                }
+            }
+        }
+    }
+    setFilterTileCache(defaultTileCache);
+
+    printf("%d cartoonize calls match\n", checks);
+    printf("Terminating\n");
+    return (0);
+}
@@ -0,0 +1,177 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Check IntegralImage against brute-force rectangle sums.
+//
+// Usage: checkintegral.exe
+//
+// Builds the tables of random 1- to 4-channel images of odd and even widths, with 32-bit and 64-bit sums, and
+// compares sum and squareSum over random rectangles, whole images, single pixels and rectangles reaching past the
+// edges with sums taken pixel by pixel. One image is large enough that its sums need 64 bits without asking. The same
+// IntegralImage is rebuilt for every image, so stale data left from a larger build shows up too. Exits with -1 on the
+// first difference. The check runs on the best instruction set of the CPU; run it again with OPENCV_CPU_DISABLE=AVX2
+// and OPENCV_CPU_DISABLE=AVX2,SSE4_1 to cover the other paths.
+
+#include "opencv2/opencv.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "integral.h"
+#include "simd.h"
+
+// Random rectangles checked per table
+static const int RECTS = 200;
+
+/**
+ * @brief Brute-force sum of one channel over a rectangle, and of its squares.
+ *
+ * @param src The source image.
+ * @param rect The rectangle, clipped to the image.
+ * @param channel The channel.
+ * @param squares Set to the sum of the squares.
+ * @return The sum.
+ */
+static int64_t sumReference(const cv::Mat &src, const cv::Rect &rect, int channel, int64_t &squares)
+{
+    cv::Rect clipped = rect & cv::Rect(0, 0, src.cols, src.rows);
+    int cn = src.channels();
+    int64_t sum = 0;
+    squares = 0;
+    for (int y = clipped.y; y < clipped.y + clipped.height; y++)
+    {
+        const uchar *ptr = src.ptr<uchar>(y);
+        for (int x = clipped.x; x < clipped.x + clipped.width; x++)
+        {
+            int value = ptr[x * cn + channel];
+            sum += value;
+            squares += value * value;
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief Compare the tables of an image with brute-force sums over one rectangle, in every channel.
+ *
+ * @return true if they match.
+ */
+static bool checkRect(const IntegralImage &integral, const cv::Mat &src, const cv::Rect &rect)
+{
+    for (int c = 0; c < src.channels(); c++)
+    {
+        int64_t squares = 0;
+        int64_t sum = sumReference(src, rect, c, squares);
+        int64_t expectedSquares = integral.hasSquares() ? squares : 0;
+        if (integral.sum(rect, c) != sum || integral.squareSum(rect, c) != expectedSquares)
+        {
+            printf("Mismatch: %dx%d, %d channels, %s table, squares %s, rect %d,%d %dx%d, channel %d: sum %lld "
+                   "(expected %lld), squareSum %lld (expected %lld)\n",
+                   src.cols, src.rows, src.channels(), integral.isWide() ? "wide" : "narrow",
+                   integral.hasSquares() ? "on" : "off", rect.x, rect.y, rect.width, rect.height, c,
+                   (long long)integral.sum(rect, c), (long long)sum, (long long)integral.squareSum(rect, c),
+                   (long long)expectedSquares);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Build the tables of an image and check them over a set of rectangles.
+ *
+ * @param integral The integral image to build, reused between images.
+ * @param src The source image.
+ * @param squares Whether to build the table of squared values.
+ * @param wide Whether to ask for 64-bit sums.
+ * @param maxSide The largest side of the random rectangles.
+ * @return The number of rectangles checked, or -1 on a mismatch.
+ */
+static int checkImage(IntegralImage &integral, cv::Mat &src, bool squares, bool wide, int maxSide)
+{
+    if (integral.build(src, squares, wide) != 0 || integral.size() != src.size() ||
+        integral.channels() != src.channels() || integral.hasSquares() != squares || (wide && !integral.isWide()))
+    {
+        printf("Build failed: %dx%d, %d channels\n", src.cols, src.rows, src.channels());
+        return -1;
+    }
+
+    // The whole image, its corners, a rectangle past every edge and one outside the image
+    std::vector<cv::Rect> rects;
+    rects.push_back(cv::Rect(0, 0, src.cols, src.rows));
+    rects.push_back(cv::Rect(0, 0, 1, 1));
+    rects.push_back(cv::Rect(src.cols - 1, src.rows - 1, 1, 1));
+    rects.push_back(cv::Rect(-3, -2, src.cols + 7, src.rows + 5));
+    rects.push_back(cv::Rect(src.cols, src.rows, 4, 4));
+    for (int i = 0; i < RECTS; i++)
+    {
+        int x = rand() % src.cols;
+        int y = rand() % src.rows;
+        int width = 1 + rand() % std::min(maxSide, src.cols - x);
+        int height = 1 + rand() % std::min(maxSide, src.rows - y);
+        rects.push_back(cv::Rect(x, y, width, height));
+    }
+
+    for (size_t i = 0; i < rects.size(); i++)
+    {
+        if (!checkRect(integral, src, rects[i]))
+        {
+            return -1;
+        }
+    }
+    return static_cast<int>(rects.size());
+}
+
+int main(int argc, char *argv[])
+{
+    const char *levelNames[3] = {"scalar", "SSE4.1", "AVX2"};
+    printf("Checking IntegralImage on the %s path\n", levelNames[simdLevel()]);
+
+    // Widths around the 4-, 8- and 16-value SIMD blocks, odd ones among them
+    const int sizes[][2] = {{1, 1}, {1, 7}, {2, 3}, {3, 2}, {5, 5}, {7, 9}, {15, 4}, {17, 9}, {33, 31}, {63, 20},
+                            {97, 53}, {640, 480}, {1921, 37}};
+    IntegralImage integral;
+    int checks = 0;
+    srand(1);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        for (int cn = 1; cn <= 4; cn++)
+        {
+            cv::Mat src(sizes[s][1], sizes[s][0], CV_8UC(cn));
+            cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+            for (int mode = 0; mode < 4; mode++)
+            {
+                int count = checkImage(integral, src, (mode & 1) != 0, (mode & 2) != 0, 64);
+                if (count < 0)
+                {
+                    exit(-1);
+                }
+                checks += count;
+            }
+        }
+    }
+
+    // Saturated pixels over more than INT32_MAX / 255 of them, so the sums need 64 bits whatever the caller asks for
+    for (int cn = 1; cn <= 4; cn += 3)
+    {
+        cv::Mat src(2100, 4097, CV_8UC(cn), cv::Scalar::all(255));
+        cv::Mat corner = src(cv::Rect(0, 0, 300, 300));
+        cv::randu(corner, cv::Scalar::all(0), cv::Scalar::all(256));
+        int count = checkImage(integral, src, true, false, 300);
+        if (count < 0)
+        {
+            exit(-1);
+        }
+        if (!integral.isWide())
+        {
+            printf("Expected 64-bit sums for %dx%d, %d channels\n", src.cols, src.rows, cn);
+            exit(-1);
+        }
+        checks += count;
+    }
+
+    printf("%d rectangles match\n", checks);
+    printf("Terminating\n");
+    return (0);
+}
@@ -8,6 +8,7 @@
   The path to the Haar cascade file is define in faceDetect.h
 */
 #include "faceDetect.h"
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -21,7 +22,28 @@
  */
 int detectFaces(cv::Mat &grey, std::vector<cv::Rect> &faces)
 {
-    // a static variable to hold a half-size image
+    // a static variable to hold the pyramid of the image, kept to reuse its buffers
+    static GaussianPyramid pyramid;
+
+    // cut the image size in half to reduce processing time
+    if (pyramid.build(grey, 2) != 0)
+    {
+        faces.clear();
+        return (-1);
+    }
+
+    return detectFaces(pyramid, faces);
+}
+
+/*
+  Arguments:
+  GaussianPyramid &pyramid - a pyramid of a greyscale source image; faces are detected in its half-size level
+  std::vector<cv::Rect> &faces - a standard vector of cv::Rect rectangles in the coordinates of the full size image
+     if the length of the vector is zero, no faces were found
+ */
+int detectFaces(GaussianPyramid &pyramid, std::vector<cv::Rect> &faces)
+{
+    // a static variable to hold the equalized half-size image, so the shared pyramid level is left unchanged
     static cv::Mat half;
 
     // a static variable to hold the classifier
@@ -43,11 +65,17 @@ int detectFaces(cv::Mat &grey, std::vector<cv::Rect> &faces)
     // clear the vector of faces
     faces.clear();
 
-    // cut the image size in half to reduce processing time
-    cv::resize(grey, half, cv::Size(grey.cols / 2, grey.rows / 2));
+    // use the half-size level, or the image itself if the pyramid has only one level
+    int level = std::min(pyramid.levels() - 1, 1);
+    if (level < 0)
+    {
+        printf("Frame is empty\n");
+        return (-1);
+    }
+    int scale = 1 << level;
 
     // equalize the image
-    cv::equalizeHist(half, half);
+    cv::equalizeHist(pyramid.level(level), half);
 
     // apply the Haar cascade detector
     face_cascade.detectMultiScale(half, faces);
@@ -55,10 +83,10 @@ int detectFaces(cv::Mat &grey, std::vector<cv::Rect> &faces)
     // adjust the rectangle sizes back to the full size image
     for (int i = 0; i < faces.size(); i++)
     {
-        faces[i].x *= 2;
-        faces[i].y *= 2;
-        faces[i].width *= 2;
-        faces[i].height *= 2;
+        faces[i].x *= scale;
+        faces[i].y *= scale;
+        faces[i].width *= scale;
+        faces[i].height *= scale;
     }
 
     return (0);
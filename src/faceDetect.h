@@ -9,6 +9,8 @@
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
 
+#include "pyramid.h"
+
 #ifndef FACEDETECT_H
 #define FACEDETECT_H
 
@@ -17,6 +19,7 @@
 
 // prototypes
 int detectFaces(cv::Mat &grey, std::vector<cv::Rect> &faces);
+int detectFaces(GaussianPyramid &pyramid, std::vector<cv::Rect> &faces);
 int drawBoxes(cv::Mat &frame, std::vector<cv::Rect> &faces, int minWidth = 50, float scale = 1.0);
 
 #endif
@@ -3,15 +3,183 @@
 // Purpose: Display live video using OpenCV.
 
 #include "filter.h"
+#include "pixelTraits.h"
+#include "separableFilter.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
 
+// Number of row bands the kernels split an image into. 0 means one band per OpenCV worker thread.
+static int filterThreads = 0;
+
+// Bands shorter than this are not worth handing to another thread.
+static const int MIN_BAND_ROWS = 16;
+
+// Working set in bytes the stencil filters size their tiles to. 0 runs the passes over whole rows.
+static int filterTileCache = 256 * 1024;
+
+/**
+ * @brief Set the number of threads the filters split their work across.
+ *
+ * @param threads The number of threads. 1 runs every filter on the calling thread, 0 or less uses every worker in
+ * OpenCV's thread pool.
+ * @return 0 if successful, -1 if error.
+ */
+int setFilterThreads(int threads)
+{
+    filterThreads = std::max(threads, 0);
+    return 0;
+}
+
+/**
+ * @brief Get the number of threads the filters split their work across.
+ *
+ * @return The number of threads.
+ */
+int getFilterThreads()
+{
+    return filterThreads > 0 ? filterThreads : std::max(cv::getNumThreads(), 1);
+}
+
+/**
+ * @brief Set the cache budget the stencil filters size their tiles to.
+ *
+ * @param bytes The tile working set in bytes, e.g. the per-core L2 size. 0 or less runs the passes over whole rows.
+ * @return 0 if successful, -1 if error.
+ */
+int setFilterTileCache(int bytes)
+{
+    filterTileCache = std::max(bytes, 0);
+    return 0;
+}
+
+/**
+ * @brief Get the cache budget the stencil filters size their tiles to.
+ *
+ * @return The tile working set in bytes, or 0 when the filters run over whole rows.
+ */
+int getFilterTileCache()
+{
+    return filterTileCache;
+}
+
+/**
+ * @brief Get the number of bands parallelRows splits a row range into.
+ *
+ * @param rows The number of rows in the range.
+ * @return The number of bands, at least 1.
+ */
+int rowBandCount(int rows)
+{
+    return std::max(std::min(getFilterThreads(), rows / MIN_BAND_ROWS), 1);
+}
+
+/**
+ * @brief Get the first row of one band of a row range split by parallelRows.
+ *
+ * Band band covers the rows [rowBandBegin(begin, rows, bands, band), rowBandBegin(begin, rows, bands, band + 1)).
+ *
+ * @param begin The first row of the range.
+ * @param rows The number of rows in the range.
+ * @param bands The number of bands, as returned by rowBandCount.
+ * @param band The band, from 0 to bands. Passing bands gives one past the last row.
+ * @return The first row of the band.
+ */
+int rowBandBegin(int begin, int rows, int bands, int band)
+{
+    return begin + (int)((long long)rows * band / bands);
+}
+
+/**
+ * @brief Get the band of a row range split by parallelRows that holds a row.
+ *
+ * @param begin The first row of the range.
+ * @param rows The number of rows in the range.
+ * @param bands The number of bands, as returned by rowBandCount.
+ * @param row The row, e.g. the bandBegin passed to a parallelRows body.
+ * @return The band holding row.
+ */
+int rowBandIndex(int begin, int rows, int bands, int row)
+{
+    int band = (int)((long long)(row - begin) * bands / rows);
+    while (band > 0 && rowBandBegin(begin, rows, bands, band) > row)
+    {
+        band--;
+    }
+    while (band + 1 < bands && rowBandBegin(begin, rows, bands, band + 1) <= row)
+    {
+        band++;
+    }
+    return band;
+}
+
+/**
+ * @brief The bands of one parallelRowBands call, run by OpenCV's thread pool.
+ */
+class RowBandLoop : public cv::ParallelLoopBody
+{
+  public:
+    RowBandLoop(int begin, int rows, int bands, void (*body)(const void *, int, int), const void *bodyData)
+        : begin(begin), rows(rows), bands(bands), body(body), bodyData(bodyData)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for (int band = range.start; band < range.end; band++)
+        {
+            body(bodyData, rowBandBegin(begin, rows, bands, band), rowBandBegin(begin, rows, bands, band + 1));
+        }
+    }
+
+  private:
+    int begin;
+    int rows;
+    int bands;
+    void (*body)(const void *, int, int);
+    const void *bodyData;
+};
+
+/**
+ * @brief Run a row loop in parallel bands, calling body(bodyData, bandBegin, bandEnd) for each band.
+ *
+ * Splits the rows [begin, end) into contiguous bands and runs them on OpenCV's persistent thread pool. Each band only
+ * writes its own destination rows, so the stencil kernels can read their halo rows straight from the source image.
+ *
+ * @param begin The first row.
+ * @param end One past the last row.
+ * @param body The function running one band.
+ * @param bodyData The pointer passed back to body.
+ */
+void parallelRowBands(int begin, int end, void (*body)(const void *bodyData, int bandBegin, int bandEnd),
+                      const void *bodyData)
+{
+    int rows = end - begin;
+    if (rows <= 0)
+    {
+        return;
+    }
+
+    int bands = rowBandCount(rows);
+    if (bands == 1)
+    {
+        body(bodyData, begin, end);
+        return;
+    }
+
+    cv::parallel_for_(cv::Range(0, bands), RowBandLoop(begin, rows, bands, body, bodyData), bands);
+}
+
 /**
  * @brief Convert a color image to greyscale.
  *
  * This function converts a color image to greyscale. It does so by subtracting
  * the red value of each pixel from 255 and setting the red, green, and blue
- * values of each pixel to the resulting value.
+ * values of each pixel to the resulting value. A single-channel image is
+ * treated as its own red channel and inverted.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -25,20 +193,41 @@ int greyscale(cv::Mat &src, cv::Mat &dst)
         return -1;
     }
 
-    dst = src.clone();
+    if (src.depth() != CV_8U || src.channels() == 2)
+    {
+        printf("Expected an 8-bit grey or color image\n");
+        return -1;
+    }
 
-    for (int y = 0; y < dst.rows; ++y)
+    PointOp invert = PointOp::negative();
+    if (src.channels() == 1)
     {
-        for (int x = 0; x < dst.cols; ++x)
-        {
-            cv::Vec3b &pixel = dst.at<cv::Vec3b>(y, x);
+        // A grey pixel is its own red value
+        return invert.apply(src, dst);
+    }
 
-            uchar invertedRed = 255 - pixel[2];
-            pixel[0] = invertedRed;
-            pixel[1] = invertedRed;
-            pixel[2] = invertedRed;
+    int cn = src.channels();
+
+    dst.create(src.size(), src.type());
+
+    parallelRows(0, dst.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y)
+        {
+            const uchar *ptr = src.ptr<uchar>(y);
+            uchar *ptrDst = dst.ptr<uchar>(y);
+            for (int x = 0; x < dst.cols; ++x, ptr += cn, ptrDst += cn)
+            {
+                uchar invertedRed = invert.table[ptr[2]];
+                ptrDst[0] = invertedRed;
+                ptrDst[1] = invertedRed;
+                ptrDst[2] = invertedRed;
+                for (int k = 3; k < cn; k++)
+                {
+                    ptrDst[k] = ptr[k];
+                }
+            }
         }
-    }
+    });
 
     return 0;
 }
@@ -47,7 +236,8 @@ int greyscale(cv::Mat &src, cv::Mat &dst)
  * @brief Convert a color image to sepia tone.
  *
  * This function converts a color image to sepia tone. It does so by applying
- * sepia coefficients to each pixel.
+ * sepia coefficients to each pixel through ColorMatrix::sepia(). A single-channel
+ * grey image gives a 3-channel sepia image.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -61,45 +251,215 @@ int sepiaTone(cv::Mat &src, cv::Mat &dst)
         return -1;
     }
 
-    dst = src.clone();
+    return ColorMatrix::sepia().apply(src, dst);
+}
+
+/**
+ * @brief Check that an image is 8-bit with a channel count the per-pixel kernels are instantiated for.
+ *
+ * @param src The image.
+ * @return true for 8-bit images with 1 to 4 channels.
+ */
+static bool isChannelCountSupported(const cv::Mat &src)
+{
+    return src.depth() == CV_8U && src.channels() >= 1 && src.channels() <= 4;
+}
+
+/**
+ * @brief Index of a pixel depth in the per-depth kernel tables.
+ *
+ * @param depth The OpenCV depth.
+ * @return 0 for 8-bit, 1 for 16-bit and 2 for float images, -1 for depths the templated kernels do not support.
+ */
+static int depthIndex(int depth)
+{
+    return depth == CV_8U ? 0 : depth == CV_16U ? 1 : depth == CV_32F ? 2 : -1;
+}
+
+/**
+ * @brief Depth of the Sobel gradients of an image, from PixelTraits::GRADIENT_DEPTH.
+ *
+ * @param depth The depth of the image, one depthIndex accepts.
+ * @return CV_16S for 8-bit, CV_32S for 16-bit and CV_32F for float images.
+ */
+static int gradientDepth(int depth)
+{
+    static const int depths[3] = {PixelTraits<uchar>::GRADIENT_DEPTH, PixelTraits<ushort>::GRADIENT_DEPTH,
+                                  PixelTraits<float>::GRADIENT_DEPTH};
+    return depths[depthIndex(depth)];
+}
+
+/**
+ * @brief Function filtering the rows [y0, y1) of src into dst, instantiated per channel count.
+ */
+typedef void (*BlurRowsFunc)(const cv::Mat &src, cv::Mat &dst, int borderType, int y0, int y1);
+
+/**
+ * @brief Direct 5x5 Gaussian blur of a band of rows of an image with CN channels.
+ *
+ * The channel count is a template argument, so the channel loops have a fixed length and fold away for a
+ * single-channel image.
+ */
+template <int CN> static void blur5x5_1Rows(const cv::Mat &input, cv::Mat &dst, int borderType, int y0, int y1)
+{
+    typedef cv::Vec<uchar, CN> Pixel;
+
+    static const int kernel[5][5] = {// Gaussian kernel 5x5
+                                     {1, 2, 4, 2, 1},
+                                     {2, 4, 8, 4, 2},
+                                     {4, 8, 16, 8, 4},
+                                     {2, 4, 8, 4, 2},
+                                     {1, 2, 4, 2, 1}};
+    const int kernelSum = 100; // sum of all kernel values
+
+    for (int y = y0; y < y1; y++) // iterate through image rows
+    {
+        for (int x = 0; x < input.cols; x++) // iterate through image columns
+        {
+            int sum[CN] = {0}; // initialize channel values
+
+            for (int ky = -2; ky <= 2; ky++) // iterate through kernel rows
+            {
+                int row = borderIndex(y + ky, input.rows, borderType); // kernel row, mapped into the image
+                if (row < 0)
+                {
+                    continue; // constant border reads as 0
+                }
+
+                for (int kx = -2; kx <= 2; kx++) // iterate through kernel columns
+                {
+                    int col = borderIndex(x + kx, input.cols, borderType);
+                    if (col < 0)
+                    {
+                        continue;
+                    }
+
+                    const Pixel &pixel = input.at<Pixel>(row, col); // get pixel at kernel index
+                    int weight = kernel[ky + 2][kx + 2];            // get kernel weight
+
+                    // Apply kernel to pixel
+                    for (int k = 0; k < CN; k++)
+                    {
+                        sum[k] += pixel[k] * weight;
+                    }
+                }
+            }
+
+            // Set pixel to average of kernel
+            Pixel &out = dst.at<Pixel>(y, x);
+            for (int k = 0; k < CN; k++)
+            {
+                out[k] = static_cast<uchar>(sum[k] / kernelSum);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Horizontal 1x5 pass of blur5x5_2 over a band of rows of an image with CN channels.
+ */
+template <int CN> static void blur5x5_2Horizontal(const cv::Mat &src, cv::Mat &temp, int borderType, int y0, int y1)
+{
+    typedef cv::Vec<uchar, CN> Pixel;
+
+    // 1x5 kernel
+    static const int kernel[5] = {1, 2, 4, 2, 1};
+    const int kernelSum = 10;
 
-    for (int y = 0; y < dst.rows; y++)
+    for (int y = y0; y < y1; ++y) // iterate through image rows
     {
-        for (int x = 0; x < dst.cols; x++)
+        for (int x = 0; x < src.cols; ++x) // iterate through image columns
         {
-            cv::Vec3b pixel = src.at<cv::Vec3b>(y, x);
+            int sum[CN] = {0}; // initialize channel values
 
-            uchar blue = pixel[0];
-            uchar green = pixel[1];
-            uchar red = pixel[2];
+            for (int k = -2; k <= 2; ++k) // iterate through kernel
+            {
+                int col = borderIndex(x + k, src.cols, borderType); // kernel column, mapped into the image
+                if (col < 0)
+                {
+                    continue; // constant border reads as 0
+                }
 
-            // 0.189, 0.168, 0.131  Blue coefficients
-            // 0.769, 0.686, 0.534, Green coefficients
-            // 0.393, 0.349, 0.272, Red coefficients
+                const Pixel &pixel = src.ptr<Pixel>(y)[col]; // get pixel at kernel index
+                int weight = kernel[k + 2];                  // get kernel weight
 
-            // Apply sepia coefficients
-            uchar newRed = std::min(255.0, 0.393 * red + 0.769 * green + 0.189 * blue);
-            uchar newGreen = std::min(255.0, 0.349 * red + 0.686 * green + 0.168 * blue);
-            uchar newBlue = std::min(255.0, 0.272 * red + 0.534 * green + 0.131 * blue);
+                // Apply kernel to pixel
+                for (int c = 0; c < CN; c++)
+                {
+                    sum[c] += pixel[c] * weight;
+                }
+            }
 
-            dst.at<cv::Vec3b>(y, x) = cv::Vec3b(newBlue, newGreen, newRed);
+            // Set pixel to average of kernel
+            Pixel &out = temp.ptr<Pixel>(y)[x];
+            for (int c = 0; c < CN; c++)
+            {
+                out[c] = static_cast<uchar>(sum[c] / kernelSum);
+            }
         }
     }
+}
 
-    return 0;
+/**
+ * @brief Vertical 5x1 pass of blur5x5_2 over a band of rows of an image with CN channels.
+ */
+template <int CN> static void blur5x5_2Vertical(const cv::Mat &temp, cv::Mat &dst, int borderType, int y0, int y1)
+{
+    typedef cv::Vec<uchar, CN> Pixel;
+
+    // 1x5 kernel
+    static const int kernel[5] = {1, 2, 4, 2, 1};
+    const int kernelSum = 10;
+
+    for (int y = y0; y < y1; ++y) // iterate through image rows
+    {
+        for (int x = 0; x < temp.cols; ++x) // iterate through image columns
+        {
+            int sum[CN] = {0}; // initialize channel values
+
+            for (int k = -2; k <= 2; ++k) // iterate through kernel
+            {
+                int row = borderIndex(y + k, temp.rows, borderType); // kernel row, mapped into the image
+                if (row < 0)
+                {
+                    continue; // constant border reads as 0
+                }
+
+                const Pixel &pixel = temp.ptr<Pixel>(row)[x]; // get pixel at kernel index
+                int weight = kernel[k + 2];                   // get kernel weight
+
+                // Apply kernel to pixel
+                for (int c = 0; c < CN; c++)
+                {
+                    sum[c] += pixel[c] * weight;
+                }
+            }
+
+            // Set pixel to average of kernel
+            Pixel &out = dst.ptr<Pixel>(y)[x];
+            for (int c = 0; c < CN; c++)
+            {
+                out[c] = static_cast<uchar>(sum[c] / kernelSum);
+            }
+        }
+    }
 }
 
 /**
  * @brief Blur a color image using a 5x5 Gaussian kernel.
  *
  * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * applying the kernel to each pixel within a nested loop. Images with 1 to 4
+ * channels each run a loop instantiated for their channel count.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_1(cv::Mat &src, cv::Mat &dst)
+int blur5x5_1(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
 {
     if (src.empty())
     {
@@ -107,40 +467,25 @@ int blur5x5_1(cv::Mat &src, cv::Mat &dst)
         return -1;
     }
 
-    dst = src.clone();
-
-    int kernel[5][5] = {// Gaussian kernel 5x5
-                        {1, 2, 4, 2, 1},
-                        {2, 4, 8, 4, 2},
-                        {4, 8, 16, 8, 4},
-                        {2, 4, 8, 4, 2},
-                        {1, 2, 4, 2, 1}};
-    int kernelSum = 100; // sum of all kernel values
+    if (!isBorderSupported(borderType))
+    {
+        printf("Unsupported border type\n");
+        return -1;
+    }
 
-    for (int y = 2; y < src.rows - 2; y++) // iterate through image rows
+    if (!isChannelCountSupported(src))
     {
-        for (int x = 2; x < src.cols - 2; x++) // iterate through image columns
-        {
-            int blue = 0, green = 0, red = 0; // initialize color channel values
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
 
-            for (int ky = -2; ky <= 2; ky++) // iterate through kernel rows
-            {
-                for (int kx = -2; kx <= 2; kx++) // iterate through kernel columns
-                {
-                    cv::Vec3b pixel = src.at<cv::Vec3b>(y + ky, x + kx); // get pixel at kernel index
-                    int weight = kernel[ky + 2][kx + 2];                 // get kernel weight
+    static const BlurRowsFunc blurRows[4] = {blur5x5_1Rows<1>, blur5x5_1Rows<2>, blur5x5_1Rows<3>, blur5x5_1Rows<4>};
+    BlurRowsFunc rowsFunc = blurRows[src.channels() - 1];
 
-                    // Apply kernel to pixel
-                    blue += pixel[0] * weight;
-                    green += pixel[1] * weight;
-                    red += pixel[2] * weight;
-                }
-            }
+    cv::Mat input = stencilInput(src, dst, ctx);
+    dst.create(src.size(), src.type());
 
-            // Set pixel to average of kernel
-            dst.at<cv::Vec3b>(y, x) = cv::Vec3b(blue / kernelSum, green / kernelSum, red / kernelSum);
-        }
-    }
+    parallelRows(0, input.rows, [&](int y0, int y1) { rowsFunc(input, dst, borderType, y0, y1); });
 
     return 0;
 }
@@ -150,12 +495,16 @@ int blur5x5_1(cv::Mat &src, cv::Mat &dst)
  *
  * This function blurs a color image using a 1x5 Gaussian kernel. It does so by
  * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal).
+ * Images with 1 to 4 channels each run loops instantiated for their channel count.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_2(cv::Mat &src, cv::Mat &dst)
+int blur5x5_2(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
 {
     if (src.empty())
     {
@@ -163,77 +512,4719 @@ int blur5x5_2(cv::Mat &src, cv::Mat &dst)
         return -1;
     }
 
-    dst = src.clone();
+    if (!isBorderSupported(borderType))
+    {
+        printf("Unsupported border type\n");
+        return -1;
+    }
+
+    if (!isChannelCountSupported(src))
+    {
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
 
-    // 1x5 kernel
-    int kernel[5] = {1, 2, 4, 2, 1};
-    int kernelSum = 10;
+    static const BlurRowsFunc horizontalRows[4] = {blur5x5_2Horizontal<1>, blur5x5_2Horizontal<2>,
+                                                   blur5x5_2Horizontal<3>, blur5x5_2Horizontal<4>};
+    static const BlurRowsFunc verticalRows[4] = {blur5x5_2Vertical<1>, blur5x5_2Vertical<2>, blur5x5_2Vertical<3>,
+                                                 blur5x5_2Vertical<4>};
+    BlurRowsFunc horizontal = horizontalRows[src.channels() - 1];
+    BlurRowsFunc vertical = verticalRows[src.channels() - 1];
 
-    cv::Mat temp = cv::Mat::zeros(src.size(), src.type()); // Temporary image used for horizontal pass
+    // Temporary image used for horizontal pass. The vertical pass only reads temp, so dst may be the same as src.
+    cv::Mat local;
+    cv::Mat &temp = scratchImage(ctx, FilterContext::SCRATCH_TEMP, src.rows, src.cols, src.type(), local);
 
     // Horizontal pass
-    for (int y = 0; y < src.rows; ++y) // iterate through image rows
-    {
-        for (int x = 2; x < src.cols - 2; ++x) // iterate through image columns
-        {
-            int blue = 0, green = 0, red = 0; // initialize color channel values
+    parallelRows(0, src.rows, [&](int y0, int y1) { horizontal(src, temp, borderType, y0, y1); });
 
-            for (int k = -2; k <= 2; ++k) // iterate through kernel
-            {
-                // printf("y: %d, x: %d, k: %d\n", y, x, k);
-                cv::Vec3b pixel = src.ptr<cv::Vec3b>(y)[x + k]; // get pixel at kernel index
-                int weight = kernel[k + 2];                     // get kernel weight
+    // Vertical pass
+    dst.create(src.size(), src.type());
+    parallelRows(0, temp.rows, [&](int y0, int y1) { vertical(temp, dst, borderType, y0, y1); });
 
-                // Apply kernel to pixel
-                blue += pixel[0] * weight;
-                green += pixel[1] * weight;
-                red += pixel[2] * weight;
-            }
+    return 0;
+}
+
+/**
+ * @brief Blur a color image using a 5x5 Gaussian kernel.
+ *
+ * This function blurs a color image using a 5x5 Gaussian kernel. It no longer has a loop of its own: the kernel is
+ * applied as two 1x5 passes by Gauss5x5Filter::apply, which gives the same result as the full 5x5 sum. Works on 8-bit,
+ * 16-bit and float images.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blur5x5_3(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+{
+    return Gauss5x5Filter::apply(src, dst, borderType, ctx);
+}
+
+/**
+ * @brief Blur a color image using a 5x5 Gaussian kernel.
+ *
+ * This function blurs a color image using a 5x5 Gaussian kernel. Like blur5x5_3 it delegates to
+ * Gauss5x5Filter::apply, which applies the kernel as two 1x5 passes and gives the same result as the full 5x5 sum.
+ * Works on 8-bit, 16-bit and float images.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ **/
+int blur5x5_4(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+{
+    return Gauss5x5Filter::apply(src, dst, borderType, ctx);
+}
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sums over part of an interleaved 8-bit row.
+ *
+ * Works on the row as a flat byte array, so neighbouring pixels are `cn` bytes apart and all channels are handled in
+ * the same loop. Writes dst[i] for i in [begin, end); the caller keeps i - 2 * cn and i + 2 * cn inside the row. The
+ * sums are not divided, so the vertical pass can divide once and match the full 5x5 convolution exactly.
+ *
+ * @param src The source row.
+ * @param dst The destination row of sums, at most 2550 each.
+ * @param begin The first byte to write.
+ * @param end One past the last byte to write.
+ * @param cn The number of channels (byte distance between horizontal neighbours).
+ */
+static void blurRow5Scalar(const uchar *src, ushort *dst, int begin, int end, int cn)
+{
+    for (int i = begin; i < end; i++)
+    {
+        dst[i] = src[i - 2 * cn] + 2 * src[i - cn] + 4 * src[i] + 2 * src[i + cn] + src[i + 2 * cn];
+    }
+}
+
+/**
+ * @brief Vertical 1-2-4-2-1 pass over part of a row, given the five rows of horizontal sums centred on it.
+ *
+ * @param rows The five rows of horizontal sums, top to bottom.
+ * @param dst The destination row.
+ * @param begin The first byte to write.
+ * @param end One past the last byte to write.
+ */
+static void blurCol5Scalar(const ushort *const rows[5], uchar *dst, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        int sum = rows[0][i] + 2 * rows[1][i] + 4 * rows[2][i] + 2 * rows[3][i] + rows[4][i];
+        dst[i] = sum / 100;
+    }
+}
+
+#ifdef SIMD_X86
+// The full 5x5 sums are at most 25500, so both passes fit in 16 bits and sum / 100 == (sum * 41944) >> 22 holds
+// exactly for every value. That keeps the SIMD paths bit-exact with the scalar integer division.
+
+/**
+ * @brief Weighted 1-2-4-2-1 sum of five vectors of 16-bit values, using SSE4.1.
+ */
+SIMD_TARGET_SSE41 static inline __m128i blurTaps5SSE41(__m128i a, __m128i b, __m128i c, __m128i d, __m128i e)
+{
+    __m128i outer = _mm_add_epi16(a, e);
+    __m128i inner = _mm_add_epi16(b, d);
+    return _mm_add_epi16(outer, _mm_add_epi16(_mm_slli_epi16(inner, 1), _mm_slli_epi16(c, 2)));
+}
+
+/**
+ * @brief Load 8 bytes and widen them to 16 bits, using SSE4.1.
+ */
+SIMD_TARGET_SSE41 static inline __m128i loadWiden8SSE41(const uchar *p)
+{
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)p));
+}
+
+/**
+ * @brief Vertical 1-2-4-2-1 sum of 8 columns divided by 100, using SSE4.1.
+ */
+SIMD_TARGET_SSE41 static inline __m128i blurCol8SSE41(const ushort *const rows[5], int i)
+{
+    __m128i sum = blurTaps5SSE41(_mm_loadu_si128((const __m128i *)(rows[0] + i)),
+                                 _mm_loadu_si128((const __m128i *)(rows[1] + i)),
+                                 _mm_loadu_si128((const __m128i *)(rows[2] + i)),
+                                 _mm_loadu_si128((const __m128i *)(rows[3] + i)),
+                                 _mm_loadu_si128((const __m128i *)(rows[4] + i)));
+    return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((short)41944)), 6);
+}
+
+/**
+ * @brief SSE4.1 version of blurRow5Scalar. Processes 8 bytes per iteration.
+ *
+ * @return The first byte that was not written; the caller finishes the tail with the scalar loop.
+ */
+SIMD_TARGET_SSE41 static int blurRow5SSE41(const uchar *src, ushort *dst, int begin, int end, int cn)
+{
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m128i sum = blurTaps5SSE41(loadWiden8SSE41(src + i - 2 * cn), loadWiden8SSE41(src + i - cn),
+                                     loadWiden8SSE41(src + i), loadWiden8SSE41(src + i + cn),
+                                     loadWiden8SSE41(src + i + 2 * cn));
+        _mm_storeu_si128((__m128i *)(dst + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief SSE4.1 version of blurCol5Scalar. Processes 16 bytes per iteration.
+ *
+ * @return The first byte that was not written.
+ */
+SIMD_TARGET_SSE41 static int blurCol5SSE41(const ushort *const rows[5], uchar *dst, int begin, int end)
+{
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i blurred = _mm_packus_epi16(blurCol8SSE41(rows, i), blurCol8SSE41(rows, i + 8));
+        _mm_storeu_si128((__m128i *)(dst + i), blurred);
+    }
+    return i;
+}
+
+/**
+ * @brief Weighted 1-2-4-2-1 sum of five vectors of 16-bit values, using AVX2.
+ */
+SIMD_TARGET_AVX2 static inline __m256i blurTaps5AVX2(__m256i a, __m256i b, __m256i c, __m256i d, __m256i e)
+{
+    __m256i outer = _mm256_add_epi16(a, e);
+    __m256i inner = _mm256_add_epi16(b, d);
+    return _mm256_add_epi16(outer, _mm256_add_epi16(_mm256_slli_epi16(inner, 1), _mm256_slli_epi16(c, 2)));
+}
+
+/**
+ * @brief Load 16 bytes and widen them to 16 bits, using AVX2.
+ */
+SIMD_TARGET_AVX2 static inline __m256i loadWiden16AVX2(const uchar *p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+}
+
+/**
+ * @brief Vertical 1-2-4-2-1 sum of 16 columns divided by 100, using AVX2.
+ */
+SIMD_TARGET_AVX2 static inline __m256i blurCol16AVX2(const ushort *const rows[5], int i)
+{
+    __m256i sum = blurTaps5AVX2(_mm256_loadu_si256((const __m256i *)(rows[0] + i)),
+                                _mm256_loadu_si256((const __m256i *)(rows[1] + i)),
+                                _mm256_loadu_si256((const __m256i *)(rows[2] + i)),
+                                _mm256_loadu_si256((const __m256i *)(rows[3] + i)),
+                                _mm256_loadu_si256((const __m256i *)(rows[4] + i)));
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(sum, _mm256_set1_epi16((short)41944)), 6);
+}
+
+/**
+ * @brief AVX2 version of blurRow5Scalar. Processes 16 bytes per iteration.
+ *
+ * @return The first byte that was not written.
+ */
+SIMD_TARGET_AVX2 static int blurRow5AVX2(const uchar *src, ushort *dst, int begin, int end, int cn)
+{
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m256i sum = blurTaps5AVX2(loadWiden16AVX2(src + i - 2 * cn), loadWiden16AVX2(src + i - cn),
+                                    loadWiden16AVX2(src + i), loadWiden16AVX2(src + i + cn),
+                                    loadWiden16AVX2(src + i + 2 * cn));
+        _mm256_storeu_si256((__m256i *)(dst + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief AVX2 version of blurCol5Scalar. Processes 32 bytes per iteration.
+ *
+ * The pack instruction works within 128-bit lanes, so a cross-lane permute puts the bytes back in order.
+ *
+ * @return The first byte that was not written.
+ */
+SIMD_TARGET_AVX2 static int blurCol5AVX2(const ushort *const rows[5], uchar *dst, int begin, int end)
+{
+    int i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i blurred = _mm256_packus_epi16(blurCol16AVX2(rows, i), blurCol16AVX2(rows, i + 16));
+        blurred = _mm256_permute4x64_epi64(blurred, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(dst + i), blurred);
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sum at one pixel near the edge of a row, reading outside pixels by the border mode.
+ *
+ * @param src The source row.
+ * @param dst The destination sums of the pixel, one per channel.
+ * @param x The pixel to write.
+ * @param cols The row length in pixels.
+ * @param cn The number of channels.
+ * @param borderType The OpenCV border mode.
+ */
+static void blurEdge5(const uchar *src, ushort *dst, int x, int cols, int cn, int borderType)
+{
+    static const int kernel[5] = {1, 2, 4, 2, 1};
+    for (int c = 0; c < cn; c++)
+    {
+        int sum = 0;
+        for (int k = 0; k < 5; k++)
+        {
+            int col = borderIndex(x + k - 2, cols, borderType);
+            if (col >= 0)
+            {
+                sum += kernel[k] * src[col * cn + c];
+            }
+        }
+        dst[c] = static_cast<ushort>(sum);
+    }
+}
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sums over the pixels [x0, x1) of one image row using the best instruction set available.
+ *
+ * @param src The source image.
+ * @param y The row to filter. Rows outside the image are read by the border mode.
+ * @param dst The destination sums, (x1 - x0) * src.channels() long. dst[0] holds the first channel of pixel x0.
+ * @param x0 The first pixel to filter.
+ * @param x1 One past the last pixel to filter.
+ * @param borderType The OpenCV border mode.
+ */
+static void blurRow5(const cv::Mat &src, int y, ushort *dst, int x0, int x1, int borderType)
+{
+    int cn = src.channels();
+    int row = borderIndex(y, src.rows, borderType);
+    if (row < 0)
+    {
+        memset(dst, 0, (x1 - x0) * cn * sizeof(ushort));
+        return;
+    }
+
+    // The kernels index from pixel x0, which still leaves the two pixels left of any pixel they write inside the row
+    const uchar *ptr = src.ptr<uchar>(row);
+    const uchar *ptrRange = ptr + x0 * cn;
+    int left = std::min(std::max(2, x0), x1);               // first pixel the kernel fits over
+    int right = std::max(std::min(src.cols - 2, x1), left); // first pixel past the ones it fits over
+    int i = (left - x0) * cn;
+    int end = (right - x0) * cn;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = blurRow5AVX2(ptrRange, dst, i, end, cn);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i = blurRow5SSE41(ptrRange, dst, i, end, cn);
+    }
+#endif
+    blurRow5Scalar(ptrRange, dst, i, end, cn);
+
+    for (int x = x0; x < left; x++)
+    {
+        blurEdge5(ptr, dst + (x - x0) * cn, x, src.cols, cn, borderType);
+    }
+    for (int x = right; x < x1; x++)
+    {
+        blurEdge5(ptr, dst + (x - x0) * cn, x, src.cols, cn, borderType);
+    }
+}
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sums over one whole image row.
+ */
+static void blurRow5(const cv::Mat &src, int y, ushort *dst, int borderType)
+{
+    blurRow5(src, y, dst, 0, src.cols, borderType);
+}
+
+/**
+ * @brief Vertical 1-2-4-2-1 pass over part of a row using the best instruction set available.
+ */
+static void blurCol5(const ushort *const rows[5], uchar *dst, int begin, int end)
+{
+    int i = begin;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = blurCol5AVX2(rows, dst, i, end);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i = blurCol5SSE41(rows, dst, i, end);
+    }
+#endif
+    blurCol5Scalar(rows, dst, i, end);
+}
+
+// Rows of horizontal sums blur5x5_5 keeps per band: the five-row ring, then the two rows below the band
+static const int BLUR5_RING_ROWS = 5;
+static const int BLUR5_BAND_ROWS = BLUR5_RING_ROWS + 2;
+
+/**
+ * @brief The streaming pass of blur5x5_5, with the vertical pass of each output row left to a function.
+ *
+ * Each band of rows keeps a ring of the last five rows of horizontal sums and calls rowFunc for an output row as soon
+ * as the ring holds the rows it needs. rowFunc may read source row y while it writes dst row y, even in place: rows
+ * are only written by the band that owns them, after the sums that need them are taken.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image, created with the size and type of src. May be the same as src.
+ * @param borderType How pixels outside the image are read.
+ * @param ctx Optional context that provides the ring buffers.
+ * @param rowFunc Writes dst row y given the five rows of horizontal sums centred on it, as
+ * rowFunc(const ushort *const window[5], int y).
+ */
+template <typename RowFunc>
+static void blur5Stream(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx, const RowFunc &rowFunc)
+{
+    int rows = src.rows;
+    int width = src.cols * src.channels(); // row length in bytes
+    int bands = rowBandCount(rows);
+
+    cv::Mat local;
+    cv::Mat &ring = scratchImage(ctx, FilterContext::SCRATCH_TEMP, bands * BLUR5_BAND_ROWS, width, CV_16U, local);
+    int step = static_cast<int>(ring.step1());
+
+    // The two rows above and below each band belong to its neighbours, which overwrite them when the call is in place.
+    // Filter them before any band starts writing: the rows above go into the first two ring slots, the rows below
+    // after the ring.
+    for (int band = 0; band < bands; band++)
+    {
+        int y0 = rowBandBegin(0, rows, bands, band);
+        int y1 = rowBandBegin(0, rows, bands, band + 1);
+        ushort *block = ring.ptr<ushort>(band * BLUR5_BAND_ROWS);
+        blurRow5(src, y0 - 2, block, borderType);
+        blurRow5(src, y0 - 1, block + step, borderType);
+        blurRow5(src, y1, block + BLUR5_RING_ROWS * step, borderType);
+        blurRow5(src, y1 + 1, block + (BLUR5_RING_ROWS + 1) * step, borderType);
+    }
+
+    // parallelRows splits the rows into the same bands. Each band only reads source rows of its own, and has read
+    // row y + 2 into the ring before it writes row y, so src and dst may be the same image.
+    dst.create(src.size(), src.type());
+    parallelRows(0, rows, [&](int y0, int y1) {
+        ushort *block = ring.ptr<ushort>(rowBandIndex(0, rows, bands, y0) * BLUR5_BAND_ROWS);
+
+        // Row r of horizontal sums: in the ring at (r - y0 + 2) % 5, or after the ring for the rows below the band
+        auto sums = [&](int r) -> ushort * {
+            return block + (r < y1 ? (r - y0 + 2) % BLUR5_RING_ROWS : BLUR5_RING_ROWS + r - y1) * step;
+        };
+
+        for (int r = y0; r < std::min(y0 + 2, y1); r++)
+        {
+            blurRow5(src, r, sums(r), borderType);
+        }
+        for (int y = y0; y < y1; y++)
+        {
+            if (y + 2 < y1)
+            {
+                blurRow5(src, y + 2, sums(y + 2), borderType);
+            }
+
+            const ushort *window[5] = {sums(y - 2), sums(y - 1), sums(y), sums(y + 1), sums(y + 2)};
+            rowFunc(window, y);
+        }
+    });
+}
+
+/**
+ * @brief Blur a color image using a 1x5 Gaussian kernel.
+ *
+ * This function blurs a color image using a 1x5 Gaussian kernel. It does so by
+ * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal).
+ *
+ * The two passes are fused into one streaming pass. Each band of rows keeps a ring of the last five rows of horizontal
+ * sums and writes an output row as soon as the ring holds the rows it needs, so the scratch memory is a few rows per
+ * thread and stays in cache. The sums are kept at full precision and divided once, so the result is exactly the 5x5
+ * convolution with truncating division. The passes run on whole rows with AVX2 or SSE4.1 when the CPU supports them
+ * and fall back to scalar code otherwise; every path produces the same bytes. Pixels within two of the edge are
+ * filtered too, reading the pixels outside the image according to the border mode. 16-bit and float images are
+ * filtered by Gauss5x5Filter, which gives the same result in two passes.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blur5x5_5(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != CV_8U)
+    {
+        // 16-bit and float images run the same kernel through the two-pass filter templated on the pixel type
+        return Gauss5x5Filter::apply(src, dst, borderType, ctx);
+    }
+
+    if (!isBorderSupported(borderType))
+    {
+        printf("Unsupported border type\n");
+        return -1;
+    }
+
+    int width = src.cols * src.channels(); // row length in bytes
+    blur5Stream(src, dst, borderType, ctx,
+                [&](const ushort *const window[5], int y) { blurCol5(window, dst.ptr<uchar>(y), 0, width); });
+
+    return 0;
+}
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sum at one even pixel near the edge of a row, reading outside pixels by the border mode.
+ *
+ * @param src The source row.
+ * @param dst The destination row of sums, one pixel for every two source pixels.
+ * @param x The pixel of dst to write, centred on source pixel 2 * x.
+ * @param cols The source row length in pixels.
+ * @param cn The number of channels.
+ * @param borderType The OpenCV border mode.
+ */
+static void blurEdge5Even(const uchar *src, ushort *dst, int x, int cols, int cn, int borderType)
+{
+    static const int kernel[5] = {1, 2, 4, 2, 1};
+    for (int c = 0; c < cn; c++)
+    {
+        int sum = 0;
+        for (int k = 0; k < 5; k++)
+        {
+            int col = borderIndex(2 * x + k - 2, cols, borderType);
+            if (col >= 0)
+            {
+                sum += kernel[k] * src[col * cn + c];
+            }
+        }
+        dst[x * cn + c] = static_cast<ushort>(sum);
+    }
+}
+
+/**
+ * @brief Horizontal 1-2-4-2-1 sums at the even pixels of one image row, for pyrDown5x5.
+ *
+ * @param src The source image.
+ * @param y The row to filter. Rows outside the image are read by the border mode.
+ * @param dst The destination row of sums, one pixel for every two source pixels.
+ * @param dstCols The number of pixels in dst.
+ * @param borderType The OpenCV border mode.
+ */
+static void blurRow5Even(const cv::Mat &src, int y, ushort *dst, int dstCols, int borderType)
+{
+    int cn = src.channels();
+    int row = borderIndex(y, src.rows, borderType);
+    if (row < 0)
+    {
+        memset(dst, 0, dstCols * cn * sizeof(ushort));
+        return;
+    }
+
+    // Output pixels whose five taps all fall inside the row: 2 * x - 2 >= 0 and 2 * x + 2 < cols
+    const uchar *ptr = src.ptr<uchar>(row);
+    int left = std::min(1, dstCols);
+    int right = std::max(std::min((src.cols - 1) / 2, dstCols), left);
+    for (int x = left; x < right; x++)
+    {
+        const uchar *p = ptr + 2 * x * cn;
+        ushort *d = dst + x * cn;
+        for (int c = 0; c < cn; c++)
+        {
+            d[c] = p[c - 2 * cn] + 2 * p[c - cn] + 4 * p[c] + 2 * p[c + cn] + p[c + 2 * cn];
+        }
+    }
+
+    for (int x = 0; x < left; x++)
+    {
+        blurEdge5Even(ptr, dst, x, src.cols, cn, borderType);
+    }
+    for (int x = right; x < dstCols; x++)
+    {
+        blurEdge5Even(ptr, dst, x, src.cols, cn, borderType);
+    }
+}
+
+/**
+ * @brief Blur an image with the 5x5 kernel of blur5x5_5 and halve it, as one level of a Gaussian pyramid.
+ *
+ * Each band of output rows keeps a ring of five rows of horizontal sums, taken only at the even source pixels. Output
+ * row y reads source rows 2y - 2 to 2y + 2, so every step adds the two rows below and drops the two above; the
+ * vertical pass is the same SIMD kernel blur5x5_5 uses, so the result matches its even rows and columns exactly.
+ *
+ * @param src The source image.
+ * @param dst The destination image, (src.cols + 1) / 2 by (src.rows + 1) / 2 pixels. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int pyrDown5x5(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (!isChannelCountSupported(src))
+    {
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    if (!isBorderSupported(borderType))
+    {
+        printf("Unsupported border type\n");
+        return -1;
+    }
+
+    // Keep a header on the source, since dst has a new size and reallocating it would release src when they alias
+    cv::Mat input = src;
+    int rows = (input.rows + 1) / 2;
+    int cols = (input.cols + 1) / 2;
+    int width = cols * input.channels(); // output row length in bytes
+    int bands = rowBandCount(rows);
+
+    cv::Mat local;
+    cv::Mat &ring = scratchImage(ctx, FilterContext::SCRATCH_TEMP, bands * BLUR5_RING_ROWS, width, CV_16U, local);
+    int step = static_cast<int>(ring.step1());
+
+    dst.create(rows, cols, input.type());
+    parallelRows(0, rows, [&](int y0, int y1) {
+        ushort *block = ring.ptr<ushort>(rowBandIndex(0, rows, bands, y0) * BLUR5_RING_ROWS);
+
+        // Source row r of horizontal sums, from 2 * y0 - 2 on, in the ring at (r - 2 * y0 + 2) % 5
+        auto sums = [&](int r) -> ushort * { return block + (r - 2 * y0 + 2) % BLUR5_RING_ROWS * step; };
+
+        for (int r = 2 * y0 - 2; r < 2 * y0 + 1; r++)
+        {
+            blurRow5Even(input, r, sums(r), cols, borderType);
+        }
+        for (int y = y0; y < y1; y++)
+        {
+            for (int r = std::max(2 * y + 1, 2 * y0 + 1); r <= 2 * y + 2; r++)
+            {
+                blurRow5Even(input, r, sums(r), cols, borderType);
+            }
+
+            const ushort *window[5] = {sums(2 * y - 2), sums(2 * y - 1), sums(2 * y), sums(2 * y + 1), sums(2 * y + 2)};
+            blurCol5(window, dst.ptr<uchar>(y), 0, width);
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Blur a color image using a 3x3 Gaussian kernel.
+ *
+ * This function blurs a color image using a 3x3 Gaussian kernel.
+ *
+ * The kernel is applied as two 1x3 passes by Gauss3x3Filter, which gives the same result as the full 3x3 sum.
+ * Works on 8-bit, 16-bit and float images.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int gauss3x3at(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx) // pass images by reference
+{
+    return Gauss3x3Filter::apply(src, dst, borderType, ctx);
+}
+
+/**
+ * @brief Clamp a pixel index to [0, size - 1], replicating the edge pixels outside the image.
+ */
+static inline int clampIndex(int i, int size)
+{
+    return std::min(std::max(i, 0), size - 1);
+}
+
+/**
+ * @brief Fixed-point reciprocal of a box window size, so the running sums are averaged with a multiply and a shift.
+ */
+static inline uint64_t boxScale(int size)
+{
+    return ((uint64_t(1) << 32) + size / 2) / size;
+}
+
+/**
+ * @brief Rounded average of a window sum, given the scale returned by boxScale.
+ */
+static inline uchar boxAverage(int sum, uint64_t scale)
+{
+    return static_cast<uchar>((sum * scale + (uint64_t(1) << 31)) >> 32);
+}
+
+/**
+ * @brief Blur an image with a (2 * radius + 1) square box filter in time independent of the radius.
+ *
+ * This function blurs an image by averaging every pixel with its neighbours in a square window. It keeps running sums
+ * that add the pixel entering the window and subtract the one leaving it, first along each row and then down each
+ * column, so every pixel costs the same few additions whatever the radius. Pixels outside the image repeat the nearest
+ * edge pixel.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param radius The radius of the window. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int boxBlur(cv::Mat &src, cv::Mat &dst, int radius, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != CV_8U || radius < 0)
+    {
+        printf("Expected an 8-bit image and a non-negative radius\n");
+        return -1;
+    }
+
+    if (radius == 0)
+    {
+        src.copyTo(dst);
+        return 0;
+    }
+
+    int cn = src.channels();
+    int width = src.cols * cn; // row length in bytes
+    uint64_t scale = boxScale(2 * radius + 1);
+
+    // Horizontal pass. The vertical pass only reads temp, so src and dst may be the same image.
+    cv::Mat local;
+    cv::Mat &temp = scratchImage(ctx, FilterContext::SCRATCH_TEMP, src.rows, src.cols, src.type(), local);
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const uchar *ptrSrc = src.ptr<uchar>(y);
+            uchar *ptrTemp = temp.ptr<uchar>(y);
+            for (int k = 0; k < cn; k++)
+            {
+                int sum = 0;
+                for (int x = -radius; x <= radius; x++)
+                {
+                    sum += ptrSrc[clampIndex(x, src.cols) * cn + k];
+                }
+                for (int x = 0; x < src.cols; x++)
+                {
+                    ptrTemp[x * cn + k] = boxAverage(sum, scale);
+                    sum += ptrSrc[clampIndex(x + radius + 1, src.cols) * cn + k];
+                    sum -= ptrSrc[clampIndex(x - radius, src.cols) * cn + k];
+                }
+            }
+        }
+    });
+
+    // Vertical pass. Each band starts its column sums from the window around its first row.
+    int bands = rowBandCount(src.rows);
+    cv::Mat localSums;
+    cv::Mat &bandSums = scratchImage(ctx, FilterContext::SCRATCH_BANDS, bands, width, CV_32S, localSums);
+    dst.create(src.size(), src.type());
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        int *sums = bandSums.ptr<int>(rowBandIndex(0, src.rows, bands, y0));
+        std::fill(sums, sums + width, 0);
+        for (int y = y0 - radius; y <= y0 + radius; y++)
+        {
+            const uchar *ptrTemp = temp.ptr<uchar>(clampIndex(y, temp.rows));
+            for (int i = 0; i < width; i++)
+            {
+                sums[i] += ptrTemp[i];
+            }
+        }
+
+        for (int y = y0; y < y1; y++)
+        {
+            uchar *ptrDst = dst.ptr<uchar>(y);
+            const uchar *ptrIn = temp.ptr<uchar>(clampIndex(y + radius + 1, temp.rows));
+            const uchar *ptrOut = temp.ptr<uchar>(clampIndex(y - radius, temp.rows));
+            for (int i = 0; i < width; i++)
+            {
+                ptrDst[i] = boxAverage(sums[i], scale);
+                sums[i] += ptrIn[i] - ptrOut[i];
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Blur an image with an approximate Gaussian kernel built from three box blurs.
+ *
+ * This function approximates a Gaussian blur of the given standard deviation by running boxBlur three times, with
+ * window sizes picked so the variance of the combined kernel matches sigma as closely as odd sizes allow. The cost per
+ * pixel does not depend on sigma.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param sigma The standard deviation of the Gaussian, in pixels. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int boxGaussianBlur(cv::Mat &src, cv::Mat &dst, double sigma, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (sigma < 0)
+    {
+        printf("Expected a non-negative sigma\n");
+        return -1;
+    }
+
+    // A box of width w has variance (w^2 - 1) / 12. Use the two odd widths around the ideal one, and pick how many
+    // passes get the smaller width so the variances add up to sigma^2.
+    const int passes = 3;
+    double variance = 12 * sigma * sigma;
+    int lower = static_cast<int>(floor(sqrt(variance / passes + 1)));
+    if (lower % 2 == 0)
+    {
+        lower--;
+    }
+    int upper = lower + 2;
+    int lowerPasses = cvRound((variance - passes * lower * lower - 4 * passes * lower - 3 * passes) / (-4 * lower - 4));
+    lowerPasses = std::min(std::max(lowerPasses, 0), passes);
+
+    cv::Mat *input = &src;
+    for (int i = 0; i < passes; i++)
+    {
+        int size = (i < lowerPasses) ? lower : upper;
+        if (boxBlur(*input, dst, size / 2, ctx) != 0)
+        {
+            return -1;
+        }
+        input = &dst;
+    }
+
+    return 0;
+}
+
+// Histograms the median filter keeps for each column: 256 fine bins, one per value, and 16 coarse bins, one per group
+// of 16 values. The counts fit in 16 bits for every radius medianFilter accepts.
+static const int MEDIAN_FINE_BINS = 256;
+static const int MEDIAN_GROUP_BINS = 16;
+static const int MEDIAN_MAX_RADIUS = 127;
+
+// Columns of histograms a stripe of the median filter keeps, halo included. The fine histograms of a stripe then take
+// 128 KB and stay in the L2 cache while the stripe moves down the band.
+static const int MEDIAN_STRIPE_COLUMNS = 256;
+static const int MEDIAN_MIN_STRIPE_WIDTH = 32;
+
+/**
+ * @brief Find the bin of 16 that holds the pixel of a given rank.
+ *
+ * The bins are counted without branching on the counts, which would mispredict on noisy images.
+ *
+ * @param bins The 16 bins.
+ * @param rank The number of pixels below the one to find, across these bins and the ones before them.
+ * @param below The number of pixels in the bins before these, increased by those in the bins below the one returned.
+ * @return The bin, from 0 to 15.
+ */
+static inline int medianBin(const ushort *bins, int rank, int &below)
+{
+    int bin = 0;
+    int sum = below;
+    int skipped = 0;
+    for (int i = 0; i < MEDIAN_GROUP_BINS; i++)
+    {
+        sum += bins[i];
+        int isBelow = sum <= rank;
+        bin += isBelow;
+        skipped += isBelow * bins[i];
+    }
+    below += skipped;
+    return bin;
+}
+
+/**
+ * @brief Additions and searches of 16-bin histogram groups for the median filter, in scalar code.
+ */
+struct MedianBinsScalar
+{
+    static inline void add(ushort *acc, const ushort *bins)
+    {
+        for (int i = 0; i < MEDIAN_GROUP_BINS; i++)
+        {
+            acc[i] += bins[i];
+        }
+    }
+
+    static inline void addSub(ushort *acc, const ushort *added, const ushort *removed)
+    {
+        for (int i = 0; i < MEDIAN_GROUP_BINS; i++)
+        {
+            acc[i] += added[i] - removed[i];
+        }
+    }
+
+    static inline int find(const ushort *bins, int rank, int &below)
+    {
+        return medianBin(bins, rank, below);
+    }
+};
+
+#ifdef SIMD_X86
+/**
+ * @brief Additions and searches of 16-bin histogram groups for the median filter, 8 bins at a time, using SSE4.1.
+ */
+struct MedianBinsSSE41
+{
+    SIMD_TARGET_SSE41 static inline void add(ushort *acc, const ushort *bins)
+    {
+        for (int i = 0; i < MEDIAN_GROUP_BINS; i += 8)
+        {
+            __m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc + i)),
+                                        _mm_loadu_si128((const __m128i *)(bins + i)));
+            _mm_storeu_si128((__m128i *)(acc + i), sum);
+        }
+    }
+
+    SIMD_TARGET_SSE41 static inline void addSub(ushort *acc, const ushort *added, const ushort *removed)
+    {
+        for (int i = 0; i < MEDIAN_GROUP_BINS; i += 8)
+        {
+            __m128i sum = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(acc + i)),
+                                        _mm_loadu_si128((const __m128i *)(added + i)));
+            sum = _mm_sub_epi16(sum, _mm_loadu_si128((const __m128i *)(removed + i)));
+            _mm_storeu_si128((__m128i *)(acc + i), sum);
+        }
+    }
+
+    /**
+     * @brief medianBin on 16 bins, from running sums of each 8-bin half compared with the rank at once.
+     */
+    SIMD_TARGET_SSE41 static inline int find(const ushort *bins, int rank, int &below)
+    {
+        __m128i target = _mm_set1_epi16(static_cast<short>(rank - below));
+        ushort sums[MEDIAN_GROUP_BINS];
+        int bin = 0;
+        int carry = 0;
+        for (int i = 0; i < MEDIAN_GROUP_BINS; i += 8)
+        {
+            __m128i sum = _mm_loadu_si128((const __m128i *)(bins + i));
+            sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 2));
+            sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 4));
+            sum = _mm_add_epi16(sum, _mm_slli_si128(sum, 8));
+            sum = _mm_add_epi16(sum, _mm_set1_epi16(static_cast<short>(carry)));
+            _mm_storeu_si128((__m128i *)(sums + i), sum);
+            carry = sums[i + 7];
+
+            // Running sums up to the rank, compared unsigned since they can pass 32767. They rise with the bin, so the
+            // bins below are the low run of set mask bits, two bits per bin.
+            __m128i isBelow = _mm_cmpeq_epi16(_mm_min_epu16(sum, target), sum);
+            bin += __builtin_ctz(~static_cast<unsigned>(_mm_movemask_epi8(isBelow))) / 2;
+        }
+        if (bin > 0)
+        {
+            below += sums[bin - 1];
+        }
+        return bin;
+    }
+};
+
+/**
+ * @brief Additions and searches of 16-bin histogram groups for the median filter, all 16 bins at once, using AVX2.
+ */
+struct MedianBinsAVX2
+{
+    SIMD_TARGET_AVX2 static inline void add(ushort *acc, const ushort *bins)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)acc),
+                                       _mm256_loadu_si256((const __m256i *)bins));
+        _mm256_storeu_si256((__m256i *)acc, sum);
+    }
+
+    SIMD_TARGET_AVX2 static inline void addSub(ushort *acc, const ushort *added, const ushort *removed)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)acc),
+                                       _mm256_loadu_si256((const __m256i *)added));
+        sum = _mm256_sub_epi16(sum, _mm256_loadu_si256((const __m256i *)removed));
+        _mm256_storeu_si256((__m256i *)acc, sum);
+    }
+
+    /**
+     * @brief medianBin on 16 bins, from running sums of all of them compared with the rank at once.
+     */
+    SIMD_TARGET_AVX2 static inline int find(const ushort *bins, int rank, int &below)
+    {
+        // Running sums within each 128-bit half, then the low half's total added to the high half
+        __m256i sum = _mm256_loadu_si256((const __m256i *)bins);
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 2));
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 4));
+        sum = _mm256_add_epi16(sum, _mm256_slli_si256(sum, 8));
+        __m128i low = _mm256_castsi256_si128(sum);
+        __m128i total = _mm_unpackhi_epi64(_mm_shufflehi_epi16(low, 0xFF), _mm_shufflehi_epi16(low, 0xFF));
+        sum = _mm256_add_epi16(sum, _mm256_inserti128_si256(_mm256_setzero_si256(), total, 1));
+
+        // Running sums up to the rank, compared unsigned since they can pass 32767. They rise with the bin, so the bins
+        // below are the low run of set mask bits, two bits per bin. The last bin always reaches past the rank.
+        __m256i target = _mm256_set1_epi16(static_cast<short>(rank - below));
+        __m256i isBelow = _mm256_cmpeq_epi16(_mm256_min_epu16(sum, target), sum);
+        int bin = __builtin_ctz(~static_cast<unsigned>(_mm256_movemask_epi8(isBelow))) / 2;
+        if (bin > 0)
+        {
+            ushort sums[MEDIAN_GROUP_BINS];
+            _mm256_storeu_si256((__m256i *)sums, sum);
+            below += sums[bin - 1];
+        }
+        return bin;
+    }
+};
+#endif
+
+/**
+ * @brief Get the width of the stripes the median filter splits the image into.
+ */
+static int medianStripeWidth(int radius)
+{
+    return std::max(MEDIAN_STRIPE_COLUMNS - 2 * radius, MEDIAN_MIN_STRIPE_WIDTH);
+}
+
+/**
+ * @brief Median filter a band of rows, adding histogram groups with Bins.
+ *
+ * The band is filtered one vertical stripe and one channel at a time, so the column histograms cover only the stripe
+ * and its halo and stay in cache. Column histograms start from the window around the band's first row and move down
+ * one row at a time. For each row, the coarse window histogram moves right one column at a time. Each group of fine
+ * bins remembers the column it was last brought up to date at, and is only moved along to the current column when the
+ * median falls in it, or summed again from the columns when it is further behind than the window is wide.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param y0 The first row of the band.
+ * @param y1 One past the last row of the band.
+ * @param radius The radius of the window.
+ * @param hist The band's histograms: the fine bins of medianStripeWidth(radius) + 2 * radius columns, then their
+ * coarse bins.
+ */
+template <typename Bins>
+static inline void medianRows(const cv::Mat &src, cv::Mat &dst, int y0, int y1, int radius, ushort *hist)
+{
+    int cn = src.channels();
+    int size = 2 * radius + 1;
+    int rank = size * size / 2; // pixels of the window below the median
+    int stripeWidth = medianStripeWidth(radius);
+    ushort *fineColumns = hist;
+    ushort *coarseColumns = hist + (stripeWidth + 2 * radius) * MEDIAN_FINE_BINS;
+
+    ushort coarse[MEDIAN_GROUP_BINS];
+    ushort fine[MEDIAN_FINE_BINS];
+    int fineColumn[MEDIAN_GROUP_BINS];
+    for (int x0 = 0; x0 < src.cols; x0 += stripeWidth)
+    {
+        // Histogram column j holds image column x0 - radius + j, or the nearest edge column outside the image
+        int x1 = std::min(x0 + stripeWidth, src.cols);
+        int columns = x1 - x0 + 2 * radius;
+        for (int c = 0; c < cn; c++)
+        {
+            auto count = [&](int y, int delta) {
+                const uchar *row = src.ptr<uchar>(clampIndex(y, src.rows)) + c;
+                for (int j = 0; j < columns; j++)
+                {
+                    int v = row[clampIndex(x0 - radius + j, src.cols) * cn];
+                    fineColumns[j * MEDIAN_FINE_BINS + v] += delta;
+                    coarseColumns[j * MEDIAN_GROUP_BINS + v / MEDIAN_GROUP_BINS] += delta;
+                }
+            };
+
+            memset(fineColumns, 0, columns * MEDIAN_FINE_BINS * sizeof(ushort));
+            memset(coarseColumns, 0, columns * MEDIAN_GROUP_BINS * sizeof(ushort));
+            for (int y = y0 - radius; y <= y0 + radius; y++)
+            {
+                count(y, 1);
+            }
+
+            for (int y = y0; y < y1; y++)
+            {
+                if (y > y0)
+                {
+                    count(y - radius - 1, -1);
+                    count(y + radius, 1);
+                }
+
+                // Window histograms for output column x0 + j, which spans histogram columns j to j + 2 * radius
+                memset(coarse, 0, sizeof(coarse));
+                for (int j = 0; j < size; j++)
+                {
+                    Bins::add(coarse, coarseColumns + j * MEDIAN_GROUP_BINS);
+                }
+                for (int g = 0; g < MEDIAN_GROUP_BINS; g++)
+                {
+                    fineColumn[g] = -2 * size; // never summed
+                }
+
+                uchar *ptrDst = dst.ptr<uchar>(y) + c;
+                for (int j = 0; j < x1 - x0; j++)
+                {
+                    if (j > 0)
+                    {
+                        Bins::addSub(coarse, coarseColumns + (j + 2 * radius) * MEDIAN_GROUP_BINS,
+                                     coarseColumns + (j - 1) * MEDIAN_GROUP_BINS);
+                    }
+
+                    // The group of 16 values holding the median
+                    int below = 0;
+                    int g = Bins::find(coarse, rank, below);
+
+                    // Bring that group of fine bins to column j
+                    ushort *group = fine + g * MEDIAN_GROUP_BINS;
+                    const ushort *groupColumns = fineColumns + g * MEDIAN_GROUP_BINS;
+                    if (j - fineColumn[g] > size)
+                    {
+                        memset(group, 0, MEDIAN_GROUP_BINS * sizeof(ushort));
+                        for (int k = j; k < j + size; k++)
+                        {
+                            Bins::add(group, groupColumns + k * MEDIAN_FINE_BINS);
+                        }
+                    }
+                    else
+                    {
+                        for (int k = fineColumn[g] + 1; k <= j; k++)
+                        {
+                            Bins::addSub(group, groupColumns + (k + 2 * radius) * MEDIAN_FINE_BINS,
+                                         groupColumns + (k - 1) * MEDIAN_FINE_BINS);
+                        }
+                    }
+                    fineColumn[g] = j;
+
+                    int v = Bins::find(group, rank, below);
+                    ptrDst[(x0 + j) * cn] = static_cast<uchar>(g * MEDIAN_GROUP_BINS + v);
+                }
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// medianRows is flattened into functions compiled for each instruction set, so the histogram additions inline into it
+// instead of being called per group
+
+/**
+ * @brief SSE4.1 version of medianRows.
+ */
+SIMD_TARGET_SSE41 __attribute__((flatten)) static void medianRowsSSE41(const cv::Mat &src, cv::Mat &dst, int y0,
+                                                                        int y1, int radius, ushort *hist)
+{
+    medianRows<MedianBinsSSE41>(src, dst, y0, y1, radius, hist);
+}
+
+/**
+ * @brief AVX2 version of medianRows.
+ */
+SIMD_TARGET_AVX2 __attribute__((flatten)) static void medianRowsAVX2(const cv::Mat &src, cv::Mat &dst, int y0, int y1,
+                                                                      int radius, ushort *hist)
+{
+    medianRows<MedianBinsAVX2>(src, dst, y0, y1, radius, hist);
+}
+#endif
+
+// Radii up to this one are filtered by a network of min/max pairs over the whole window, which beats the histograms
+// while the window is small
+static const int MEDIAN_NETWORK_MAX_RADIUS = 2;
+static const int MEDIAN_NETWORK_MAX_WINDOW = (2 * MEDIAN_NETWORK_MAX_RADIUS + 1) * (2 * MEDIAN_NETWORK_MAX_RADIUS + 1);
+
+/**
+ * @brief One min/max pair of a median network: afterwards low holds the smaller and high the larger of the two.
+ */
+struct MedianPair
+{
+    uchar low;
+    uchar high;
+};
+
+/**
+ * @brief Build the network of min/max pairs that leaves the median of a window at position count / 2.
+ *
+ * The pairs are those of Batcher's odd-even merge sort over the next power of two, with the positions past count
+ * taken to hold 255. Pairs that reach into those positions never move anything and are left out, and so are the pairs
+ * the median does not depend on, found by walking the network backwards from it.
+ *
+ * @param count The number of values in the window.
+ * @return The pairs, in the order they are applied.
+ */
+static std::vector<MedianPair> buildMedianNetwork(int count)
+{
+    int n = 1;
+    while (n < count)
+    {
+        n *= 2;
+    }
+
+    std::vector<MedianPair> sorter;
+    for (int p = 1; p < n; p *= 2)
+    {
+        for (int k = p; k >= 1; k /= 2)
+        {
+            for (int j = k % p; j + k < n; j += 2 * k)
+            {
+                for (int i = 0; i < std::min(k, n - j - k); i++)
+                {
+                    int low = i + j;
+                    int high = i + j + k;
+                    if (low / (2 * p) == high / (2 * p) && high < count)
+                    {
+                        MedianPair pair = {static_cast<uchar>(low), static_cast<uchar>(high)};
+                        sorter.push_back(pair);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<bool> needed(count, false);
+    needed[count / 2] = true;
+    std::vector<MedianPair> network;
+    for (int i = static_cast<int>(sorter.size()) - 1; i >= 0; i--)
+    {
+        if (needed[sorter[i].low] || needed[sorter[i].high])
+        {
+            needed[sorter[i].low] = true;
+            needed[sorter[i].high] = true;
+            network.push_back(sorter[i]);
+        }
+    }
+    std::reverse(network.begin(), network.end());
+    return network;
+}
+
+/**
+ * @brief Get the median network of a (2 * radius + 1) square window, built on first use.
+ */
+static const std::vector<MedianPair> &medianNetwork(int radius)
+{
+    static const std::vector<MedianPair> networks[MEDIAN_NETWORK_MAX_RADIUS + 1] = {
+        std::vector<MedianPair>(), buildMedianNetwork(9), buildMedianNetwork(25)};
+    return networks[radius];
+}
+
+/**
+ * @brief Min/max operations of the median network on single bytes.
+ */
+struct MedianLanesScalar
+{
+    typedef uchar Vec;
+    static const int WIDTH = 1;
+
+    static inline void load(Vec &v, const uchar *src)
+    {
+        v = *src;
+    }
+
+    static inline void store(uchar *dst, const Vec &v)
+    {
+        *dst = v;
+    }
+
+    static inline void sort(Vec &low, Vec &high)
+    {
+        Vec t = low;
+        low = std::min(t, high);
+        high = std::max(t, high);
+    }
+};
+
+#ifdef SIMD_X86
+/**
+ * @brief Min/max operations of the median network on 16 bytes at a time, using SSE4.1.
+ */
+struct MedianLanesSSE41
+{
+    typedef __m128i Vec;
+    static const int WIDTH = 16;
+
+    SIMD_TARGET_SSE41 static inline void load(Vec &v, const uchar *src)
+    {
+        v = _mm_loadu_si128((const __m128i *)src);
+    }
+
+    SIMD_TARGET_SSE41 static inline void store(uchar *dst, const Vec &v)
+    {
+        _mm_storeu_si128((__m128i *)dst, v);
+    }
+
+    SIMD_TARGET_SSE41 static inline void sort(Vec &low, Vec &high)
+    {
+        Vec t = low;
+        low = _mm_min_epu8(t, high);
+        high = _mm_max_epu8(t, high);
+    }
+};
+
+/**
+ * @brief Min/max operations of the median network on 32 bytes at a time, using AVX2.
+ */
+struct MedianLanesAVX2
+{
+    typedef __m256i Vec;
+    static const int WIDTH = 32;
+
+    SIMD_TARGET_AVX2 static inline void load(Vec &v, const uchar *src)
+    {
+        v = _mm256_loadu_si256((const __m256i *)src);
+    }
+
+    SIMD_TARGET_AVX2 static inline void store(uchar *dst, const Vec &v)
+    {
+        _mm256_storeu_si256((__m256i *)dst, v);
+    }
+
+    SIMD_TARGET_AVX2 static inline void sort(Vec &low, Vec &high)
+    {
+        Vec t = low;
+        low = _mm256_min_epu8(t, high);
+        high = _mm256_max_epu8(t, high);
+    }
+};
+#endif
+
+/**
+ * @brief Median of part of a row with a median network, Lanes::WIDTH bytes at a time. The window must lie inside the
+ * row for every byte written.
+ *
+ * @param rows The 2 * radius + 1 rows of the window, top to bottom.
+ * @param dst The destination row.
+ * @param begin The first byte to write.
+ * @param end One past the last byte to write.
+ * @param radius The radius of the window.
+ * @param cn The number of channels.
+ * @param network The median network of the window.
+ * @return The first byte that was not written.
+ */
+template <typename Lanes>
+static inline int medianNetworkRow(const uchar *const *rows, uchar *dst, int begin, int end, int radius, int cn,
+                                   const std::vector<MedianPair> &network)
+{
+    typedef typename Lanes::Vec Vec;
+    int size = 2 * radius + 1;
+    const MedianPair *pairs = network.data();
+    int count = static_cast<int>(network.size());
+
+    int i = begin;
+    for (; i + Lanes::WIDTH <= end; i += Lanes::WIDTH)
+    {
+        Vec v[MEDIAN_NETWORK_MAX_WINDOW];
+        for (int dy = 0; dy < size; dy++)
+        {
+            for (int dx = 0; dx < size; dx++)
+            {
+                Lanes::load(v[dy * size + dx], rows[dy] + i + (dx - radius) * cn);
+            }
+        }
+        for (int k = 0; k < count; k++)
+        {
+            Lanes::sort(v[pairs[k].low], v[pairs[k].high]);
+        }
+        Lanes::store(dst + i, v[size * size / 2]);
+    }
+    return i;
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief SSE4.1 version of medianNetworkRow.
+ */
+SIMD_TARGET_SSE41 __attribute__((flatten)) static int medianNetworkRowSSE41(const uchar *const *rows, uchar *dst,
+                                                                             int begin, int end, int radius, int cn,
+                                                                             const std::vector<MedianPair> &network)
+{
+    return medianNetworkRow<MedianLanesSSE41>(rows, dst, begin, end, radius, cn, network);
+}
+
+/**
+ * @brief AVX2 version of medianNetworkRow.
+ */
+SIMD_TARGET_AVX2 __attribute__((flatten)) static int medianNetworkRowAVX2(const uchar *const *rows, uchar *dst,
+                                                                           int begin, int end, int radius, int cn,
+                                                                           const std::vector<MedianPair> &network)
+{
+    return medianNetworkRow<MedianLanesAVX2>(rows, dst, begin, end, radius, cn, network);
+}
+#endif
+
+/**
+ * @brief Median filter a band of rows with a median network, for radii up to MEDIAN_NETWORK_MAX_RADIUS.
+ *
+ * Rows and columns past the edges of the image are replicated, as in medianRows. The pixels whose window reaches past
+ * the sides of the image gather their window one value at a time.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param y0 The first row of the band.
+ * @param y1 One past the last row of the band.
+ * @param radius The radius of the window, from 1 to MEDIAN_NETWORK_MAX_RADIUS.
+ */
+static void medianNetworkRows(const cv::Mat &src, cv::Mat &dst, int y0, int y1, int radius)
+{
+    const std::vector<MedianPair> &network = medianNetwork(radius);
+    int cn = src.channels();
+    int size = 2 * radius + 1;
+    int left = std::min(radius, src.cols);                  // first pixel whose window fits in the row
+    int right = std::max(src.cols - radius, left);          // first pixel past the ones whose window fits
+    const uchar *rows[2 * MEDIAN_NETWORK_MAX_RADIUS + 1];
+    uchar window[MEDIAN_NETWORK_MAX_WINDOW];
+
+    for (int y = y0; y < y1; y++)
+    {
+        for (int dy = 0; dy < size; dy++)
+        {
+            rows[dy] = src.ptr<uchar>(clampIndex(y + dy - radius, src.rows));
+        }
+        uchar *ptrDst = dst.ptr<uchar>(y);
+
+        int i = left * cn;
+#ifdef SIMD_X86
+        SimdLevel level = simdLevel();
+        if (level >= SIMD_AVX2)
+        {
+            i = medianNetworkRowAVX2(rows, ptrDst, i, right * cn, radius, cn, network);
+        }
+        if (level >= SIMD_SSE41)
+        {
+            i = medianNetworkRowSSE41(rows, ptrDst, i, right * cn, radius, cn, network);
+        }
+#endif
+        medianNetworkRow<MedianLanesScalar>(rows, ptrDst, i, right * cn, radius, cn, network);
+
+        for (int x = 0; x < src.cols; x++)
+        {
+            if (x == left)
+            {
+                x = right;
+                if (x >= src.cols)
+                {
+                    break;
+                }
+            }
+            for (int c = 0; c < cn; c++)
+            {
+                for (int dy = 0; dy < size; dy++)
+                {
+                    for (int dx = 0; dx < size; dx++)
+                    {
+                        window[dy * size + dx] = rows[dy][clampIndex(x + dx - radius, src.cols) * cn + c];
+                    }
+                }
+                std::nth_element(window, window + size * size / 2, window + size * size);
+                ptrDst[x * cn + c] = window[size * size / 2];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Whether medianFilter sorts windows of the radius with the median network. Without SIMD the network does more
+ * work per pixel than the histograms, so only the SSE4.1 and AVX2 paths take it.
+ */
+static bool useMedianNetwork(int radius)
+{
+    bool simd = false;
+#ifdef SIMD_X86
+    simd = simdLevel() >= SIMD_SSE41;
+#endif
+    return simd && radius <= MEDIAN_NETWORK_MAX_RADIUS;
+}
+
+/**
+ * @brief Replace every pixel with the median of a (2 * radius + 1) square window.
+ *
+ * With SSE4.1 or AVX2, radii up to MEDIAN_NETWORK_MAX_RADIUS sort each window with a fixed network of byte min/max
+ * operations, 16 or 32 bytes at a time. Other radii take time independent of the radius: each band of rows keeps its own column histograms, so the
+ * bands run in parallel, and works through the image in vertical stripes a few hundred columns wide, so its
+ * histograms take about 140 KB whatever the image size.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param radius The radius of the window, from 0 to 127. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int medianFilter(cv::Mat &src, cv::Mat &dst, int radius, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (!isChannelCountSupported(src))
+    {
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    if (radius < 0 || radius > MEDIAN_MAX_RADIUS)
+    {
+        printf("Expected a radius from 0 to %d\n", MEDIAN_MAX_RADIUS);
+        return -1;
+    }
+
+    if (radius == 0)
+    {
+        src.copyTo(dst);
+        return 0;
+    }
+
+    // Bands read rows around their own, so an in-place call works on a copy
+    cv::Mat input = stencilInput(src, dst, ctx);
+
+    if (useMedianNetwork(radius))
+    {
+        dst.create(src.size(), src.type());
+        parallelRows(0, src.rows, [&](int y0, int y1) { medianNetworkRows(input, dst, y0, y1, radius); });
+        return 0;
+    }
+
+    int bands = rowBandCount(src.rows);
+    int histSize = (medianStripeWidth(radius) + 2 * radius) * (MEDIAN_FINE_BINS + MEDIAN_GROUP_BINS);
+
+    cv::Mat local;
+    cv::Mat &hists = scratchImage(ctx, FilterContext::SCRATCH_TEMP, bands, histSize, CV_16U, local);
+
+    dst.create(src.size(), src.type());
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        ushort *hist = hists.ptr<ushort>(rowBandIndex(0, src.rows, bands, y0));
+#ifdef SIMD_X86
+        SimdLevel level = simdLevel();
+        if (level >= SIMD_AVX2)
+        {
+            medianRowsAVX2(input, dst, y0, y1, radius, hist);
+            return;
+        }
+        if (level >= SIMD_SSE41)
+        {
+            medianRowsSSE41(input, dst, y0, y1, radius, hist);
+            return;
+        }
+#endif
+        medianRows<MedianBinsScalar>(input, dst, y0, y1, radius, hist);
+    });
+
+    return 0;
+}
+
+// Empty cells around the bilateral grid on every side, so its blur and the trilinear slice never read outside it
+static const int GRID_PAD = 2;
+
+// Cells a bilateral grid may always have, about 20 MB for a 4-channel image; larger images may have one per pixel
+static const int GRID_MIN_CELL_BUDGET = 1 << 20;
+
+/**
+ * @brief Intensity of a pixel: the luminance of a color pixel, or the first channel of a grey one. The bilateral grid
+ * uses it as its range coordinate and cartoonize finds its edges in it.
+ */
+static inline int pixelIntensity(const uchar *pixel, int cn)
+{
+    return cn < 3 ? pixel[0] : (29 * pixel[0] + 150 * pixel[1] + 77 * pixel[2]) >> 8;
+}
+
+/**
+ * @brief Blur one line of a bilateral grid in place with the 1-4-6-4-1 kernel, reading cells past its ends as empty.
+ *
+ * @param line The first cell of the line.
+ * @param length The number of cells in the line.
+ * @param stride The distance between cells of the line, in floats.
+ * @param channels The number of floats per cell.
+ * @param temp A buffer of (length + 4) * channels floats.
+ */
+static void blurGridLine(float *line, int length, int stride, int channels, float *temp)
+{
+    memset(temp, 0, 2 * channels * sizeof(float));
+    memset(temp + (length + 2) * channels, 0, 2 * channels * sizeof(float));
+    for (int i = 0; i < length; i++)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            temp[(i + 2) * channels + c] = line[(size_t)i * stride + c];
+        }
+    }
+
+    for (int i = 0; i < length; i++)
+    {
+        const float *t = temp + (i + 2) * channels;
+        float *cell = line + (size_t)i * stride;
+        for (int c = 0; c < channels; c++)
+        {
+            float outer = t[c - 2 * channels] + t[c + 2 * channels];
+            float inner = t[c - channels] + t[c + channels];
+            cell[c] = (outer + 4.0f * inner + 6.0f * t[c]) * (1.0f / 16.0f);
+        }
+    }
+}
+
+/**
+ * @brief Read a band of rows back from a blurred bilateral grid with CN channels, by trilinear interpolation.
+ *
+ * Each cell holds CN channel sums and then the weight, and the output is their interpolated ratio.
+ *
+ * @param src The source image, giving each pixel's intensity.
+ * @param dst The destination image.
+ * @param y0 The first row of the band.
+ * @param y1 One past the last row of the band.
+ * @param grid The grid, height x width x depth cells of CN + 1 floats.
+ * @param width The grid width in cells.
+ * @param depth The grid depth in cells.
+ * @param spaceScale Cells per pixel.
+ * @param rangeScale Cells per intensity level.
+ */
+template <int CN>
+static void sliceGridRows(const cv::Mat &src, cv::Mat &dst, int y0, int y1, const float *grid, int width, int depth,
+                          float spaceScale, float rangeScale)
+{
+    const int C = CN + 1;
+    const int dz = C;
+    const int dx = depth * C;
+    const size_t dy = (size_t)width * depth * C;
+    for (int y = y0; y < y1; y++)
+    {
+        float fy = y * spaceScale + GRID_PAD;
+        int gy = static_cast<int>(fy);
+        float wy = fy - gy;
+
+        const uchar *ptrSrc = src.ptr<uchar>(y);
+        uchar *ptrDst = dst.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; x++)
+        {
+            float fx = x * spaceScale + GRID_PAD;
+            float fz = pixelIntensity(ptrSrc + x * CN, CN) * rangeScale + GRID_PAD;
+            int gx = static_cast<int>(fx);
+            int gz = static_cast<int>(fz);
+            float wx = fx - gx;
+            float wz = fz - gz;
+
+            const float *cell = grid + gy * dy + gx * dx + gz * dz;
+            float corner[4][C];
+            for (int c = 0; c < C; c++)
+            {
+                // Interpolate along z, then x, then y
+                corner[0][c] = cell[c] + wz * (cell[dz + c] - cell[c]);
+                corner[1][c] = cell[dx + c] + wz * (cell[dx + dz + c] - cell[dx + c]);
+                corner[2][c] = cell[dy + c] + wz * (cell[dy + dz + c] - cell[dy + c]);
+                corner[3][c] = cell[dy + dx + c] + wz * (cell[dy + dx + dz + c] - cell[dy + dx + c]);
+            }
+
+            float value[C];
+            for (int c = 0; c < C; c++)
+            {
+                float top = corner[0][c] + wx * (corner[1][c] - corner[0][c]);
+                float bottom = corner[2][c] + wx * (corner[3][c] - corner[2][c]);
+                value[c] = top + wy * (bottom - top);
+            }
+
+            // Every pixel adds its own weight next to where it reads, so the weight is not zero
+            float scale = value[CN] > 0 ? 1.0f / value[CN] : 0.0f;
+            for (int c = 0; c < CN; c++)
+            {
+                ptrDst[x * CN + c] = cv::saturate_cast<uchar>(value[c] * scale);
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief Linear interpolation of four floats, using SSE4.1.
+ */
+SIMD_TARGET_SSE41 static inline __m128 lerp4SSE41(__m128 a, __m128 b, __m128 w)
+{
+    return _mm_add_ps(a, _mm_mul_ps(w, _mm_sub_ps(b, a)));
+}
+
+/**
+ * @brief SSE4.1 version of sliceGridRows for 3-channel images, whose cells of three sums and a weight fill one vector.
+ */
+SIMD_TARGET_SSE41 static void sliceGridRowsBGRSSE41(const cv::Mat &src, cv::Mat &dst, int y0, int y1, const float *grid,
+                                                    int width, int depth, float spaceScale, float rangeScale)
+{
+    const int dz = 4;
+    const int dx = depth * 4;
+    const size_t dy = (size_t)width * depth * 4;
+    for (int y = y0; y < y1; y++)
+    {
+        float fy = y * spaceScale + GRID_PAD;
+        int gy = static_cast<int>(fy);
+        __m128 wy = _mm_set1_ps(fy - gy);
+
+        const uchar *ptrSrc = src.ptr<uchar>(y);
+        uchar *ptrDst = dst.ptr<uchar>(y);
+        for (int x = 0; x < src.cols; x++)
+        {
+            float fx = x * spaceScale + GRID_PAD;
+            float fz = pixelIntensity(ptrSrc + x * 3, 3) * rangeScale + GRID_PAD;
+            int gx = static_cast<int>(fx);
+            int gz = static_cast<int>(fz);
+            __m128 wx = _mm_set1_ps(fx - gx);
+            __m128 wz = _mm_set1_ps(fz - gz);
+
+            // Interpolate along z, then x, then y, all four values of a cell at once
+            const float *cell = grid + gy * dy + gx * dx + gz * dz;
+            __m128 c00 = lerp4SSE41(_mm_loadu_ps(cell), _mm_loadu_ps(cell + dz), wz);
+            __m128 c01 = lerp4SSE41(_mm_loadu_ps(cell + dx), _mm_loadu_ps(cell + dx + dz), wz);
+            __m128 c10 = lerp4SSE41(_mm_loadu_ps(cell + dy), _mm_loadu_ps(cell + dy + dz), wz);
+            __m128 c11 = lerp4SSE41(_mm_loadu_ps(cell + dy + dx), _mm_loadu_ps(cell + dy + dx + dz), wz);
+            __m128 value = lerp4SSE41(lerp4SSE41(c00, c01, wx), lerp4SSE41(c10, c11, wx), wy);
+
+            float weight = _mm_cvtss_f32(_mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3)));
+            float scale = weight > 0 ? 1.0f / weight : 0.0f;
+            __m128i rounded = _mm_cvtps_epi32(_mm_mul_ps(value, _mm_set1_ps(scale)));
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(rounded, rounded), rounded);
+            int pixel = _mm_cvtsi128_si32(bytes);
+            memcpy(ptrDst + x * 3, &pixel, 3);
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Smooth an image while keeping its edges, with a bilateral filter computed on a bilateral grid.
+ *
+ * The grid has a cell per sigmaSpace pixels and per sigmaRange levels, plus GRID_PAD empty cells on every side. Sigmas
+ * that would give more cells than the image has pixels, or than GRID_MIN_CELL_BUDGET for a small image, are scaled up
+ * together until the grid fits, which keeps its memory a bounded fraction of the image. Each step runs in parallel:
+ * the splat over rows of grid cells, so no two threads add into the same cell, the blur over the lines of each axis,
+ * and the slice over rows of the image. The slice reads only the pixel it writes, so src and dst may be the same image.
+ *
+ * @param src The 8-bit grey or color source image, with 1, 3 or 4 channels.
+ * @param dst The destination image. May be the same as src.
+ * @param sigmaSpace The spatial extent of the smoothing in pixels, at least 1.
+ * @param sigmaRange The intensity difference, in 8-bit levels, across which pixels are still averaged, at least 1.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int bilateralGrid(cv::Mat &src, cv::Mat &dst, double sigmaSpace, double sigmaRange, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    int cn = src.channels();
+    if (src.depth() != CV_8U || cn == 2 || cn > 4)
+    {
+        printf("Expected an 8-bit grey or color image\n");
+        return -1;
+    }
+
+    if (sigmaSpace < 1 || sigmaRange < 1)
+    {
+        printf("Expected spatial and range sigmas of at least 1\n");
+        return -1;
+    }
+
+    // Keep the grid to at most one cell per pixel, or GRID_MIN_CELL_BUDGET cells for small images, by scaling both
+    // sigmas up together when they are too small for the image
+    double budget = std::max((double)src.total(), (double)GRID_MIN_CELL_BUDGET);
+    auto gridCells = [&](double space, double range) {
+        double cellsX = (int)((src.cols - 1) / space) + 2 + 2 * GRID_PAD;
+        double cellsY = (int)((src.rows - 1) / space) + 2 + 2 * GRID_PAD;
+        double cellsZ = (int)(255 / range) + 2 + 2 * GRID_PAD;
+        return cellsX * cellsY * cellsZ;
+    };
+    if (gridCells(sigmaSpace, sigmaRange) > budget)
+    {
+        double grow = std::cbrt(gridCells(sigmaSpace, sigmaRange) / budget);
+        while (gridCells(sigmaSpace * grow, sigmaRange * grow) > budget)
+        {
+            grow *= 1.05;
+        }
+        sigmaSpace *= grow;
+        sigmaRange *= grow;
+    }
+
+    float spaceScale = static_cast<float>(1.0 / sigmaSpace);
+    float rangeScale = static_cast<float>(1.0 / sigmaRange);
+    int width = static_cast<int>((src.cols - 1) * spaceScale) + 2 + 2 * GRID_PAD;
+    int height = static_cast<int>((src.rows - 1) * spaceScale) + 2 + 2 * GRID_PAD;
+    int depth = static_cast<int>(255 * rangeScale) + 2 + 2 * GRID_PAD;
+    int channels = cn + 1; // channel sums, then the weight
+
+    cv::Mat local;
+    int rowStep = width * depth * channels; // floats per row of grid cells
+    cv::Mat &gridImage = scratchImage(ctx, FilterContext::SCRATCH_TEMP, height, rowStep, CV_32F, local);
+    gridImage.setTo(0);
+    float *grid = gridImage.ptr<float>();
+
+    // Splat: add every pixel into its nearest cell. Grid row gy gathers the image rows that round to it.
+    auto cellOf = [](int v, float scale) { return static_cast<int>(v * scale + 0.5f) + GRID_PAD; };
+    parallelRows(0, height, [&](int gy0, int gy1) {
+        for (int gy = gy0; gy < gy1; gy++)
+        {
+            int first = std::max(static_cast<int>((gy - GRID_PAD - 0.5f) * sigmaSpace) - 1, 0);
+            int last = std::min(static_cast<int>((gy - GRID_PAD + 0.5f) * sigmaSpace) + 1, src.rows - 1);
+            for (int y = first; y <= last; y++)
+            {
+                if (cellOf(y, spaceScale) != gy)
+                {
+                    continue;
+                }
+                const uchar *ptr = src.ptr<uchar>(y);
+                float *gridRow = grid + (size_t)gy * rowStep;
+                for (int x = 0; x < src.cols; x++)
+                {
+                    const uchar *pixel = ptr + x * cn;
+                    int gz = cellOf(pixelIntensity(pixel, cn), rangeScale);
+                    float *cell = gridRow + ((size_t)cellOf(x, spaceScale) * depth + gz) * channels;
+                    for (int c = 0; c < cn; c++)
+                    {
+                        cell[c] += pixel[c];
+                    }
+                    cell[cn] += 1.0f;
+                }
+            }
+        }
+    });
+
+    // Blur along z and x within each grid row, then along y down each column of cells. Each band of either pass
+    // copies the line it blurs into its own row of lineImage.
+    int rowBands = rowBandCount(height);
+    int columnBands = rowBandCount(width);
+    int lineLength = (std::max(std::max(width, depth), height) + 4) * channels;
+    cv::Mat localLines;
+    cv::Mat &lineImage = scratchImage(ctx, FilterContext::SCRATCH_BANDS, std::max(rowBands, columnBands), lineLength,
+                                      CV_32F, localLines);
+    parallelRows(0, height, [&](int gy0, int gy1) {
+        float *temp = lineImage.ptr<float>(rowBandIndex(0, height, rowBands, gy0));
+        for (int gy = gy0; gy < gy1; gy++)
+        {
+            float *gridRow = grid + (size_t)gy * rowStep;
+            for (int gx = 0; gx < width; gx++)
+            {
+                blurGridLine(gridRow + gx * depth * channels, depth, channels, channels, temp);
+            }
+            for (int gz = 0; gz < depth; gz++)
+            {
+                blurGridLine(gridRow + gz * channels, width, depth * channels, channels, temp);
+            }
+        }
+    });
+    parallelRows(0, width, [&](int gx0, int gx1) {
+        float *temp = lineImage.ptr<float>(rowBandIndex(0, width, columnBands, gx0));
+        for (int gx = gx0; gx < gx1; gx++)
+        {
+            for (int gz = 0; gz < depth; gz++)
+            {
+                blurGridLine(grid + ((size_t)gx * depth + gz) * channels, height, rowStep, channels, temp);
+            }
+        }
+    });
+
+    // Slice: read every pixel back at its own position and intensity
+    dst.create(src.size(), src.type());
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        switch (cn)
+        {
+        case 1:
+            sliceGridRows<1>(src, dst, y0, y1, grid, width, depth, spaceScale, rangeScale);
+            break;
+        case 3:
+#ifdef SIMD_X86
+            if (simdLevel() >= SIMD_SSE41)
+            {
+                sliceGridRowsBGRSSE41(src, dst, y0, y1, grid, width, depth, spaceScale, rangeScale);
+                break;
+            }
+#endif
+            sliceGridRows<3>(src, dst, y0, y1, grid, width, depth, spaceScale, rangeScale);
+            break;
+        default:
+            sliceGridRows<4>(src, dst, y0, y1, grid, width, depth, spaceScale, rangeScale);
+            break;
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Horizontal 3x3 Sobel gradient of a band of rows of an image with pixels of type T and CN channels.
+ *
+ * Rows are walked as flat arrays with neighbouring pixels CN values apart. The channel count is a template argument,
+ * so the stride is a constant and a single-channel image reads contiguous values. The gradient is computed and stored
+ * in PixelTraits<T>::Gradient, which holds it without overflow. Border rows and columns, where the kernel does not
+ * fit, are set to 0.
+ */
+template <typename T, int CN> static void sobelX3x3Rows(const cv::Mat &src, cv::Mat &dst, int y0, int y1)
+{
+    typedef typename PixelTraits<T>::Gradient Gradient;
+
+    int width = src.cols * CN; // row length in values
+    for (int y = y0; y < y1; y++)
+    {
+        Gradient *ptrDst = dst.ptr<Gradient>(y);
+        if (y == 0 || y == src.rows - 1 || src.cols < 3)
+        {
+            memset(ptrDst, 0, width * sizeof(Gradient));
+            continue;
+        }
+
+        const T *ptrUp = src.ptr<T>(y - 1);
+        const T *ptr = src.ptr<T>(y);
+        const T *ptrDown = src.ptr<T>(y + 1);
+
+        memset(ptrDst, 0, CN * sizeof(Gradient));
+        for (int i = CN; i < width - CN; i++)
+        {
+            Gradient left = ptrUp[i - CN] + 2 * ptr[i - CN] + ptrDown[i - CN];
+            Gradient right = ptrUp[i + CN] + 2 * ptr[i + CN] + ptrDown[i + CN];
+
+            ptrDst[i] = static_cast<Gradient>(right - left);
+        }
+        memset(ptrDst + width - CN, 0, CN * sizeof(Gradient));
+    }
+}
+
+/**
+ * @brief Vertical 3x3 Sobel gradient of a band of rows of an image with pixels of type T and CN channels.
+ */
+template <typename T, int CN> static void sobelY3x3Rows(const cv::Mat &src, cv::Mat &dst, int y0, int y1)
+{
+    typedef typename PixelTraits<T>::Gradient Gradient;
+
+    int width = src.cols * CN; // row length in values
+    for (int y = y0; y < y1; y++)
+    {
+        Gradient *ptrDst = dst.ptr<Gradient>(y);
+        if (y == 0 || y == src.rows - 1 || src.cols < 3)
+        {
+            memset(ptrDst, 0, width * sizeof(Gradient));
+            continue;
+        }
+
+        const T *ptrUp = src.ptr<T>(y - 1);
+        const T *ptrDown = src.ptr<T>(y + 1);
+
+        memset(ptrDst, 0, CN * sizeof(Gradient));
+        for (int i = CN; i < width - CN; i++)
+        {
+            Gradient top = ptrUp[i - CN] + 2 * ptrUp[i] + ptrUp[i + CN];
+            Gradient bottom = ptrDown[i - CN] + 2 * ptrDown[i] + ptrDown[i + CN];
+
+            ptrDst[i] = static_cast<Gradient>(bottom - top);
+        }
+        memset(ptrDst + width - CN, 0, CN * sizeof(Gradient));
+    }
+}
+
+/**
+ * @brief Function computing a gradient over the rows [y0, y1) of src into dst, instantiated per depth and channel
+ * count.
+ */
+typedef void (*SobelRowsFunc)(const cv::Mat &src, cv::Mat &dst, int y0, int y1);
+
+/**
+ * @brief Check that an image is one the templated Sobel kernels take: 8-bit, 16-bit or float with 1 to 4 channels.
+ *
+ * @param src The image.
+ * @return true if supported.
+ */
+static bool isSobelInputSupported(const cv::Mat &src)
+{
+    return depthIndex(src.depth()) >= 0 && src.channels() >= 1 && src.channels() <= 4;
+}
+
+/**
+ * @brief Enhance vertical lines in an image using a 3x3 Sobel kernel.
+ *
+ * This function enhances vertical lines in an image using a 3x3 Sobel kernel. It does so by
+ * applying the kernel to each pixel within a nested loop. Takes an 8-bit, 16-bit or float image
+ * with 1 to 4 channels and gives a gradient image with the same channel count: signed short for
+ * 8-bit, 32-bit integer for 16-bit and float for float images. The border pixels, where the kernel
+ * does not fit, are set to 0.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int sobelX3x3(cv::Mat &src, cv::Mat &dst)
+{
+    // -1  0  1
+    // -2  0  2
+    // -1  0  1
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (!isSobelInputSupported(src))
+    {
+        printf("Expected an 8-bit, 16-bit or float image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    static const SobelRowsFunc sobelRows[3][4] = {
+        {sobelX3x3Rows<uchar, 1>, sobelX3x3Rows<uchar, 2>, sobelX3x3Rows<uchar, 3>, sobelX3x3Rows<uchar, 4>},
+        {sobelX3x3Rows<ushort, 1>, sobelX3x3Rows<ushort, 2>, sobelX3x3Rows<ushort, 3>, sobelX3x3Rows<ushort, 4>},
+        {sobelX3x3Rows<float, 1>, sobelX3x3Rows<float, 2>, sobelX3x3Rows<float, 3>, sobelX3x3Rows<float, 4>}};
+    SobelRowsFunc rowsFunc = sobelRows[depthIndex(src.depth())][src.channels() - 1];
+
+    dst.create(src.size(), CV_MAKETYPE(gradientDepth(src.depth()), src.channels())); // Create dst with gradient type
+
+    parallelRows(0, src.rows, [&](int y0, int y1) { rowsFunc(src, dst, y0, y1); });
+    return 0;
+}
+
+/**
+ * @brief Enhance horizontal lines in an image using a 3x3 Sobel kernel.
+ *
+ * This function enhances horizontal lines in an image using a 3x3 Sobel kernel. It does so by
+ * applying the kernel to each pixel within a nested loop. Takes an 8-bit, 16-bit or float image
+ * with 1 to 4 channels and gives a gradient image with the same channel count: signed short for
+ * 8-bit, 32-bit integer for 16-bit and float for float images. The border pixels, where the kernel
+ * does not fit, are set to 0.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int sobelY3x3(cv::Mat &src, cv::Mat &dst)
+{
+    // -1 -2 -1
+    //  0  0  0
+    //  1  2  1
+
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (!isSobelInputSupported(src))
+    {
+        printf("Expected an 8-bit, 16-bit or float image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    static const SobelRowsFunc sobelRows[3][4] = {
+        {sobelY3x3Rows<uchar, 1>, sobelY3x3Rows<uchar, 2>, sobelY3x3Rows<uchar, 3>, sobelY3x3Rows<uchar, 4>},
+        {sobelY3x3Rows<ushort, 1>, sobelY3x3Rows<ushort, 2>, sobelY3x3Rows<ushort, 3>, sobelY3x3Rows<ushort, 4>},
+        {sobelY3x3Rows<float, 1>, sobelY3x3Rows<float, 2>, sobelY3x3Rows<float, 3>, sobelY3x3Rows<float, 4>}};
+    SobelRowsFunc rowsFunc = sobelRows[depthIndex(src.depth())][src.channels() - 1];
+
+    dst.create(src.size(), CV_MAKETYPE(gradientDepth(src.depth()), src.channels())); // Create dst with gradient type
+
+    parallelRows(0, src.rows, [&](int y0, int y1) { rowsFunc(src, dst, y0, y1); });
+    return 0;
+}
+
+/**
+ * @brief Horizontal and vertical 3x3 Sobel gradients of a band of rows of an image with pixels of type T.
+ *
+ * Border rows and columns, where the kernel does not fit, are set to 0.
+ */
+template <typename T> static void sobelXY3x3Rows(const cv::Mat &src, cv::Mat &sx, cv::Mat &sy, int y0, int y1)
+{
+    typedef typename PixelTraits<T>::Gradient Gradient;
+
+    int cn = src.channels();
+    int width = src.cols * cn; // row length in values
+    for (int y = y0; y < y1; y++)
+    {
+        Gradient *ptrSx = sx.ptr<Gradient>(y);
+        Gradient *ptrSy = sy.ptr<Gradient>(y);
+
+        if (y == 0 || y == src.rows - 1 || src.cols < 3)
+        {
+            memset(ptrSx, 0, width * sizeof(Gradient));
+            memset(ptrSy, 0, width * sizeof(Gradient));
+            continue;
+        }
+
+        const T *ptrUp = src.ptr<T>(y - 1);
+        const T *ptr = src.ptr<T>(y);
+        const T *ptrDown = src.ptr<T>(y + 1);
+
+        memset(ptrSx, 0, cn * sizeof(Gradient));
+        memset(ptrSy, 0, cn * sizeof(Gradient));
+        for (int i = cn; i < width - cn; i++)
+        {
+            Gradient left = ptrUp[i - cn] + 2 * ptr[i - cn] + ptrDown[i - cn];
+            Gradient right = ptrUp[i + cn] + 2 * ptr[i + cn] + ptrDown[i + cn];
+            Gradient top = ptrUp[i - cn] + 2 * ptrUp[i] + ptrUp[i + cn];
+            Gradient bottom = ptrDown[i - cn] + 2 * ptrDown[i] + ptrDown[i + cn];
+
+            ptrSx[i] = static_cast<Gradient>(right - left);
+            ptrSy[i] = static_cast<Gradient>(bottom - top);
+        }
+        memset(ptrSx + width - cn, 0, cn * sizeof(Gradient));
+        memset(ptrSy + width - cn, 0, cn * sizeof(Gradient));
+    }
+}
+
+/**
+ * @brief Compute the horizontal and vertical 3x3 Sobel gradients in one pass.
+ *
+ * This function computes the same gradients as sobelX3x3 and sobelY3x3, but reads each 3x3 neighbourhood once and
+ * writes both outputs from it, so the source is swept once instead of twice. The border pixels, where the kernel does
+ * not fit, are set to 0.
+ *
+ * @param src The 8-bit, 16-bit or float source image.
+ * @param sx The destination image for the horizontal gradient (signed short for 8-bit, 32-bit integer for 16-bit and
+ * float for float images, same number of channels as src).
+ * @param sy The destination image for the vertical gradient (same type as sx).
+ * @return 0 if successful, -1 if error.
+ */
+int sobelXY3x3(cv::Mat &src, cv::Mat &sx, cv::Mat &sy)
+{
+    // X:  -1  0  1    Y:  -1 -2 -1
+    //     -2  0  2         0  0  0
+    //     -1  0  1         1  2  1
+
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (depthIndex(src.depth()) < 0)
+    {
+        printf("Expected an 8-bit, 16-bit or float image\n");
+        return -1;
+    }
+
+    int type = CV_MAKETYPE(gradientDepth(src.depth()), src.channels());
+    sx.create(src.size(), type);
+    sy.create(src.size(), type);
+
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        switch (src.depth())
+        {
+        case CV_8U:
+            sobelXY3x3Rows<uchar>(src, sx, sy, y0, y1);
+            break;
+        case CV_16U:
+            sobelXY3x3Rows<ushort>(src, sx, sy, y0, y1);
+            break;
+        default:
+            sobelXY3x3Rows<float>(src, sx, sy, y0, y1);
+            break;
+        }
+    });
+
+    return 0;
+}
+
+// Largest sum of squares whose square root still fits in a byte; anything above saturates to 255
+static const int MAGNITUDE_MAX_SQUARE = 255 * 255;
+
+/**
+ * @brief Table of floor(sqrt(n)) for every n in [0, 255 * 255], built once on first use.
+ */
+struct SqrtTable
+{
+    uchar value[MAGNITUDE_MAX_SQUARE + 1];
+
+    SqrtTable()
+    {
+        int root = 0;
+        for (int n = 0; n <= MAGNITUDE_MAX_SQUARE; n++)
+        {
+            while ((root + 1) * (root + 1) <= n)
+            {
+                root++;
+            }
+            value[n] = static_cast<uchar>(root);
+        }
+    }
+};
+
+static const SqrtTable &sqrtTable()
+{
+    static const SqrtTable table;
+    return table;
+}
+
+/**
+ * @brief Gradient magnitude of one pixel channel, saturated to 8 bits.
+ *
+ * The square root is read from a table, which gives the same result as truncating sqrt() in double precision.
+ *
+ * @param gx The horizontal gradient.
+ * @param gy The vertical gradient.
+ * @return The magnitude, clamped to 255.
+ */
+static inline uchar gradientMagnitude(int gx, int gy)
+{
+    // Unsigned, because two gradients of -32768 from a signed short image overflow an int
+    unsigned square = static_cast<unsigned>(gx * gx) + static_cast<unsigned>(gy * gy);
+    return sqrtTable().value[std::min(square, static_cast<unsigned>(MAGNITUDE_MAX_SQUARE))];
+}
+
+/**
+ * @brief L1 gradient magnitude of one pixel channel, saturated to 8 bits.
+ *
+ * @param gx The horizontal gradient.
+ * @param gy The vertical gradient.
+ * @return |gx| + |gy|, clamped to 255.
+ */
+static inline uchar gradientMagnitudeL1(int gx, int gy)
+{
+    return static_cast<uchar>(std::min(std::abs(gx) + std::abs(gy), 255));
+}
+
+/**
+ * @brief Gradient magnitude of one pixel channel in the given norm.
+ */
+template <MagnitudeNorm Norm> static inline uchar gradientNorm(int gx, int gy)
+{
+    return Norm == MAGNITUDE_L1 ? gradientMagnitudeL1(gx, gy) : gradientMagnitude(gx, gy);
+}
+
+/**
+ * @brief Gradient magnitude of one pixel channel of a 16-bit or float image in the given norm.
+ *
+ * The norm is computed in PixelTraits<T>::Real, which holds the squares of 16-bit gradients exactly. A 16-bit
+ * magnitude is rounded down and saturated to 65535, like the 8-bit one; a float magnitude is kept as it is.
+ *
+ * @param gx The horizontal gradient.
+ * @param gy The vertical gradient.
+ * @return The magnitude.
+ */
+template <typename T, MagnitudeNorm Norm>
+static inline T gradientNormWide(typename PixelTraits<T>::Gradient gx, typename PixelTraits<T>::Gradient gy)
+{
+    typedef typename PixelTraits<T>::Real Real;
+
+    Real x = static_cast<Real>(gx);
+    Real y = static_cast<Real>(gy);
+    Real value = Norm == MAGNITUDE_L1 ? std::abs(x) + std::abs(y) : std::sqrt(x * x + y * y);
+    return cv::saturate_cast<T>(std::is_floating_point<T>::value ? value : std::floor(value));
+}
+
+// Emboss light direction and the grey level of a flat region
+static const float EMBOSS_DIR_X = 0.7071f;
+static const float EMBOSS_DIR_Y = 0.7071f;
+static const int EMBOSS_OFFSET = 128;
+
+/**
+ * @brief Emboss value of one pixel channel: the gradient projected on the light direction, around mid grey.
+ *
+ * @param gx The horizontal gradient.
+ * @param gy The vertical gradient.
+ * @return The emboss value, clamped to [0, 255].
+ */
+static inline uchar embossValue(int gx, int gy)
+{
+    int val = EMBOSS_DIR_X * gx + EMBOSS_DIR_Y * gy + EMBOSS_OFFSET;
+    return static_cast<uchar>(std::min(std::max(val, 0), 255));
+}
+
+/**
+ * @brief Function applied to part of a row by sobelPointFilter.
+ *
+ * @param ptrUp The source row above.
+ * @param ptr The source row.
+ * @param ptrDown The source row below.
+ * @param ptrDst The destination row.
+ * @param begin The first byte to write.
+ * @param end One past the last byte to write.
+ * @param cn The number of channels, i.e. the distance in bytes between horizontal neighbours.
+ */
+typedef void (*SobelRowFunc)(const uchar *ptrUp, const uchar *ptr, const uchar *ptrDown, uchar *ptrDst, int begin,
+                             int end, int cn);
+
+/**
+ * @brief Apply op(gx, gy) to the 3x3 Sobel gradients of part of a row, one byte at a time.
+ */
+template <uchar (*Op)(int, int)>
+static void sobelPointRow(const uchar *ptrUp, const uchar *ptr, const uchar *ptrDown, uchar *ptrDst, int begin,
+                          int end, int cn)
+{
+    for (int i = begin; i < end; i++)
+    {
+        int left = ptrUp[i - cn] + 2 * ptr[i - cn] + ptrDown[i - cn];
+        int right = ptrUp[i + cn] + 2 * ptr[i + cn] + ptrDown[i + cn];
+        int top = ptrUp[i - cn] + 2 * ptrUp[i] + ptrUp[i + cn];
+        int bottom = ptrDown[i - cn] + 2 * ptrDown[i] + ptrDown[i + cn];
+
+        ptrDst[i] = Op(right - left, bottom - top);
+    }
+}
+
+/**
+ * @brief Fused Sobel magnitude over part of a row of a 16-bit or float image.
+ *
+ * Same layout as sobelPointRow, with the gradients held in PixelTraits<T>::Gradient.
+ */
+template <typename T, MagnitudeNorm Norm>
+static void sobelMagnitudeRowWide(const T *ptrUp, const T *ptr, const T *ptrDown, T *ptrDst, int begin, int end,
+                                  int cn)
+{
+    typedef typename PixelTraits<T>::Gradient Gradient;
+
+    for (int i = begin; i < end; i++)
+    {
+        Gradient left = ptrUp[i - cn] + 2 * ptr[i - cn] + ptrDown[i - cn];
+        Gradient right = ptrUp[i + cn] + 2 * ptr[i + cn] + ptrDown[i + cn];
+        Gradient top = ptrUp[i - cn] + 2 * ptrUp[i] + ptrUp[i + cn];
+        Gradient bottom = ptrDown[i - cn] + 2 * ptrDown[i] + ptrDown[i + cn];
+
+        ptrDst[i] = gradientNormWide<T, Norm>(right - left, bottom - top);
+    }
+}
+
+#ifdef SIMD_X86
+// Sums of squares are clamped to 255 * 255 before the square root. Below 2^24 every integer is exact in single
+// precision and sqrt is correctly rounded, and no integer under 255 * 255 has a root within float rounding of the next
+// integer, so truncating the float result matches the table bit for bit.
+
+/**
+ * @brief Gradient magnitudes of eight pairs of signed 16-bit gradients, as 16-bit values in [0, 255], using SSE4.1.
+ */
+template <MagnitudeNorm Norm> SIMD_TARGET_SSE41 static inline __m128i magnitude8SSE41(__m128i gx, __m128i gy)
+{
+    if (Norm == MAGNITUDE_L1)
+    {
+        __m128i sum = _mm_adds_epu16(_mm_abs_epi16(gx), _mm_abs_epi16(gy));
+        return _mm_min_epu16(sum, _mm_set1_epi16(255));
+    }
+
+    const __m128i maxSquare = _mm_set1_epi32(MAGNITUDE_MAX_SQUARE);
+    __m128i lo = _mm_unpacklo_epi16(gx, gy);
+    __m128i hi = _mm_unpackhi_epi16(gx, gy);
+    lo = _mm_min_epu32(_mm_madd_epi16(lo, lo), maxSquare);
+    hi = _mm_min_epu32(_mm_madd_epi16(hi, hi), maxSquare);
+    lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(lo)));
+    hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(hi)));
+    return _mm_packs_epi32(lo, hi);
+}
+
+/**
+ * @brief SSE4.1 version of the fused Sobel magnitude row. Processes 8 bytes per iteration.
+ *
+ * @return The first byte that was not written; the caller finishes the tail with the scalar loop.
+ */
+template <MagnitudeNorm Norm>
+SIMD_TARGET_SSE41 static int sobelMagnitudeRowSSE41(const uchar *ptrUp, const uchar *ptr, const uchar *ptrDown,
+                                                    uchar *ptrDst, int begin, int end, int cn)
+{
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m128i upLeft = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrUp + i - cn)));
+        __m128i up = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrUp + i)));
+        __m128i upRight = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrUp + i + cn)));
+        __m128i left = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptr + i - cn)));
+        __m128i right = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptr + i + cn)));
+        __m128i downLeft = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrDown + i - cn)));
+        __m128i down = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrDown + i)));
+        __m128i downRight = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(ptrDown + i + cn)));
+
+        __m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(upRight, downRight), _mm_slli_epi16(right, 1)),
+                                   _mm_add_epi16(_mm_add_epi16(upLeft, downLeft), _mm_slli_epi16(left, 1)));
+        __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(downLeft, downRight), _mm_slli_epi16(down, 1)),
+                                   _mm_add_epi16(_mm_add_epi16(upLeft, upRight), _mm_slli_epi16(up, 1)));
+
+        __m128i mag = magnitude8SSE41<Norm>(gx, gy);
+        _mm_storel_epi64((__m128i *)(ptrDst + i), _mm_packus_epi16(mag, mag));
+    }
+    return i;
+}
+
+/**
+ * @brief SSE4.1 version of the magnitude row over two signed short gradient rows. Processes 8 values per iteration.
+ *
+ * @return The first value that was not written.
+ */
+template <MagnitudeNorm Norm>
+SIMD_TARGET_SSE41 static int magnitudeRowSSE41(const short *ptrSx, const short *ptrSy, uchar *ptrDst, int width)
+{
+    int i = 0;
+    for (; i + 8 <= width; i += 8)
+    {
+        __m128i mag = magnitude8SSE41<Norm>(_mm_loadu_si128((const __m128i *)(ptrSx + i)),
+                                            _mm_loadu_si128((const __m128i *)(ptrSy + i)));
+        _mm_storel_epi64((__m128i *)(ptrDst + i), _mm_packus_epi16(mag, mag));
+    }
+    return i;
+}
+
+/**
+ * @brief Gradient magnitudes of sixteen pairs of signed 16-bit gradients, as 16-bit values in [0, 255], using AVX2.
+ *
+ * The unpack and pack instructions both work within 128-bit lanes, so the values come back out in their original order.
+ */
+template <MagnitudeNorm Norm> SIMD_TARGET_AVX2 static inline __m256i magnitude16AVX2(__m256i gx, __m256i gy)
+{
+    if (Norm == MAGNITUDE_L1)
+    {
+        __m256i sum = _mm256_adds_epu16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy));
+        return _mm256_min_epu16(sum, _mm256_set1_epi16(255));
+    }
+
+    const __m256i maxSquare = _mm256_set1_epi32(MAGNITUDE_MAX_SQUARE);
+    __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+    __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+    lo = _mm256_min_epu32(_mm256_madd_epi16(lo, lo), maxSquare);
+    hi = _mm256_min_epu32(_mm256_madd_epi16(hi, hi), maxSquare);
+    lo = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(lo)));
+    hi = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(hi)));
+    return _mm256_packs_epi32(lo, hi);
+}
+
+/**
+ * @brief Narrow sixteen 16-bit values in [0, 255] to bytes and store them.
+ */
+SIMD_TARGET_AVX2 static inline void storeBytes16AVX2(uchar *dst, __m256i v)
+{
+    // packus interleaves the two lanes, so gather their low halves back together before storing
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+    _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(packed));
+}
+
+/**
+ * @brief AVX2 version of the fused Sobel magnitude row. Processes 16 bytes per iteration.
+ *
+ * @return The first byte that was not written.
+ */
+template <MagnitudeNorm Norm>
+SIMD_TARGET_AVX2 static int sobelMagnitudeRowAVX2(const uchar *ptrUp, const uchar *ptr, const uchar *ptrDown,
+                                                  uchar *ptrDst, int begin, int end, int cn)
+{
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m256i upLeft = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrUp + i - cn)));
+        __m256i up = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrUp + i)));
+        __m256i upRight = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrUp + i + cn)));
+        __m256i left = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptr + i - cn)));
+        __m256i right = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptr + i + cn)));
+        __m256i downLeft = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrDown + i - cn)));
+        __m256i down = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrDown + i)));
+        __m256i downRight = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ptrDown + i + cn)));
+
+        __m256i gx =
+            _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(upRight, downRight), _mm256_slli_epi16(right, 1)),
+                             _mm256_add_epi16(_mm256_add_epi16(upLeft, downLeft), _mm256_slli_epi16(left, 1)));
+        __m256i gy =
+            _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(downLeft, downRight), _mm256_slli_epi16(down, 1)),
+                             _mm256_add_epi16(_mm256_add_epi16(upLeft, upRight), _mm256_slli_epi16(up, 1)));
+
+        storeBytes16AVX2(ptrDst + i, magnitude16AVX2<Norm>(gx, gy));
+    }
+    return i;
+}
+
+/**
+ * @brief AVX2 version of the magnitude row over two signed short gradient rows. Processes 16 values per iteration.
+ *
+ * @return The first value that was not written.
+ */
+template <MagnitudeNorm Norm>
+SIMD_TARGET_AVX2 static int magnitudeRowAVX2(const short *ptrSx, const short *ptrSy, uchar *ptrDst, int width)
+{
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        __m256i mag = magnitude16AVX2<Norm>(_mm256_loadu_si256((const __m256i *)(ptrSx + i)),
+                                            _mm256_loadu_si256((const __m256i *)(ptrSy + i)));
+        storeBytes16AVX2(ptrDst + i, mag);
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Fused Sobel magnitude over part of a row using the best instruction set available.
+ */
+template <MagnitudeNorm Norm>
+static void sobelMagnitudeRow(const uchar *ptrUp, const uchar *ptr, const uchar *ptrDown, uchar *ptrDst, int begin,
+                              int end, int cn)
+{
+    int i = begin;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = sobelMagnitudeRowAVX2<Norm>(ptrUp, ptr, ptrDown, ptrDst, i, end, cn);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i = sobelMagnitudeRowSSE41<Norm>(ptrUp, ptr, ptrDown, ptrDst, i, end, cn);
+    }
+#endif
+    sobelPointRow<gradientNorm<Norm> >(ptrUp, ptr, ptrDown, ptrDst, i, end, cn);
+}
+
+/**
+ * @brief Magnitude of a row of signed short gradients using the best instruction set available.
+ */
+template <MagnitudeNorm Norm> static void magnitudeRow(const short *ptrSx, const short *ptrSy, uchar *ptrDst, int width)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = magnitudeRowAVX2<Norm>(ptrSx, ptrSy, ptrDst, width);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i += magnitudeRowSSE41<Norm>(ptrSx + i, ptrSy + i, ptrDst + i, width - i);
+    }
+#endif
+    for (; i < width; i++)
+    {
+        ptrDst[i] = gradientNorm<Norm>(ptrSx[i], ptrSy[i]);
+    }
+}
+
+/**
+ * @brief Apply a per-pixel function of the 3x3 Sobel gradients straight from an image with pixels of type T.
+ *
+ * The gradients of each pixel channel are computed by rowFunc and mapped to an output value without ever being stored,
+ * so no intermediate gradient images are allocated or written.
+ *
+ * @param src The source image, with depth PixelTraits<T>::DEPTH.
+ * @param dst The destination image, same size and type as src.
+ * @param border The value written to border pixels, where the kernel does not fit.
+ * @param rowFunc The function filling the interior of each row, with the signature of SobelRowFunc for pixels of T.
+ * @param ctx Optional context that holds the copy of the source for in-place calls.
+ * @return 0 if successful, -1 if error.
+ */
+template <typename T, typename RowFunc>
+static int sobelPointFilter(cv::Mat &src, cv::Mat &dst, T border, RowFunc rowFunc, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != PixelTraits<T>::DEPTH)
+    {
+        printf("Unexpected image depth\n");
+        return -1;
+    }
+
+    int cn = src.channels();
+    int width = src.cols * cn; // row length in values
+
+    cv::Mat input = stencilInput(src, dst, ctx);
+    dst.create(src.size(), src.type());
+
+    parallelRows(0, input.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            T *ptrDst = dst.ptr<T>(y);
+
+            if (y == 0 || y == input.rows - 1 || input.cols < 3)
+            {
+                std::fill(ptrDst, ptrDst + width, border);
+                continue;
+            }
+
+            std::fill(ptrDst, ptrDst + cn, border);
+            rowFunc(input.ptr<T>(y - 1), input.ptr<T>(y), input.ptr<T>(y + 1), ptrDst, cn, width - cn, cn);
+            std::fill(ptrDst + width - cn, ptrDst + width, border);
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Magnitude of the gradients of a 16-bit or float image, as an image with pixels of type T.
+ *
+ * @param sx The horizontal gradients, of type PixelTraits<T>::Gradient.
+ * @param sy The vertical gradients, same type and size as sx.
+ * @param dst The destination image.
+ * @param norm The norm to measure the gradient with.
+ * @return 0 if successful.
+ */
+template <typename T> static int magnitudeWide(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeNorm norm)
+{
+    typedef typename PixelTraits<T>::Gradient Gradient;
+
+    dst.create(sx.size(), CV_MAKETYPE(PixelTraits<T>::DEPTH, sx.channels()));
+
+    int width = sx.cols * sx.channels(); // row length in values
+    parallelRows(0, dst.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const Gradient *ptrSx = sx.ptr<Gradient>(y);
+            const Gradient *ptrSy = sy.ptr<Gradient>(y);
+            T *ptrDst = dst.ptr<T>(y);
+
+            for (int i = 0; i < width; i++)
+            {
+                ptrDst[i] = norm == MAGNITUDE_L1 ? gradientNormWide<T, MAGNITUDE_L1>(ptrSx[i], ptrSy[i])
+                                                 : gradientNormWide<T, MAGNITUDE_L2>(ptrSx[i], ptrSy[i]);
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Calculate the gradient magnitude of an image.
+ *
+ * This function calculates the gradient magnitude of an image. It does so by
+ * applying horizontal and vertical sobel filters to each pixel within a nested loop.
+ *
+ * The magnitude is computed in integers (or exact single precision square roots on the SIMD paths) and saturated to
+ * 255, so no double precision math runs per pixel. The 32-bit integer gradients of a 16-bit image give a 16-bit
+ * magnitude saturated to 65535, and float gradients a float magnitude.
+ *
+ * @param sx The source image with a sobel x filter applied.
+ * @param sy The source image with a sobel y filter applied.
+ * @param dst The destination image.
+ * @param norm The norm to measure the gradient with.
+ * @return 0 if successful, -1 if error.
+ */
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeNorm norm)
+{
+
+    if (sx.empty() || sy.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (sx.type() != sy.type() || sx.size() != sy.size())
+    {
+        printf("Expected two gradient images of the same type and size\n");
+        return -1;
+    }
+
+    if (sx.depth() == CV_32S)
+    {
+        return magnitudeWide<ushort>(sx, sy, dst, norm);
+    }
+    if (sx.depth() == CV_32F)
+    {
+        return magnitudeWide<float>(sx, sy, dst, norm);
+    }
+    if (sx.depth() != CV_16S)
+    {
+        printf("Expected signed short, 32-bit integer or float gradients\n");
+        return -1;
+    }
+
+    dst.create(sx.size(), CV_8UC(sx.channels())); // Create dst with unsigned char type
+
+    int width = sx.cols * sx.channels(); // row length in values
+    parallelRows(0, dst.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const short *ptrSx = sx.ptr<short>(y);
+            const short *ptrSy = sy.ptr<short>(y);
+            uchar *ptrDst = dst.ptr<uchar>(y);
+
+            if (norm == MAGNITUDE_L1)
+            {
+                magnitudeRow<MAGNITUDE_L1>(ptrSx, ptrSy, ptrDst, width);
+            }
+            else
+            {
+                magnitudeRow<MAGNITUDE_L2>(ptrSx, ptrSy, ptrDst, width);
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Calculate the gradient magnitude of an image.
+ *
+ * This function calculates the gradient magnitude of an image. The horizontal and vertical 3x3 sobel gradients of
+ * each pixel are computed from the three rows around it and combined with the chosen norm.
+ *
+ * The gradients are computed and turned into a magnitude in the same pass, without writing intermediate signed short
+ * images. Border pixels are set to 0. Rows are vectorized with AVX2 or SSE4.1 when the CPU supports them. 16-bit and
+ * float images run a scalar loop templated on the pixel type and give a magnitude of the same depth.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param norm The norm to measure the gradient with.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int magnitude(cv::Mat &src, cv::Mat &dst, MagnitudeNorm norm, FilterContext *ctx)
+{
+    bool l1 = norm == MAGNITUDE_L1;
+    switch (src.depth())
+    {
+    case CV_16U:
+        return sobelPointFilter<ushort>(src, dst, 0, l1 ? sobelMagnitudeRowWide<ushort, MAGNITUDE_L1>
+                                                        : sobelMagnitudeRowWide<ushort, MAGNITUDE_L2>,
+                                        ctx);
+    case CV_32F:
+        return sobelPointFilter<float>(src, dst, 0, l1 ? sobelMagnitudeRowWide<float, MAGNITUDE_L1>
+                                                       : sobelMagnitudeRowWide<float, MAGNITUDE_L2>,
+                                       ctx);
+    default:
+        SobelRowFunc rowFunc = l1 ? sobelMagnitudeRow<MAGNITUDE_L1> : sobelMagnitudeRow<MAGNITUDE_L2>;
+        return sobelPointFilter<uchar>(src, dst, 0, rowFunc, ctx);
+    }
+}
+
+/**
+ * @brief Blur a color image using a 5x5 Gaussian kernel. Quantize the image to a specified number of levels.
+ *
+ * This function blurs a color image using a 5x5 Gaussian kernel. It then quantizes the image to a specified number of
+ * levels. It does so by dividing the image into buckets and setting each pixel to the average value of the bucket.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param levels The number of levels to quantize the image to.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (levels < 1)
+    {
+        printf("Expected at least one level\n");
+        return -1;
+    }
+
+    if (blur5x5_5(src, dst, cv::BORDER_REFLECT_101, ctx) != 0)
+    {
+        return -1;
+    }
+
+    return PointOp::quantize(levels).apply(dst, dst);
+}
+
+// Rows of scratch cartoonize keeps per band: the five-row ring of horizontal sums, then three blurred rows and the
+// three intensity rows made from them
+static const int CARTOON_SUM_ROWS = 5;
+static const int CARTOON_BAND_ROWS = CARTOON_SUM_ROWS + 3 + 3;
+
+// Narrowest strip of columns cartoonize splits a band into, so a small tile cache budget still leaves the SIMD rows
+// long enough to pay off
+static const int CARTOON_MIN_TILE_COLS = 64;
+
+// Largest |gx| + |gy| of a 3x3 Sobel kernel on 8-bit intensities, the top of the cartoonize edge threshold range
+static const int CARTOON_MAX_EDGE_THRESHOLD = 2 * 4 * 255;
+
+/**
+ * @brief Split a lookup table into blocks of 16 inputs that each step at most once, so it can be applied with byte
+ * shuffles indexed by the high nibble of each input. Quantization tables of up to 16 levels qualify.
+ *
+ * @param table The table.
+ * @param low The output at the start of each block.
+ * @param high The output from the step of each block on, the same as low if the block does not step.
+ * @param step The first input of each block that gives high.
+ * @return true if every block steps at most once.
+ */
+static bool tableBlocks(const uchar *table, uchar *low, uchar *high, uchar *step)
+{
+    for (int block = 0; block < 16; block++)
+    {
+        const uchar *entries = table + 16 * block;
+        low[block] = entries[0];
+        high[block] = entries[0];
+        step[block] = static_cast<uchar>(16 * block);
+        for (int i = 1; i < 16; i++)
+        {
+            if (entries[i] != entries[i - 1])
+            {
+                if (high[block] != low[block])
+                {
+                    return false;
+                }
+                high[block] = entries[i];
+                step[block] = static_cast<uchar>(16 * block + i);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Intensity of part of a row of pixels, as in pixelIntensity.
+ *
+ * @param src The source row.
+ * @param dst The destination row, one byte per pixel.
+ * @param begin The first pixel to write.
+ * @param end One past the last pixel to write.
+ * @param cn The number of channels.
+ */
+static void intensityRowScalar(const uchar *src, uchar *dst, int begin, int end, int cn)
+{
+    for (int x = begin; x < end; x++)
+    {
+        dst[x] = static_cast<uchar>(pixelIntensity(src + x * cn, cn));
+    }
+}
+
+/**
+ * @brief Write part of a row of the cartoon effect: the quantized blurred pixel, or black where the L1 norm of the 3x3
+ * Sobel gradient of the blurred intensity is above a threshold. Columns past the ends of the row are replicated.
+ *
+ * @param intensity The blurred intensity rows above, at and below the row.
+ * @param blurred The blurred row.
+ * @param dst The destination row.
+ * @param begin The first pixel to write.
+ * @param end One past the last pixel to write.
+ * @param cols The row length in pixels.
+ * @param cn The number of channels.
+ * @param edgeThreshold The gradient norm above which a pixel is an edge.
+ * @param table The quantization table.
+ */
+static void cartoonRowScalar(const uchar *const intensity[3], const uchar *blurred, uchar *dst, int begin, int end,
+                             int cols, int cn, int edgeThreshold, const uchar *table)
+{
+    const uchar *above = intensity[0];
+    const uchar *centre = intensity[1];
+    const uchar *below = intensity[2];
+    for (int x = begin; x < end; x++)
+    {
+        int left = x > 0 ? x - 1 : 0;
+        int right = x < cols - 1 ? x + 1 : cols - 1;
+        int gx = (above[right] + 2 * centre[right] + below[right]) - (above[left] + 2 * centre[left] + below[left]);
+        int gy = (below[left] + 2 * below[x] + below[right]) - (above[left] + 2 * above[x] + above[right]);
+        bool edge = std::abs(gx) + std::abs(gy) > edgeThreshold;
+        for (int c = 0; c < cn; c++)
+        {
+            dst[x * cn + c] = edge ? 0 : table[blurred[x * cn + c]];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief SSE4.1 version of intensityRowScalar for 3- and 4-channel rows. Processes 8 pixels per iteration.
+ *
+ * @return The first pixel not written.
+ */
+SIMD_TARGET_SSE41 static int intensityRowSSE41(const uchar *src, uchar *dst, int begin, int end, int cn)
+{
+    // Each channel of eight pixels is gathered into 16-bit lanes from two vectors of 16 bytes. The second vector of a
+    // 3-channel row starts at byte 8, so both layouts read 16 bytes per vector without going past the 8 pixels.
+    const int offset = cn == 3 ? 8 : 16;
+    __m128i lo[3], hi[3];
+    for (int c = 0; c < 3; c++)
+    {
+        signed char maskLo[16], maskHi[16];
+        for (int i = 0; i < 8; i++)
+        {
+            int byte = i * cn + c;
+            maskLo[2 * i] = static_cast<signed char>(byte < 16 ? byte : -1);
+            maskHi[2 * i] = static_cast<signed char>(byte >= 16 ? byte - offset : -1);
+            maskLo[2 * i + 1] = -1;
+            maskHi[2 * i + 1] = -1;
+        }
+        lo[c] = _mm_loadu_si128((const __m128i *)maskLo);
+        hi[c] = _mm_loadu_si128((const __m128i *)maskHi);
+    }
+
+    const __m128i weightBlue = _mm_set1_epi16(29);
+    const __m128i weightGreen = _mm_set1_epi16(150);
+    const __m128i weightRed = _mm_set1_epi16(77);
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        const uchar *ptr = src + x * cn;
+        __m128i a = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i b = _mm_loadu_si128((const __m128i *)(ptr + offset));
+        __m128i blue = _mm_or_si128(_mm_shuffle_epi8(a, lo[0]), _mm_shuffle_epi8(b, hi[0]));
+        __m128i green = _mm_or_si128(_mm_shuffle_epi8(a, lo[1]), _mm_shuffle_epi8(b, hi[1]));
+        __m128i red = _mm_or_si128(_mm_shuffle_epi8(a, lo[2]), _mm_shuffle_epi8(b, hi[2]));
+
+        // The weights add up to 256, so the weighted sum fits in 16 unsigned bits
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(blue, weightBlue), _mm_mullo_epi16(green, weightGreen));
+        sum = _mm_add_epi16(sum, _mm_mullo_epi16(red, weightRed));
+        sum = _mm_srli_epi16(sum, 8);
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+/**
+ * @brief AVX2 version of intensityRowSSE41. Processes 32 pixels per iteration.
+ *
+ * Each 128-bit lane shuffles four pixels into B, G, G, R order and multiplies them by 29, 99, 51 and 77 with
+ * _mm256_maddubs_epi16. The green weight of 150 does not fit a signed byte, so it is split across the two pairs, each of
+ * which adds up to at most 255 * 128 without saturating. _mm256_madd_epi16 then adds the pairs into the exact weighted
+ * sum of pixelIntensity.
+ *
+ * @return The first pixel not written.
+ */
+SIMD_TARGET_AVX2 static int intensityRowAVX2(const uchar *src, uchar *dst, int begin, int end, int cn)
+{
+    signed char order[16];
+    for (int p = 0; p < 4; p++)
+    {
+        order[4 * p] = static_cast<signed char>(p * cn);
+        order[4 * p + 1] = static_cast<signed char>(p * cn + 1);
+        order[4 * p + 2] = static_cast<signed char>(p * cn + 1);
+        order[4 * p + 3] = static_cast<signed char>(p * cn + 2);
+    }
+    const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)order));
+    const __m256i weights = _mm256_set1_epi32(29 | (99 << 8) | (51 << 16) | (77 << 24));
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    // A lane reads 16 bytes from its first pixel, so a 3-channel row needs two pixels past the 32 it writes
+    const int slack = cn == 3 ? 2 : 0;
+    int x = begin;
+    for (; x + 32 + slack <= end; x += 32)
+    {
+        __m256i sums[4];
+        for (int v = 0; v < 4; v++)
+        {
+            const uchar *ptr = src + (x + 8 * v) * cn;
+            __m256i pixels = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)ptr)),
+                _mm_loadu_si128((const __m128i *)(ptr + 4 * cn)), 1);
+            __m256i pairs = _mm256_maddubs_epi16(_mm256_shuffle_epi8(pixels, shuffle), weights);
+            sums[v] = _mm256_madd_epi16(pairs, ones);
+        }
+
+        // Pack to 16 bits, drop the 8 fraction bits, pack to bytes and put the 4-pixel groups back in order
+        __m256i lo = _mm256_srli_epi16(_mm256_packus_epi32(sums[0], sums[1]), 8);
+        __m256i hi = _mm256_srli_epi16(_mm256_packus_epi32(sums[2], sums[3]), 8);
+        __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), pixelOrder);
+        _mm256_storeu_si256((__m256i *)(dst + x), bytes);
+    }
+    return x;
+}
+
+/**
+ * @brief L1 norms of the 3x3 Sobel gradients at eight pixels of an intensity row, as 16-bit values, using SSE4.1.
+ *
+ * @param above The row above, at the first pixel.
+ * @param centre The row, at the first pixel.
+ * @param below The row below, at the first pixel.
+ */
+SIMD_TARGET_SSE41 static inline __m128i sobelNorm8SSE41(const uchar *above, const uchar *centre, const uchar *below)
+{
+    __m128i aboveLeft = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(above - 1)));
+    __m128i aboveMiddle = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)above));
+    __m128i aboveRight = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(above + 1)));
+    __m128i centreLeft = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(centre - 1)));
+    __m128i centreRight = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(centre + 1)));
+    __m128i belowLeft = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(below - 1)));
+    __m128i belowMiddle = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)below));
+    __m128i belowRight = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(below + 1)));
+
+    __m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(aboveRight, belowRight), _mm_slli_epi16(centreRight, 1)),
+                               _mm_add_epi16(_mm_add_epi16(aboveLeft, belowLeft), _mm_slli_epi16(centreLeft, 1)));
+    __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(belowLeft, belowRight), _mm_slli_epi16(belowMiddle, 1)),
+                               _mm_add_epi16(_mm_add_epi16(aboveLeft, aboveRight), _mm_slli_epi16(aboveMiddle, 1)));
+    return _mm_add_epi16(_mm_abs_epi16(gx), _mm_abs_epi16(gy));
+}
+
+/**
+ * @brief Look up 16 bytes in a table split by tableBlocks, using SSE4.1.
+ *
+ * @param v The bytes.
+ * @param low The low outputs of the blocks.
+ * @param high The high outputs of the blocks.
+ * @param step The step inputs of the blocks.
+ */
+SIMD_TARGET_SSE41 static inline __m128i lookupBlocks16SSE41(__m128i v, __m128i low, __m128i high, __m128i step)
+{
+    __m128i block = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_shuffle_epi8(step, block)), v);
+    return _mm_blendv_epi8(_mm_shuffle_epi8(low, block), _mm_shuffle_epi8(high, block), above);
+}
+
+/**
+ * @brief SSE4.1 version of cartoonRowScalar for the pixels with both horizontal neighbours in the row, and a table
+ * split by tableBlocks. Processes 16 pixels per iteration without branching on edges: the bytes are quantized by
+ * shuffles, then cleared by the edge mask of their pixel.
+ *
+ * @return The first pixel not written.
+ */
+SIMD_TARGET_SSE41 static int cartoonRowSSE41(const uchar *const intensity[3], const uchar *blurred, uchar *dst,
+                                             int begin, int end, int cn, int edgeThreshold, const uchar *blocks)
+{
+    // Byte i of the j-th vector of 16 pixels belongs to pixel (16 * j + i) / cn
+    __m128i expand[4];
+    for (int j = 0; j < cn; j++)
+    {
+        signed char mask[16];
+        for (int i = 0; i < 16; i++)
+        {
+            mask[i] = static_cast<signed char>((16 * j + i) / cn);
+        }
+        expand[j] = _mm_loadu_si128((const __m128i *)mask);
+    }
+
+    const __m128i threshold = _mm_set1_epi16(static_cast<short>(edgeThreshold));
+    const __m128i low = _mm_loadu_si128((const __m128i *)blocks);
+    const __m128i high = _mm_loadu_si128((const __m128i *)(blocks + 16));
+    const __m128i step = _mm_loadu_si128((const __m128i *)(blocks + 32));
+    int x = begin;
+    for (; x + 16 <= end; x += 16)
+    {
+        __m128i normLo = sobelNorm8SSE41(intensity[0] + x, intensity[1] + x, intensity[2] + x);
+        __m128i normHi = sobelNorm8SSE41(intensity[0] + x + 8, intensity[1] + x + 8, intensity[2] + x + 8);
+        __m128i edges = _mm_packs_epi16(_mm_cmpgt_epi16(normLo, threshold), _mm_cmpgt_epi16(normHi, threshold));
+
+        for (int j = 0; j < cn; j++)
+        {
+            int i = x * cn + 16 * j;
+            __m128i quantized = lookupBlocks16SSE41(_mm_loadu_si128((const __m128i *)(blurred + i)), low, high, step);
+            __m128i cleared = _mm_andnot_si128(_mm_shuffle_epi8(edges, expand[j]), quantized);
+            _mm_storeu_si128((__m128i *)(dst + i), cleared);
+        }
+    }
+    return x;
+}
+
+/**
+ * @brief Edge masks of 16 pixels from their 3x3 neighbourhoods held in 16-bit lanes: all ones where the L1 norm of the
+ * Sobel gradient is above a threshold, using AVX2.
+ */
+SIMD_TARGET_AVX2 static inline __m256i sobelEdges16AVX2(__m256i aboveLeft, __m256i aboveMiddle, __m256i aboveRight,
+                                                        __m256i centreLeft, __m256i centreRight, __m256i belowLeft,
+                                                        __m256i belowMiddle, __m256i belowRight, __m256i threshold)
+{
+    __m256i gx = _mm256_sub_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(aboveRight, belowRight), _mm256_slli_epi16(centreRight, 1)),
+        _mm256_add_epi16(_mm256_add_epi16(aboveLeft, belowLeft), _mm256_slli_epi16(centreLeft, 1)));
+    __m256i gy = _mm256_sub_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(belowLeft, belowRight), _mm256_slli_epi16(belowMiddle, 1)),
+        _mm256_add_epi16(_mm256_add_epi16(aboveLeft, aboveRight), _mm256_slli_epi16(aboveMiddle, 1)));
+    return _mm256_cmpgt_epi16(_mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy)), threshold);
+}
+
+/**
+ * @brief Edge masks of 32 pixels of an intensity row: 0xFF where the L1 norm of the 3x3 Sobel gradient is above a
+ * threshold, using AVX2.
+ *
+ * The rows are loaded as 16-bit words and split into even pixels, the low bytes, and odd pixels, the high bytes, with
+ * masks and shifts rather than byte shuffles, which leaves the shuffle port to the quantization. Each half is
+ * compared in 16 bits and shifted back into its own byte, so the masks come out in pixel order.
+ *
+ * @param above The row above, at the first pixel.
+ * @param centre The row, at the first pixel.
+ * @param below The row below, at the first pixel.
+ * @param threshold The threshold in every 16-bit lane.
+ */
+SIMD_TARGET_AVX2 static inline __m256i sobelEdges32AVX2(const uchar *above, const uchar *centre, const uchar *below,
+                                                        __m256i threshold)
+{
+    __m256i aboveLeft = _mm256_loadu_si256((const __m256i *)(above - 1));
+    __m256i aboveMiddle = _mm256_loadu_si256((const __m256i *)above);
+    __m256i aboveRight = _mm256_loadu_si256((const __m256i *)(above + 1));
+    __m256i centreLeft = _mm256_loadu_si256((const __m256i *)(centre - 1));
+    __m256i centreRight = _mm256_loadu_si256((const __m256i *)(centre + 1));
+    __m256i belowLeft = _mm256_loadu_si256((const __m256i *)(below - 1));
+    __m256i belowMiddle = _mm256_loadu_si256((const __m256i *)below);
+    __m256i belowRight = _mm256_loadu_si256((const __m256i *)(below + 1));
+
+    const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+    __m256i even = sobelEdges16AVX2(
+        _mm256_and_si256(aboveLeft, lowBytes), _mm256_and_si256(aboveMiddle, lowBytes),
+        _mm256_and_si256(aboveRight, lowBytes), _mm256_and_si256(centreLeft, lowBytes),
+        _mm256_and_si256(centreRight, lowBytes), _mm256_and_si256(belowLeft, lowBytes),
+        _mm256_and_si256(belowMiddle, lowBytes), _mm256_and_si256(belowRight, lowBytes), threshold);
+    __m256i odd = sobelEdges16AVX2(
+        _mm256_srli_epi16(aboveLeft, 8), _mm256_srli_epi16(aboveMiddle, 8), _mm256_srli_epi16(aboveRight, 8),
+        _mm256_srli_epi16(centreLeft, 8), _mm256_srli_epi16(centreRight, 8), _mm256_srli_epi16(belowLeft, 8),
+        _mm256_srli_epi16(belowMiddle, 8), _mm256_srli_epi16(belowRight, 8), threshold);
+
+    return _mm256_or_si256(_mm256_srli_epi16(even, 8), _mm256_slli_epi16(odd, 8));
+}
+
+/**
+ * @brief AVX2 version of lookupBlocks16SSE41, for 32 bytes.
+ */
+SIMD_TARGET_AVX2 static inline __m256i lookupBlocks32AVX2(__m256i v, __m256i low, __m256i high, __m256i step)
+{
+    __m256i block = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_shuffle_epi8(step, block)), v);
+    return _mm256_blendv_epi8(_mm256_shuffle_epi8(low, block), _mm256_shuffle_epi8(high, block), above);
+}
+
+/**
+ * @brief Quantize 32 bytes of a blurred row with a table split by tableBlocks and clear the edge bytes, using AVX2.
+ *
+ * @param blurred The blurred bytes.
+ * @param dst The destination bytes.
+ * @param mask 0xFF for each byte of an edge pixel.
+ * @param low The low outputs of the blocks, in both halves.
+ * @param high The high outputs of the blocks, in both halves.
+ * @param step The step inputs of the blocks, in both halves.
+ */
+SIMD_TARGET_AVX2 static inline void cartoonBytes32AVX2(const uchar *blurred, uchar *dst, __m256i mask, __m256i low,
+                                                       __m256i high, __m256i step)
+{
+    __m256i quantized = lookupBlocks32AVX2(_mm256_loadu_si256((const __m256i *)blurred), low, high, step);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_andnot_si256(mask, quantized));
+}
+
+/**
+ * @brief AVX2 version of cartoonRowSSE41 for CN channels. Processes 32 pixels per iteration.
+ *
+ * Byte shuffles do not cross the 128-bit lanes, so each lane of output bytes shuffles its masks from a copy of the
+ * edge masks with the group of 16 pixels it belongs to in both halves. The masks stay in registers throughout.
+ *
+ * @return The first pixel not written.
+ */
+template <int CN>
+SIMD_TARGET_AVX2 static int cartoonRowAVX2(const uchar *const intensity[3], const uchar *blurred, uchar *dst,
+                                           int begin, int end, int edgeThreshold, const uchar *blocks)
+{
+    // Byte i of the k-th 16 bytes of a group of 16 pixels belongs to pixel (16 * k + i) / CN of the group, and the
+    // j-th vector of output bytes holds the 16-byte blocks 2j and 2j + 1
+    __m128i expand[4];
+    for (int k = 0; k < CN; k++)
+    {
+        signed char mask[16];
+        for (int i = 0; i < 16; i++)
+        {
+            mask[i] = static_cast<signed char>((16 * k + i) / CN);
+        }
+        expand[k] = _mm_loadu_si128((const __m128i *)mask);
+    }
+    __m256i pairExpand[4];
+    for (int j = 0; j < CN; j++)
+    {
+        pairExpand[j] =
+            _mm256_inserti128_si256(_mm256_castsi128_si256(expand[(2 * j) % CN]), expand[(2 * j + 1) % CN], 1);
+    }
+
+    const __m256i threshold = _mm256_set1_epi16(static_cast<short>(edgeThreshold));
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)blocks));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(blocks + 16)));
+    const __m256i step = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(blocks + 32)));
+    int x = begin;
+    for (; x + 32 <= end; x += 32)
+    {
+        // Pixel masks of group 0 in the low half and group 1 in the high half. The 16-byte blocks of a 2-channel row
+        // come from groups 0, 0 | 1, 1, those of a 3-channel row from 0, 0 | 0, 1 | 1, 1 and those of a 4-channel row
+        // from 0, 0 | 0, 0 | 1, 1 | 1, 1.
+        __m256i edges = sobelEdges32AVX2(intensity[0] + x, intensity[1] + x, intensity[2] + x, threshold);
+        const uchar *ptrBlurred = blurred + x * CN;
+        uchar *ptrDst = dst + x * CN;
+        if (CN == 1)
+        {
+            cartoonBytes32AVX2(ptrBlurred, ptrDst, edges, low, high, step);
+            continue;
+        }
+
+        __m256i group0 = _mm256_permute2x128_si256(edges, edges, 0x00);
+        __m256i group1 = _mm256_permute2x128_si256(edges, edges, 0x11);
+        if (CN == 2)
+        {
+            cartoonBytes32AVX2(ptrBlurred, ptrDst, _mm256_shuffle_epi8(group0, pairExpand[0]), low, high, step);
+            cartoonBytes32AVX2(ptrBlurred + 32, ptrDst + 32, _mm256_shuffle_epi8(group1, pairExpand[1]), low, high,
+                               step);
+            continue;
+        }
+
+        cartoonBytes32AVX2(ptrBlurred, ptrDst, _mm256_shuffle_epi8(group0, pairExpand[0]), low, high, step);
+        cartoonBytes32AVX2(ptrBlurred + 32, ptrDst + 32, _mm256_shuffle_epi8(CN == 3 ? edges : group0, pairExpand[1]),
+                           low, high, step);
+        cartoonBytes32AVX2(ptrBlurred + 64, ptrDst + 64, _mm256_shuffle_epi8(group1, pairExpand[2]), low, high, step);
+        if (CN == 4)
+        {
+            cartoonBytes32AVX2(ptrBlurred + 96, ptrDst + 96, _mm256_shuffle_epi8(group1, pairExpand[3]), low, high,
+                               step);
+        }
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Intensity of a row of pixels using the best instruction set available.
+ */
+static void intensityRow(const uchar *src, uchar *dst, int cols, int cn)
+{
+    if (cn == 1)
+    {
+        memcpy(dst, src, cols);
+        return;
+    }
+
+    int x = 0;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (cn >= 3 && level >= SIMD_AVX2)
+    {
+        x = intensityRowAVX2(src, dst, x, cols, cn);
+    }
+    if (cn >= 3 && level >= SIMD_SSE41)
+    {
+        x = intensityRowSSE41(src, dst, x, cols, cn);
+    }
+#endif
+    intensityRowScalar(src, dst, x, cols, cn);
+}
+
+/**
+ * @brief Write part of one row of the cartoon effect using the best instruction set available.
+ *
+ * @param intensity The blurred intensity rows above, at and below the row.
+ * @param blurred The blurred row.
+ * @param dst The destination row.
+ * @param begin The first pixel to write.
+ * @param end One past the last pixel to write.
+ * @param cols The row length in pixels. The first and last pixels replicate their missing neighbour.
+ * @param cn The number of channels.
+ * @param edgeThreshold The gradient norm above which a pixel is an edge.
+ * @param table The quantization table.
+ * @param blocks The low, high and step arrays of the table from tableBlocks, one after the other, or NULL to look up
+ * every byte.
+ */
+static void cartoonRow(const uchar *const intensity[3], const uchar *blurred, uchar *dst, int begin, int end, int cols,
+                       int cn, int edgeThreshold, const uchar *table, const uchar *blocks)
+{
+    // The first and last pixels replicate their missing neighbour, so only the scalar code writes them
+    int first = std::min(std::max(begin, 1), end);
+    int x = first;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    int last = std::max(std::min(end, cols - 1), x);
+    if (blocks != NULL && level >= SIMD_AVX2)
+    {
+        switch (cn)
+        {
+        case 1:
+            x = cartoonRowAVX2<1>(intensity, blurred, dst, x, last, edgeThreshold, blocks);
+            break;
+        case 2:
+            x = cartoonRowAVX2<2>(intensity, blurred, dst, x, last, edgeThreshold, blocks);
+            break;
+        case 3:
+            x = cartoonRowAVX2<3>(intensity, blurred, dst, x, last, edgeThreshold, blocks);
+            break;
+        case 4:
+            x = cartoonRowAVX2<4>(intensity, blurred, dst, x, last, edgeThreshold, blocks);
+            break;
+        }
+    }
+    if (blocks != NULL && level >= SIMD_SSE41)
+    {
+        x = cartoonRowSSE41(intensity, blurred, dst, x, last, cn, edgeThreshold, blocks);
+    }
+#endif
+    cartoonRowScalar(intensity, blurred, dst, begin, first, cols, cn, edgeThreshold, table);
+    cartoonRowScalar(intensity, blurred, dst, x, end, cols, cn, edgeThreshold, table);
+}
+
+/**
+ * @brief Turn an image into a cartoon: blur it, quantize it and draw its edges in black, in one pass.
+ *
+ * The blur is the 5x5 kernel of blur5x5_5 and the quantization that of PointOp::quantize, so away from edges the
+ * result is exactly blurQuantize. A pixel is an edge when the L1 norm of the 3x3 Sobel gradient of the blurred
+ * intensity is above the threshold. Each band of rows is split into strips of columns sized to the tile cache budget
+ * set by setFilterTileCache, and each strip streams down the band through a few rows of scratch: a ring of horizontal
+ * sums, the blurred rows and their intensity. An output row is written as soon as the blurred rows below it are
+ * ready, so nothing is written at full size but the result. Bands and strips also blur the row and column on each
+ * side of them for the edge test.
+ * Works on 8-bit images with 1 to 4 channels.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @param levels The number of levels to quantize the image to.
+ * @param edgeThreshold The Sobel gradient norm above which a pixel is drawn as an edge, from 0 to 2040.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int cartoonize(cv::Mat &src, cv::Mat &dst, int levels, int edgeThreshold, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (!isChannelCountSupported(src))
+    {
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    if (levels < 1)
+    {
+        printf("Expected at least one level\n");
+        return -1;
+    }
+
+    if (edgeThreshold < 0 || edgeThreshold > CARTOON_MAX_EDGE_THRESHOLD)
+    {
+        printf("Expected an edge threshold from 0 to %d\n", CARTOON_MAX_EDGE_THRESHOLD);
+        return -1;
+    }
+
+    int rows = src.rows;
+    int cols = src.cols;
+    int cn = src.channels();
+    int bands = rowBandCount(rows);
+    PointOp quantize = PointOp::quantize(levels);
+    uchar blocks[48];
+    bool shuffled = tableBlocks(quantize.table, blocks, blocks + 16, blocks + 32);
+
+    // Strips of columns sized so their rows of scratch, plus the source and output rows, fit the tile cache budget
+    int pixelBytes = (CARTOON_SUM_ROWS * static_cast<int>(sizeof(ushort)) + 3 + 1) * cn + 3;
+    int tileCache = getFilterTileCache();
+    int tileCols = tileCache > 0 ? std::min(cols, std::max(tileCache / pixelBytes, CARTOON_MIN_TILE_COLS)) : cols;
+    int spanCols = std::min(tileCols + 2, cols); // a strip and the column on each side of it
+
+    cv::Mat input = stencilInput(src, dst, ctx);
+    cv::Mat local;
+    cv::Mat &scratch =
+        scratchImage(ctx, FilterContext::SCRATCH_TEMP, bands * CARTOON_BAND_ROWS, spanCols * cn, CV_16U, local);
+    dst.create(src.size(), src.type());
+
+    parallelRows(0, rows, [&](int y0, int y1) {
+        int first = rowBandIndex(0, rows, bands, y0) * CARTOON_BAND_ROWS;
+
+        // Ring slots: horizontal sums of row r at (r + 5) % 5, blurred row r and its intensity at r % 3. The blurred
+        // rows live in the ushort scratch rows as bytes.
+        auto sums = [&](int r) { return scratch.ptr<ushort>(first + (r + CARTOON_SUM_ROWS) % CARTOON_SUM_ROWS); };
+        auto blurred = [&](int r) { return scratch.ptr<uchar>(first + CARTOON_SUM_ROWS + r % 3); };
+        auto intensity = [&](int r) { return scratch.ptr<uchar>(first + CARTOON_SUM_ROWS + 3 + r % 3); };
+
+        for (int tx0 = 0; tx0 < cols; tx0 += tileCols)
+        {
+            // The strip is blurred over [x0, x1), which adds the column on each side of it for the edge test
+            int tx1 = std::min(tx0 + tileCols, cols);
+            int x0 = std::max(tx0 - 1, 0);
+            int x1 = std::min(tx1 + 1, cols);
+            int span = x1 - x0;
+
+            int nextSum = std::max(y0 - 1, 0) - 2; // next row of horizontal sums to compute
+            int nextBlur = std::max(y0 - 1, 0);    // next blurred row to compute
+            for (int y = y0; y < y1; y++)
+            {
+                for (; nextBlur <= std::min(y + 1, rows - 1); nextBlur++)
+                {
+                    for (; nextSum <= nextBlur + 2; nextSum++)
+                    {
+                        blurRow5(input, nextSum, sums(nextSum), x0, x1, cv::BORDER_REFLECT_101);
+                    }
+
+                    const ushort *window[5] = {sums(nextBlur - 2), sums(nextBlur - 1), sums(nextBlur),
+                                               sums(nextBlur + 1), sums(nextBlur + 2)};
+                    uchar *ptrBlurred = blurred(nextBlur);
+                    blurCol5(window, ptrBlurred, 0, span * cn);
+
+                    intensityRow(ptrBlurred, intensity(nextBlur), span, cn);
+                }
+
+                // Rows past the top and bottom of the image are replicated for the edge test, and so are the columns
+                // past its sides, which are the only ends of [x0, x1) the strip writes
+                const uchar *window[3] = {intensity(std::max(y - 1, 0)), intensity(y),
+                                          intensity(std::min(y + 1, rows - 1))};
+                cartoonRow(window, blurred(y), dst.ptr<uchar>(y) + x0 * cn, tx0 - x0, tx1 - x0, span, cn,
+                           edgeThreshold, quantize.table, shuffled ? blocks : NULL);
+            }
+        }
+    });
+
+    return 0;
+}
+
+// Largest unsharp mask amount, and the fixed-point bits it is applied with
+static const int UNSHARP_MAX_AMOUNT = 16;
+static const int UNSHARP_AMOUNT_BITS = 8;
+
+/**
+ * @brief Sharpen part of a row by adding back its difference from the blurred row: dst = src + amount * (src - blur)
+ * where |src - blur| is above the threshold, saturated to [0, 255].
+ *
+ * @param src The source row.
+ * @param blurred The blurred row.
+ * @param dst The destination row. May be the same as src.
+ * @param begin The first byte to write.
+ * @param end One past the last byte to write.
+ * @param amount The amount in fixed point with UNSHARP_AMOUNT_BITS fraction bits.
+ * @param threshold The largest difference left unsharpened.
+ */
+static void sharpenRowScalar(const uchar *src, const uchar *blurred, uchar *dst, int begin, int end, int amount,
+                             int threshold)
+{
+    const int round = 1 << (UNSHARP_AMOUNT_BITS - 1);
+    for (int i = begin; i < end; i++)
+    {
+        int diff = src[i] - blurred[i];
+        int delta = std::abs(diff) > threshold ? (diff * amount + round) >> UNSHARP_AMOUNT_BITS : 0;
+        dst[i] = cv::saturate_cast<uchar>(src[i] + delta);
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief Sharpened values of eight pixels widened to 16 bits, using SSE4.1.
+ *
+ * The product with the amount is formed in 32 bits by one multiply-add of each difference interleaved with 1 against
+ * the amount interleaved with the rounding term.
+ *
+ * @param s The source values.
+ * @param b The blurred values.
+ * @param amountRound The amount and the rounding term, in the low and high halves of each 32-bit lane.
+ * @param threshold The largest difference left unsharpened.
+ */
+SIMD_TARGET_SSE41 static inline __m128i sharpen8SSE41(__m128i s, __m128i b, __m128i amountRound, __m128i threshold)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i diff = _mm_sub_epi16(s, b);
+    __m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(diff, one), amountRound), UNSHARP_AMOUNT_BITS);
+    __m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(diff, one), amountRound), UNSHARP_AMOUNT_BITS);
+    __m128i delta = _mm_and_si128(_mm_packs_epi32(lo, hi), _mm_cmpgt_epi16(_mm_abs_epi16(diff), threshold));
+    return _mm_add_epi16(s, delta);
+}
+
+/**
+ * @brief SSE4.1 version of sharpenRowScalar. Processes 16 bytes per iteration.
+ *
+ * @return The first byte not written.
+ */
+SIMD_TARGET_SSE41 static int sharpenRowSSE41(const uchar *src, const uchar *blurred, uchar *dst, int begin, int end,
+                                             int amount, int threshold)
+{
+    const __m128i amountRound = _mm_set1_epi32((1 << (UNSHARP_AMOUNT_BITS - 1 + 16)) | amount);
+    const __m128i limit = _mm_set1_epi16(static_cast<short>(threshold));
+    const __m128i zero = _mm_setzero_si128();
+    int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(blurred + i));
+        __m128i lo = sharpen8SSE41(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(b, zero), amountRound, limit);
+        __m128i hi = sharpen8SSE41(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(b, zero), amountRound, limit);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+}
+
+/**
+ * @brief AVX2 version of sharpen8SSE41, for sixteen pixels.
+ */
+SIMD_TARGET_AVX2 static inline __m256i sharpen16AVX2(__m256i s, __m256i b, __m256i amountRound, __m256i threshold)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i diff = _mm256_sub_epi16(s, b);
+    __m256i lo =
+        _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(diff, one), amountRound), UNSHARP_AMOUNT_BITS);
+    __m256i hi =
+        _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(diff, one), amountRound), UNSHARP_AMOUNT_BITS);
+    __m256i delta =
+        _mm256_and_si256(_mm256_packs_epi32(lo, hi), _mm256_cmpgt_epi16(_mm256_abs_epi16(diff), threshold));
+    return _mm256_add_epi16(s, delta);
+}
+
+/**
+ * @brief AVX2 version of sharpenRowScalar. Processes 32 bytes per iteration.
+ *
+ * @return The first byte not written.
+ */
+SIMD_TARGET_AVX2 static int sharpenRowAVX2(const uchar *src, const uchar *blurred, uchar *dst, int begin, int end,
+                                           int amount, int threshold)
+{
+    const __m256i amountRound = _mm256_set1_epi32((1 << (UNSHARP_AMOUNT_BITS - 1 + 16)) | amount);
+    const __m256i limit = _mm256_set1_epi16(static_cast<short>(threshold));
+    int i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i lo = sharpen16AVX2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i))),
+                                   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(blurred + i))),
+                                   amountRound, limit);
+        __m256i hi = sharpen16AVX2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i + 16))),
+                                   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(blurred + i + 16))),
+                                   amountRound, limit);
+        // packus works within 128-bit lanes, so the 64-bit quarters come out as lo, hi, lo, hi
+        __m256i packed = _mm256_packus_epi16(lo, hi);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Sharpen a row against its blurred copy using the best instruction set available.
+ */
+static void sharpenRow(const uchar *src, const uchar *blurred, uchar *dst, int width, int amount, int threshold)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = sharpenRowAVX2(src, blurred, dst, i, width, amount, threshold);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i = sharpenRowSSE41(src, blurred, dst, i, width, amount, threshold);
+    }
+#endif
+    sharpenRowScalar(src, blurred, dst, i, width, amount, threshold);
+}
+
+/**
+ * @brief Sharpen an image with an unsharp mask: add back the difference between it and its 5x5 Gaussian blur.
+ *
+ * The blur is the streaming pass of blur5x5_5. Each output row is blurred into a one-row buffer per band and
+ * sharpened against the source row straight away, so the blurred frame is never written. The amount is applied in
+ * fixed point with 8 fraction bits, rounded, and the result saturated, with the same bytes on the scalar, SSE4.1 and
+ * AVX2 paths. The rows are treated as flat bytes, so grey images take the same vectorized path as color ones.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param amount How much of the difference to add back, from 0 to 16. 1 doubles the detail.
+ * @param threshold The largest difference from the blur left unsharpened, from 0 to 255, so flat noisy areas stay
+ * flat.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int unsharpMask(cv::Mat &src, cv::Mat &dst, double amount, int threshold, FilterContext *ctx)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != CV_8U)
+    {
+        printf("Expected an 8-bit image\n");
+        return -1;
+    }
+
+    if (!(amount >= 0 && amount <= UNSHARP_MAX_AMOUNT))
+    {
+        printf("Expected an amount from 0 to %d\n", UNSHARP_MAX_AMOUNT);
+        return -1;
+    }
+
+    if (threshold < 0 || threshold > 255)
+    {
+        printf("Expected a threshold from 0 to 255\n");
+        return -1;
+    }
+
+    int width = src.cols * src.channels(); // row length in bytes
+    int fixedAmount = cvRound(amount * (1 << UNSHARP_AMOUNT_BITS));
+
+    // blur5Stream splits the rows into the same bands, so each band blurs into its own row
+    int bands = rowBandCount(src.rows);
+    cv::Mat local;
+    cv::Mat &blurredRows = scratchImage(ctx, FilterContext::SCRATCH_BANDS, bands, width, CV_8U, local);
+    blur5Stream(src, dst, cv::BORDER_REFLECT_101, ctx, [&](const ushort *const window[5], int y) {
+        uchar *blurred = blurredRows.ptr<uchar>(rowBandIndex(0, src.rows, bands, y));
+        blurCol5(window, blurred, 0, width);
+        sharpenRow(src.ptr<uchar>(y), blurred, dst.ptr<uchar>(y), width, fixedAmount, threshold);
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply an emboss effect to an image.
+ *
+ * This function applies an emboss effect to an image. It does so by applying a 3x3 Sobel filter to the image and
+ * adding 128 to the result. It then clamps the result to the range [0, 255]. The output has the
+ * channel count of the gradients.
+ *
+ * @param sx The source image with a sobel x filter applied.
+ * @param sy The source image with a sobel y filter applied.
+ * @param dst The destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int embossEffect(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst)
+{
+    if (sx.empty() || sy.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (sx.depth() != CV_16S || sx.type() != sy.type() || sx.size() != sy.size())
+    {
+        printf("Expected two signed short images of the same size\n");
+        return -1;
+    }
+
+    dst.create(sx.size(), CV_8UC(sx.channels())); // Create dst with unsigned char type
+
+    int width = sx.cols * sx.channels(); // row length in values
+    parallelRows(0, dst.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const short *ptrSx = sx.ptr<short>(y);
+            const short *ptrSy = sy.ptr<short>(y);
+            uchar *ptrDst = dst.ptr<uchar>(y);
+
+            for (int i = 0; i < width; i++)
+            {
+                ptrDst[i] = embossValue(ptrSx[i], ptrSy[i]);
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply an emboss effect to an image.
+ *
+ * This function applies the same emboss effect as embossEffect(sx, sy, dst), but computes the Sobel gradients of each
+ * pixel on the fly instead of reading them from two signed short images. Border pixels are set to mid grey.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int embossEffect(cv::Mat &src, cv::Mat &dst, FilterContext *ctx)
+{
+    return sobelPointFilter<uchar>(src, dst, EMBOSS_OFFSET, sobelPointRow<embossValue>, ctx);
+}
+
+/**
+ * @brief Adjust the brightness of an image.
+ *
+ * This function adjusts the brightness of an image. It does so by multiplying each pixel by a specified value.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param brightness The brightness value to multiply each pixel by.
+ * @return 0 if successful, -1 if error.
+ */
+int adjustBrightness(cv::Mat &src, cv::Mat &dst, double brightness)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    return PointOp::brightness(brightness).apply(src, dst);
+}
+
+/**
+ * @brief Create a negative of an image
+ *
+ * This function creates a negative of an image. It does so by subtracting each pixel from 255.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int negativeFilter(cv::Mat &src, cv::Mat &dst)
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    return PointOp::negative().apply(src, dst);
+}
+
+/**
+ * @brief Create the identity operation.
+ */
+PointOp::PointOp()
+{
+    for (int v = 0; v < 256; v++)
+    {
+        table[v] = static_cast<uchar>(v);
+    }
+}
+
+/**
+ * @brief Create an operation that subtracts each value from 255.
+ *
+ * @return The negative operation.
+ */
+PointOp PointOp::negative()
+{
+    PointOp op;
+    for (int v = 0; v < 256; v++)
+    {
+        op.table[v] = static_cast<uchar>(255 - v);
+    }
+    return op;
+}
+
+/**
+ * @brief Create an operation that multiplies each value by a factor and clamps it to [0, 255].
+ *
+ * @param brightness The factor to multiply each value by.
+ * @return The brightness operation.
+ */
+PointOp PointOp::brightness(double brightness)
+{
+    PointOp op;
+    for (int v = 0; v < 256; v++)
+    {
+        op.table[v] = static_cast<uchar>(std::min(std::max(v * brightness, 0.0), 255.0));
+    }
+    return op;
+}
+
+/**
+ * @brief Create an operation that quantizes each value to a number of levels.
+ *
+ * Values are divided into buckets of size 255 / levels and each value is set to the bottom of its bucket.
+ *
+ * @param levels The number of levels, at least 1.
+ * @return The quantize operation.
+ */
+PointOp PointOp::quantize(int levels)
+{
+    PointOp op;
+    float buckets = 255.0 / std::max(levels, 1);
+    for (int v = 0; v < 256; v++)
+    {
+        int quantized = static_cast<int>(v / buckets);
+        op.table[v] = static_cast<uchar>(quantized * buckets);
+    }
+    return op;
+}
+
+/**
+ * @brief Compose this operation with another one.
+ *
+ * @param next The operation to apply after this one.
+ * @return A single operation equivalent to applying this one and then next.
+ */
+PointOp PointOp::then(const PointOp &next) const
+{
+    PointOp op;
+    for (int v = 0; v < 256; v++)
+    {
+        op.table[v] = next.table[table[v]];
+    }
+    return op;
+}
+
+/**
+ * @brief Check whether the operation leaves every value unchanged.
+ *
+ * @return true if the table is the identity.
+ */
+bool PointOp::isIdentity() const
+{
+    for (int v = 0; v < 256; v++)
+    {
+        if (table[v] != v)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Apply the operation to every channel of an 8-bit image.
+ *
+ * The image is treated as flat rows of bytes, so the number of channels does not matter. Each byte costs a single
+ * table load, which keeps the pass memory-bound; the time saved comes from composing chains into one table.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @return 0 if successful, -1 if error.
+ */
+int PointOp::apply(cv::Mat &src, cv::Mat &dst) const
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != CV_8U)
+    {
+        printf("Expected an 8-bit image\n");
+        return -1;
+    }
+
+    int width = src.cols * src.channels(); // row length in bytes
+
+    dst.create(src.size(), src.type());
+
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const uchar *ptr = src.ptr<uchar>(y);
+            uchar *ptrDst = dst.ptr<uchar>(y);
+            for (int i = 0; i < width; i++)
+            {
+                ptrDst[i] = table[ptr[i]];
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply the operation to every plane of an 8-bit planar image.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @return 0 if successful, -1 if error.
+ */
+int PointOp::apply(PlanarImage &src, PlanarImage &dst) const
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    dst.create(src.size().height, src.size().width, src.channels(), src.plane(0).type());
+    for (int c = 0; c < src.channels(); c++)
+    {
+        if (apply(src.plane(c), dst.plane(c)) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Create the identity matrix.
+ */
+ColorMatrix::ColorMatrix()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            m[i][j] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+}
+
+/**
+ * @brief Create the sepia tone matrix used by sepiaTone.
+ *
+ * @return The sepia matrix.
+ */
+ColorMatrix ColorMatrix::sepia()
+{
+    // 0.189, 0.168, 0.131  Blue coefficients
+    // 0.769, 0.686, 0.534, Green coefficients
+    // 0.393, 0.349, 0.272, Red coefficients
+    ColorMatrix cm;
+    const float coeffs[3][3] = {{0.131f, 0.534f, 0.272f}, {0.168f, 0.686f, 0.349f}, {0.189f, 0.769f, 0.393f}};
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            cm.m[i][j] = coeffs[i][j];
+        }
+    }
+    return cm;
+}
+
+/**
+ * @brief Create a matrix that sets every channel to the luminance of the pixel.
+ *
+ * @return The luminance greyscale matrix.
+ */
+ColorMatrix ColorMatrix::luminance()
+{
+    ColorMatrix cm;
+    for (int i = 0; i < 3; i++)
+    {
+        cm.m[i][0] = 0.114f;
+        cm.m[i][1] = 0.587f;
+        cm.m[i][2] = 0.299f;
+    }
+    return cm;
+}
+
+/**
+ * @brief Create a matrix that reorders the channels.
+ *
+ * @param blue The source channel (0, 1 or 2) copied to the blue channel.
+ * @param green The source channel copied to the green channel.
+ * @param red The source channel copied to the red channel.
+ * @return The channel swap matrix.
+ */
+ColorMatrix ColorMatrix::channelSwap(int blue, int green, int red)
+{
+    ColorMatrix cm;
+    const int from[3] = {blue, green, red};
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            cm.m[i][j] = (from[i] == j) ? 1.0f : 0.0f;
+        }
+    }
+    return cm;
+}
+
+/**
+ * @brief Create a matrix that multiplies every channel by a factor.
+ *
+ * @param brightness The factor to multiply each channel by.
+ * @return The brightness matrix.
+ */
+ColorMatrix ColorMatrix::brightness(double brightness)
+{
+    ColorMatrix cm;
+    for (int i = 0; i < 3; i++)
+    {
+        cm.m[i][i] = static_cast<float>(brightness);
+    }
+    return cm;
+}
+
+/**
+ * @brief Compose this matrix with another one.
+ *
+ * @param next The matrix to apply after this one.
+ * @return A single matrix equivalent to applying this one and then next.
+ */
+ColorMatrix ColorMatrix::then(const ColorMatrix &next) const
+{
+    ColorMatrix cm;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            float sum = (j == 3) ? next.m[i][3] : 0.0f;
+            for (int k = 0; k < 3; k++)
+            {
+                sum += next.m[i][k] * m[k][j];
+            }
+            cm.m[i][j] = sum;
+        }
+    }
+    return cm;
+}
+
+/**
+ * @brief A ColorMatrix converted to the fixed-point form used by the row kernels.
+ *
+ * Coefficients are stored as signed shorts scaled by 2^shift, with shift chosen as large as possible (up to 14) so the
+ * largest coefficient still fits. Offsets are scaled the same way and include the rounding constant.
+ */
+struct FixedColorMatrix
+{
+    short coeff[3][3];
+    int offset[3];
+    int shift;
+};
+
+/**
+ * @brief Convert a color matrix to fixed point.
+ *
+ * @param cm The color matrix.
+ * @return The fixed-point matrix.
+ */
+static FixedColorMatrix toFixedColorMatrix(const ColorMatrix &cm)
+{
+    float maxCoeff = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            maxCoeff = std::max(maxCoeff, std::abs(cm.m[i][j]));
+        }
+    }
+
+    FixedColorMatrix fm;
+    fm.shift = 14;
+    while (fm.shift > 1 && maxCoeff * (1 << fm.shift) > 32767.0f)
+    {
+        fm.shift--;
+    }
+
+    float scale = static_cast<float>(1 << fm.shift);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            fm.coeff[i][j] = cv::saturate_cast<short>(cm.m[i][j] * scale);
+        }
+        float offset = std::min(std::max(cm.m[i][3], -65536.0f), 65536.0f);
+        fm.offset[i] = cvRound(offset * scale) + (1 << (fm.shift - 1));
+    }
+    return fm;
+}
+
+/**
+ * @brief Apply a fixed-point color matrix to pixels [begin, end) of an interleaved BGR row.
+ *
+ * @param src The source row.
+ * @param dst The destination row.
+ * @param begin The first pixel to write.
+ * @param end One past the last pixel to write.
+ * @param fm The fixed-point matrix.
+ */
+static void colorMatrixRowScalar(const uchar *src, uchar *dst, int begin, int end, const FixedColorMatrix &fm)
+{
+    for (int x = begin; x < end; x++)
+    {
+        const uchar *pixel = src + 3 * x;
+        int blue = pixel[0], green = pixel[1], red = pixel[2];
+        int out[3];
+        for (int i = 0; i < 3; i++)
+        {
+            int sum = fm.coeff[i][0] * blue + fm.coeff[i][1] * green + fm.coeff[i][2] * red + fm.offset[i];
+            out[i] = std::min(std::max(sum >> fm.shift, 0), 255);
+        }
+        dst[3 * x] = static_cast<uchar>(out[0]);
+        dst[3 * x + 1] = static_cast<uchar>(out[1]);
+        dst[3 * x + 2] = static_cast<uchar>(out[2]);
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief Apply a fixed-point color matrix to 4 pixels held in the low 12 bytes of a vector, using SSE4.1.
+ *
+ * The pixels are split into (blue, green) and (red, 0) pairs of 16-bit values so that _mm_madd_epi16 computes each
+ * output channel as two 32-bit multiply-adds. The results are narrowed with saturating packs and re-interleaved.
+ * The blueGreen, red and offset arrays hold the per-channel constants prepared by the caller.
+ *
+ * @return The 4 output pixels in the low 12 bytes.
+ */
+SIMD_TARGET_SSE41 static inline __m128i colorMatrix4SSE41(__m128i v, const __m128i blueGreen[3],
+                                                          const __m128i red[3], const __m128i offset[3], __m128i shift)
+{
+    const __m128i bgMask = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+    const __m128i rMask = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m128i interleave = _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+
+    __m128i bg = _mm_shuffle_epi8(v, bgMask);
+    __m128i r = _mm_shuffle_epi8(v, rMask);
+
+    __m128i out[3];
+    for (int i = 0; i < 3; i++)
+    {
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(bg, blueGreen[i]), _mm_madd_epi16(r, red[i]));
+        out[i] = _mm_sra_epi32(_mm_add_epi32(sum, offset[i]), shift);
+    }
+
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]), _mm_packs_epi32(out[2], out[2]));
+    return _mm_shuffle_epi8(packed, interleave);
+}
+
+/**
+ * @brief Store the low 12 bytes of a vector (4 BGR pixels).
+ */
+SIMD_TARGET_SSE41 static inline void storePixels4(uchar *dst, __m128i v)
+{
+    _mm_storel_epi64((__m128i *)dst, v);
+    int last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(dst + 8, &last, sizeof(last));
+}
+
+/**
+ * @brief Build the per-channel multiply-add constants for colorMatrix4SSE41.
+ */
+SIMD_TARGET_SSE41 static void colorMatrixConstantsSSE41(const FixedColorMatrix &fm, __m128i blueGreen[3],
+                                                        __m128i red[3], __m128i offset[3])
+{
+    for (int i = 0; i < 3; i++)
+    {
+        blueGreen[i] = _mm_set1_epi32((int)((unsigned)(ushort)fm.coeff[i][1] << 16 | (ushort)fm.coeff[i][0]));
+        red[i] = _mm_set1_epi32((ushort)fm.coeff[i][2]);
+        offset[i] = _mm_set1_epi32(fm.offset[i]);
+    }
+}
+
+/**
+ * @brief SSE4.1 version of colorMatrixRowScalar. Processes 4 pixels per iteration.
+ *
+ * Each iteration loads 16 bytes but only uses and writes 12, so the loop stops while a full load still fits in the row.
+ *
+ * @return The first pixel that was not written.
+ */
+SIMD_TARGET_SSE41 static int colorMatrixRowSSE41(const uchar *src, uchar *dst, int begin, int end,
+                                                 const FixedColorMatrix &fm)
+{
+    __m128i blueGreen[3], red[3], offset[3];
+    colorMatrixConstantsSSE41(fm, blueGreen, red, offset);
+    const __m128i shift = _mm_cvtsi32_si128(fm.shift);
+
+    int x = begin;
+    for (; 3 * x + 16 <= 3 * end; x += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+        storePixels4(dst + 3 * x, colorMatrix4SSE41(v, blueGreen, red, offset, shift));
+    }
+    return x;
+}
+
+/**
+ * @brief AVX2 version of colorMatrixRowScalar. Processes 8 pixels per iteration, 4 in each 128-bit lane.
+ *
+ * @return The first pixel that was not written.
+ */
+SIMD_TARGET_AVX2 static int colorMatrixRowAVX2(const uchar *src, uchar *dst, int begin, int end,
+                                               const FixedColorMatrix &fm)
+{
+    const __m256i bgMask = _mm256_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1, 0, -1, 1, -1, 3,
+                                            -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+    const __m256i rMask = _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1, 2, -1, -1, -1,
+                                           5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m256i interleave = _mm256_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1, 0, 4, 8, 1, 5, 9,
+                                                2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+    const __m128i shift = _mm_cvtsi32_si128(fm.shift);
+
+    __m256i blueGreen[3], red[3], offset[3];
+    for (int i = 0; i < 3; i++)
+    {
+        blueGreen[i] = _mm256_set1_epi32((int)((unsigned)(ushort)fm.coeff[i][1] << 16 | (ushort)fm.coeff[i][0]));
+        red[i] = _mm256_set1_epi32((ushort)fm.coeff[i][2]);
+        offset[i] = _mm256_set1_epi32(fm.offset[i]);
+    }
+
+    int x = begin;
+    for (; 3 * x + 28 <= 3 * end; x += 8)
+    {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + 3 * x))),
+                                            _mm_loadu_si128((const __m128i *)(src + 3 * x + 12)), 1);
+        __m256i bg = _mm256_shuffle_epi8(v, bgMask);
+        __m256i r = _mm256_shuffle_epi8(v, rMask);
+
+        __m256i out[3];
+        for (int i = 0; i < 3; i++)
+        {
+            __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(bg, blueGreen[i]), _mm256_madd_epi16(r, red[i]));
+            out[i] = _mm256_sra_epi32(_mm256_add_epi32(sum, offset[i]), shift);
+        }
+
+        __m256i packed =
+            _mm256_packus_epi16(_mm256_packs_epi32(out[0], out[1]), _mm256_packs_epi32(out[2], out[2]));
+        packed = _mm256_shuffle_epi8(packed, interleave);
+        storePixels4(dst + 3 * x, _mm256_castsi256_si128(packed));
+        storePixels4(dst + 3 * x + 12, _mm256_extracti128_si256(packed, 1));
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Apply a fixed-point color matrix to a BGR row using the best instruction set available.
+ */
+static void colorMatrixRow(const uchar *src, uchar *dst, int cols, const FixedColorMatrix &fm)
+{
+    int x = 0;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        x = colorMatrixRowAVX2(src, dst, x, cols, fm);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        x = colorMatrixRowSSE41(src, dst, x, cols, fm);
+    }
+#endif
+    colorMatrixRowScalar(src, dst, x, cols, fm);
+}
+
+/**
+ * @brief Tabulate a fixed-point color matrix over grey pixels.
+ *
+ * A grey pixel has equal blue, green and red, so each output channel depends on the one input byte. The table is built
+ * with the same fixed-point arithmetic as the color kernels, so a grey image gives the same values as its 3-channel
+ * copy.
+ *
+ * @param fm The fixed-point matrix.
+ * @param table The blue, green and red output for each grey value.
+ */
+static void greyColorTable(const FixedColorMatrix &fm, uchar table[256][3])
+{
+    for (int v = 0; v < 256; v++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            int sum = (fm.coeff[i][0] + fm.coeff[i][1] + fm.coeff[i][2]) * v + fm.offset[i];
+            table[v][i] = static_cast<uchar>(std::min(std::max(sum >> fm.shift, 0), 255));
+        }
+    }
+}
+
+/**
+ * @brief Apply a fixed-point color matrix to a grey image, producing a color image.
+ *
+ * @param src The grey source image.
+ * @param dst The color destination image. May be the same as src.
+ * @param fm The fixed-point matrix.
+ * @return 0 if successful.
+ */
+static int applyGreyColorMatrix(cv::Mat &src, cv::Mat &dst, const FixedColorMatrix &fm)
+{
+    uchar table[256][3];
+    greyColorTable(fm, table);
+
+    cv::Mat input = src; // keep the grey pixels if dst is src
+    dst.create(input.size(), CV_8UC3);
+
+    parallelRows(0, input.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const uchar *ptr = input.ptr<uchar>(y);
+            uchar *ptrDst = dst.ptr<uchar>(y);
+            for (int x = 0; x < input.cols; x++)
+            {
+                const uchar *color = table[ptr[x]];
+                ptrDst[3 * x] = color[0];
+                ptrDst[3 * x + 1] = color[1];
+                ptrDst[3 * x + 2] = color[2];
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply a color matrix to a 16-bit or float image with pixels of type T.
+ *
+ * The matrix is applied in PixelTraits<T>::Real rather than in fixed point, so 16-bit values keep their precision.
+ * Offsets are given in 8-bit units and are scaled to the depth by PixelTraits<T>::unit(). A single-channel image is
+ * treated as grey and gives a 3-channel image.
+ *
+ * @param cm The color matrix.
+ * @param src The source image, with 1 or 3 channels.
+ * @param dst The 3-channel destination image. May be the same as src.
+ * @return 0 if successful.
+ */
+template <typename T> static int applyColorMatrixWide(const ColorMatrix &cm, cv::Mat &src, cv::Mat &dst)
+{
+    typedef typename PixelTraits<T>::Real Real;
+
+    Real coeff[3][3], offset[3];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            coeff[i][j] = static_cast<Real>(cm.m[i][j]);
+        }
+        offset[i] = static_cast<Real>(cm.m[i][3]) * PixelTraits<T>::unit();
+    }
+
+    cv::Mat input = src; // keep the source pixels if dst is src and changes shape
+    int cn = input.channels();
+    int green = cn == 3 ? 1 : 0; // offsets of the green and red values in a pixel
+    int red = cn == 3 ? 2 : 0;
+    dst.create(input.size(), CV_MAKETYPE(PixelTraits<T>::DEPTH, 3));
+
+    parallelRows(0, input.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const T *ptr = input.ptr<T>(y);
+            T *ptrDst = dst.ptr<T>(y);
+            for (int x = 0; x < input.cols; x++)
+            {
+                const T *pixel = ptr + cn * x;
+                Real b = pixel[0], g = pixel[green], r = pixel[red];
+                T out[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    out[i] = cv::saturate_cast<T>(coeff[i][0] * b + coeff[i][1] * g + coeff[i][2] * r + offset[i]);
+                }
+                ptrDst[3 * x] = out[0];
+                ptrDst[3 * x + 1] = out[1];
+                ptrDst[3 * x + 2] = out[2];
+            }
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply the matrix to an 8-bit, 16-bit or float 3-channel image.
+ *
+ * A single-channel image is treated as grey, with equal blue, green and red, and gives a 3-channel image. 8-bit images
+ * run the fixed-point kernels; 16-bit and float images are computed in double and single precision, with the offsets
+ * scaled from 8-bit units to the range of the depth (0 to 65535, or 0 to 1 for float).
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @return 0 if successful, -1 if error.
+ */
+int ColorMatrix::apply(cv::Mat &src, cv::Mat &dst) const
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.channels() != 3 && src.channels() != 1)
+    {
+        printf("Expected a grey or color image\n");
+        return -1;
+    }
+
+    if (src.depth() == CV_16U)
+    {
+        return applyColorMatrixWide<ushort>(*this, src, dst);
+    }
+    if (src.depth() == CV_32F)
+    {
+        return applyColorMatrixWide<float>(*this, src, dst);
+    }
+    if (src.depth() != CV_8U)
+    {
+        printf("Expected an 8-bit, 16-bit or float image\n");
+        return -1;
+    }
+
+    FixedColorMatrix fm = toFixedColorMatrix(*this);
+
+    if (src.channels() == 1)
+    {
+        return applyGreyColorMatrix(src, dst, fm);
+    }
+
+    dst.create(src.size(), src.type());
+
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            colorMatrixRow(src.ptr<uchar>(y), dst.ptr<uchar>(y), src.cols, fm);
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Apply a fixed-point color matrix to part of a row of B, G and R planes, one pixel at a time.
+ *
+ * @param src The source rows, one per plane.
+ * @param dst The destination rows, one per plane. May be the same as src.
+ * @param begin The first pixel to write.
+ * @param end One past the last pixel to write.
+ * @param fm The fixed-point matrix.
+ */
+static void colorMatrixPlanarRowScalar(const uchar *const src[3], uchar *const dst[3], int begin, int end,
+                                       const FixedColorMatrix &fm)
+{
+    for (int x = begin; x < end; x++)
+    {
+        int blue = src[0][x], green = src[1][x], red = src[2][x];
+        for (int i = 0; i < 3; i++)
+        {
+            int sum = fm.coeff[i][0] * blue + fm.coeff[i][1] * green + fm.coeff[i][2] * red + fm.offset[i];
+            dst[i][x] = static_cast<uchar>(std::min(std::max(sum >> fm.shift, 0), 255));
+        }
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief SSE4.1 version of colorMatrixPlanarRowScalar. Processes 8 pixels per iteration.
+ *
+ * The planes are widened to 16 bits and blue and green are interleaved into pairs, so _mm_madd_epi16 computes each
+ * output as in the interleaved kernel, but without the shuffles that pick the channels apart.
+ *
+ * @return The first pixel that was not written.
+ */
+SIMD_TARGET_SSE41 static int colorMatrixPlanarRowSSE41(const uchar *const src[3], uchar *const dst[3], int begin,
+                                                       int end, const FixedColorMatrix &fm)
+{
+    __m128i blueGreen[3], red[3], offset[3];
+    colorMatrixConstantsSSE41(fm, blueGreen, red, offset);
+    const __m128i shift = _mm_cvtsi32_si128(fm.shift);
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(src[0] + x)));
+        __m128i g = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(src[1] + x)));
+        __m128i r = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(src[2] + x)));
+        __m128i bgLo = _mm_unpacklo_epi16(b, g), bgHi = _mm_unpackhi_epi16(b, g);
+        __m128i rLo = _mm_unpacklo_epi16(r, zero), rHi = _mm_unpackhi_epi16(r, zero);
+
+        for (int i = 0; i < 3; i++)
+        {
+            __m128i lo = _mm_add_epi32(_mm_madd_epi16(bgLo, blueGreen[i]), _mm_madd_epi16(rLo, red[i]));
+            __m128i hi = _mm_add_epi32(_mm_madd_epi16(bgHi, blueGreen[i]), _mm_madd_epi16(rHi, red[i]));
+            lo = _mm_sra_epi32(_mm_add_epi32(lo, offset[i]), shift);
+            hi = _mm_sra_epi32(_mm_add_epi32(hi, offset[i]), shift);
+            __m128i out = _mm_packs_epi32(lo, hi);
+            _mm_storel_epi64((__m128i *)(dst[i] + x), _mm_packus_epi16(out, out));
+        }
+    }
+    return x;
+}
+
+/**
+ * @brief AVX2 version of colorMatrixPlanarRowScalar. Processes 16 pixels per iteration.
+ *
+ * @return The first pixel that was not written.
+ */
+SIMD_TARGET_AVX2 static int colorMatrixPlanarRowAVX2(const uchar *const src[3], uchar *const dst[3], int begin,
+                                                     int end, const FixedColorMatrix &fm)
+{
+    const __m128i shift = _mm_cvtsi32_si128(fm.shift);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i blueGreen[3], red[3], offset[3];
+    for (int i = 0; i < 3; i++)
+    {
+        blueGreen[i] = _mm256_set1_epi32((int)((unsigned)(ushort)fm.coeff[i][1] << 16 | (ushort)fm.coeff[i][0]));
+        red[i] = _mm256_set1_epi32((ushort)fm.coeff[i][2]);
+        offset[i] = _mm256_set1_epi32(fm.offset[i]);
+    }
+
+    int x = begin;
+    for (; x + 16 <= end; x += 16)
+    {
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src[0] + x)));
+        __m256i g = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src[1] + x)));
+        __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src[2] + x)));
+
+        // The unpacks work within 128-bit lanes: lo holds pixels 0-3 and 8-11, hi holds 4-7 and 12-15
+        __m256i bgLo = _mm256_unpacklo_epi16(b, g), bgHi = _mm256_unpackhi_epi16(b, g);
+        __m256i rLo = _mm256_unpacklo_epi16(r, zero), rHi = _mm256_unpackhi_epi16(r, zero);
+
+        for (int i = 0; i < 3; i++)
+        {
+            __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(bgLo, blueGreen[i]), _mm256_madd_epi16(rLo, red[i]));
+            __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(bgHi, blueGreen[i]), _mm256_madd_epi16(rHi, red[i]));
+            lo = _mm256_sra_epi32(_mm256_add_epi32(lo, offset[i]), shift);
+            hi = _mm256_sra_epi32(_mm256_add_epi32(hi, offset[i]), shift);
+            __m256i out = _mm256_packs_epi32(lo, hi); // back in pixel order within each lane
+            out = _mm256_permute4x64_epi64(_mm256_packus_epi16(out, out), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(dst[i] + x), _mm256_castsi256_si128(out));
+        }
+    }
+    return x;
+}
+#endif
+
+/**
+ * @brief Apply the matrix to an 8-bit planar image with B, G and R planes.
+ *
+ * Each output plane is a multiply-add of whole input planes, so no shuffling is needed to separate the channels.
+ * Gives the same values as the interleaved apply. A single grey plane gives B, G and R planes.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @return 0 if successful, -1 if error.
+ */
+int ColorMatrix::apply(PlanarImage &src, PlanarImage &dst) const
+{
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if ((src.channels() != 3 && src.channels() != 1) || src.plane(0).type() != CV_8UC1)
+    {
+        printf("Expected an 8-bit grey or color image\n");
+        return -1;
+    }
+
+    FixedColorMatrix fm = toFixedColorMatrix(*this);
+
+    if (src.channels() == 1)
+    {
+        // Each grey value maps to one entry per output plane
+        uchar table[256][3];
+        greyColorTable(fm, table);
+
+        cv::Mat input = src.plane(0); // keep the grey plane if dst is src
+        dst.create(input.rows, input.cols, 3);
+
+        parallelRows(0, input.rows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; y++)
+            {
+                const uchar *ptr = input.ptr<uchar>(y);
+                uchar *ptrBlue = dst.plane(0).ptr<uchar>(y);
+                uchar *ptrGreen = dst.plane(1).ptr<uchar>(y);
+                uchar *ptrRed = dst.plane(2).ptr<uchar>(y);
+                for (int x = 0; x < input.cols; x++)
+                {
+                    const uchar *color = table[ptr[x]];
+                    ptrBlue[x] = color[0];
+                    ptrGreen[x] = color[1];
+                    ptrRed[x] = color[2];
+                }
+            }
+        });
+
+        return 0;
+    }
+
+    dst.create(src.size().height, src.size().width, 3);
+
+    parallelRows(0, src.size().height, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            const uchar *ptrSrc[3] = {src.plane(0).ptr<uchar>(y), src.plane(1).ptr<uchar>(y),
+                                      src.plane(2).ptr<uchar>(y)};
+            uchar *const ptrDst[3] = {dst.plane(0).ptr<uchar>(y), dst.plane(1).ptr<uchar>(y),
+                                      dst.plane(2).ptr<uchar>(y)};
+
+            int x = 0;
+#ifdef SIMD_X86
+            SimdLevel level = simdLevel();
+            if (level >= SIMD_AVX2)
+            {
+                x = colorMatrixPlanarRowAVX2(ptrSrc, ptrDst, x, src.size().width, fm);
+            }
+            if (level >= SIMD_SSE41)
+            {
+                x = colorMatrixPlanarRowSSE41(ptrSrc, ptrDst, x, src.size().width, fm);
+            }
+#endif
+            colorMatrixPlanarRowScalar(ptrSrc, ptrDst, x, src.size().width, fm);
+        }
+    });
+
+    return 0;
+}
+
+/**
+ * @brief Create an empty context. Buffers are allocated on first use.
+ */
+FilterContext::FilterContext() : allocationCount(0)
+{
+    outputData[0] = NULL;
+    outputData[1] = NULL;
+}
+
+/**
+ * @brief Get a scratch image, allocating only when the slot has never held that many bytes.
+ *
+ * @param slot The scratch slot. Images in different slots never share memory.
+ * @param rows The number of rows.
+ * @param cols The number of columns.
+ * @param type The OpenCV type.
+ * @return The scratch image. Its contents are left over from the last use of the slot, and it stays valid until the
+ * slot is requested again. Requests for other slots do not move it.
+ */
+cv::Mat &FilterContext::scratch(int slot, int rows, int cols, int type)
+{
+    if (slot >= (int)scratchImages.size())
+    {
+        scratchImages.resize(slot + 1);
+        scratchStorage.resize(slot + 1);
+    }
+
+    // Kernels ask for different shapes in the same slot, so keep one byte buffer that only grows and view it with the
+    // requested shape
+    cv::Mat &image = scratchImages[slot];
+    if (image.rows != rows || image.cols != cols || image.type() != type)
+    {
+        cv::Mat &storage = scratchStorage[slot];
+        size_t rowBytes = (size_t)cols * CV_ELEM_SIZE(type);
+        if (storage.total() < rows * rowBytes)
+        {
+            // Shaped like the request rather than as one row, so buffers of 2 GB and more keep an int width
+            storage.create(rows, (int)rowBytes, CV_8UC1);
+            allocationCount++;
+        }
+        image = cv::Mat(rows, cols, type, storage.data);
+    }
+    return image;
+}
+
+/**
+ * @brief Get a buffer to write the next pipeline stage into.
+ *
+ * @param frame The image the next stage reads.
+ * @return Whichever of the two output buffers does not share memory with frame.
+ */
+cv::Mat &FilterContext::output(const cv::Mat &frame)
+{
+    countOutputAllocations();
+    return (!outputs[0].empty() && outputs[0].data == frame.data) ? outputs[1] : outputs[0];
+}
+
+/**
+ * @brief Get the number of times a buffer of this context has been allocated or reallocated.
+ *
+ * @return The allocation count.
+ */
+int FilterContext::allocations() const
+{
+    countOutputAllocations();
+    return allocationCount;
+}
+
+/**
+ * @brief Count output buffers that a filter reallocated since they were last checked.
+ *
+ * The filters allocate their outputs with create(), so a changed data pointer is the only sign of a new allocation.
+ */
+void FilterContext::countOutputAllocations() const
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (outputs[i].data != outputData[i])
+        {
+            outputData[i] = outputs[i].data;
+            allocationCount++;
+        }
+    }
+}
+
+/**
+ * @brief Create an empty image.
+ */
+PlanarImage::PlanarImage() : planeCount(0)
+{
+}
+
+/**
+ * @brief Allocate the planes, only reallocating a plane when its size or type changes.
+ *
+ * @param rows The number of rows.
+ * @param cols The number of columns.
+ * @param planes The number of planes, from 1 to MAX_PLANES.
+ * @param type The single-channel OpenCV type of each plane.
+ */
+void PlanarImage::create(int rows, int cols, int planes, int type)
+{
+    planeCount = std::min(std::max(planes, 0), static_cast<int>(MAX_PLANES));
+    for (int c = 0; c < planeCount; c++)
+    {
+        this->planes[c].create(rows, cols, type);
+    }
+}
+
+/**
+ * @brief Get one plane.
+ *
+ * @param index The plane, from 0 to channels() - 1.
+ * @return The plane.
+ */
+cv::Mat &PlanarImage::plane(int index)
+{
+    return planes[index];
+}
+
+/**
+ * @brief Get the number of planes.
+ *
+ * @return The number of planes, 0 for an empty image.
+ */
+int PlanarImage::channels() const
+{
+    return planeCount;
+}
+
+/**
+ * @brief Get the image size.
+ *
+ * @return The size of each plane.
+ */
+cv::Size PlanarImage::size() const
+{
+    return planeCount > 0 ? planes[0].size() : cv::Size();
+}
 
-            // Set pixel to average of kernel
-            temp.ptr<cv::Vec3b>(y)[x] = cv::Vec3b(blue / kernelSum, green / kernelSum, red / kernelSum);
-        }
-    }
+/**
+ * @brief Check whether the image has no planes.
+ *
+ * @return true if the image is empty.
+ */
+bool PlanarImage::empty() const
+{
+    return planeCount == 0 || planes[0].empty();
+}
 
-    // Vertical pass
-    for (int y = 2; y < src.rows - 2; ++y) // iterate through image rows
-    {
-        for (int x = 0; x < src.cols; ++x) // iterate through image columns
-        {
-            int blue = 0, green = 0, red = 0; // initialize color channel values
+#ifdef SIMD_X86
+/**
+ * @brief Split 16 BGR pixels (48 bytes) into 16 bytes of each channel, using SSE4.1.
+ *
+ * Each output gathers its channel from the three input vectors with one byte shuffle per vector.
+ */
+SIMD_TARGET_SSE41 static inline void deinterleave16SSE41(const uchar *src, uchar *blue, uchar *green, uchar *red)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
 
-            for (int k = -2; k <= 2; ++k) // iterate through kernel
-            {
-                cv::Vec3b pixel = temp.ptr<cv::Vec3b>(y + k)[x]; // get pixel at kernel index
-                int weight = kernel[k + 2];                      // get kernel weight
+    __m128i outBlue = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    __m128i outGreen = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    __m128i outRed = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
 
-                // Apply kernel to pixel
-                blue += pixel[0] * weight;
-                green += pixel[1] * weight;
-                red += pixel[2] * weight;
-            }
+    _mm_storeu_si128((__m128i *)blue, outBlue);
+    _mm_storeu_si128((__m128i *)green, outGreen);
+    _mm_storeu_si128((__m128i *)red, outRed);
+}
 
-            // Set pixel to average of kernel
-            dst.ptr<cv::Vec3b>(y)[x] = cv::Vec3b(blue / kernelSum, green / kernelSum, red / kernelSum);
-        }
-    }
+/**
+ * @brief Merge 16 bytes of each channel into 16 BGR pixels (48 bytes), using SSE4.1.
+ */
+SIMD_TARGET_SSE41 static inline void interleave16SSE41(const uchar *blue, const uchar *green, const uchar *red,
+                                                       uchar *dst)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)blue);
+    __m128i g = _mm_loadu_si128((const __m128i *)green);
+    __m128i r = _mm_loadu_si128((const __m128i *)red);
 
-    return 0;
+    __m128i outA = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(b, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+                     _mm_shuffle_epi8(g, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+    __m128i outB = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+                     _mm_shuffle_epi8(g, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+    __m128i outC = _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(b, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+            _mm_shuffle_epi8(g, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+        _mm_shuffle_epi8(r, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+
+    _mm_storeu_si128((__m128i *)dst, outA);
+    _mm_storeu_si128((__m128i *)(dst + 16), outB);
+    _mm_storeu_si128((__m128i *)(dst + 32), outC);
 }
+#endif
 
 /**
- * @brief Blur a color image using a 5x5 Gaussian kernel.
+ * @brief Split an interleaved 8-bit image into planes.
  *
- * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop. This version of the function
- * uses the .at method to access the pixels. It adds the values of each pixel in the kernel
- * without looping through it.
+ * Three-channel images are split 16 pixels at a time with byte shuffles when the CPU has SSE4.1.
  *
- * @param src The source image.
- * @param dst The destination image.
+ * @param src The interleaved source image, 1 to 4 channels.
+ * @param dst The planar destination image.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_3(cv::Mat &src, cv::Mat &dst)
+int deinterleave(cv::Mat &src, PlanarImage &dst)
 {
     if (src.empty())
     {
@@ -241,502 +5232,425 @@ int blur5x5_3(cv::Mat &src, cv::Mat &dst)
         return -1;
     }
 
-    // int kernel[5][5] = {// Gaussian kernel 5x5
-    //                     {1, 2, 4, 2, 1},
-    //                     {2, 4, 8, 4, 2},
-    //                     {4, 8, 16, 8, 4},
-    //                     {2, 4, 8, 4, 2},
-    //                     {1, 2, 4, 2, 1}};
-    // int kernelSum = 100; // sum of all kernel values
+    int cn = src.channels();
+    if (src.depth() != CV_8U || cn > PlanarImage::MAX_PLANES)
+    {
+        printf("Expected an 8-bit image with at most %d channels\n", PlanarImage::MAX_PLANES);
+        return -1;
+    }
 
-    dst = src.clone();
+    dst.create(src.rows, src.cols, cn);
 
-    for (int y = 2; y < src.rows - 2; y++)
-    {
-        // cv::Vec3b *ptr = src.ptr<cv::Vec3b>(y);
-        for (int x = 2; x < src.cols - 2; x++)
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
         {
-            for (int k = 0; k < src.channels(); k++)
+            const uchar *ptr = src.ptr<uchar>(y);
+            uchar *ptrPlanes[PlanarImage::MAX_PLANES];
+            for (int c = 0; c < cn; c++)
             {
-                int sum = src.at<cv::Vec3b>(y - 2, x - 2)[k] + 2 * src.at<cv::Vec3b>(y - 2, x - 1)[k] +
-                          4 * src.at<cv::Vec3b>(y - 2, x)[k] + 2 * src.at<cv::Vec3b>(y - 2, x + 1)[k] +
-                          src.at<cv::Vec3b>(y - 2, x + 2)[k] + 2 * src.at<cv::Vec3b>(y - 1, x - 2)[k] +
-                          4 * src.at<cv::Vec3b>(y - 1, x - 1)[k] + 8 * src.at<cv::Vec3b>(y - 1, x)[k] +
-                          4 * src.at<cv::Vec3b>(y - 1, x + 1)[k] + 2 * src.at<cv::Vec3b>(y - 1, x + 2)[k] +
-                          4 * src.at<cv::Vec3b>(y, x - 2)[k] + 8 * src.at<cv::Vec3b>(y, x - 1)[k] +
-                          16 * src.at<cv::Vec3b>(y, x)[k] + 8 * src.at<cv::Vec3b>(y, x + 1)[k] +
-                          4 * src.at<cv::Vec3b>(y, x + 2)[k] + 2 * src.at<cv::Vec3b>(y + 1, x - 2)[k] +
-                          4 * src.at<cv::Vec3b>(y + 1, x - 1)[k] + 8 * src.at<cv::Vec3b>(y + 1, x)[k] +
-                          4 * src.at<cv::Vec3b>(y + 1, x + 1)[k] + 2 * src.at<cv::Vec3b>(y + 1, x + 2)[k] +
-                          src.at<cv::Vec3b>(y + 2, x - 2)[k] + 2 * src.at<cv::Vec3b>(y + 2, x - 1)[k] +
-                          4 * src.at<cv::Vec3b>(y + 2, x)[k] + 2 * src.at<cv::Vec3b>(y + 2, x + 1)[k];
-
-                sum /= 100;
+                ptrPlanes[c] = dst.plane(c).ptr<uchar>(y);
+            }
 
-                dst.at<cv::Vec3b>(y, x)[k] = sum;
+            int x = 0;
+#ifdef SIMD_X86
+            if (cn == 3 && simdLevel() >= SIMD_SSE41)
+            {
+                for (; x + 16 <= src.cols; x += 16)
+                {
+                    deinterleave16SSE41(ptr + 3 * x, ptrPlanes[0] + x, ptrPlanes[1] + x, ptrPlanes[2] + x);
+                }
+            }
+#endif
+            for (; x < src.cols; x++)
+            {
+                for (int c = 0; c < cn; c++)
+                {
+                    ptrPlanes[c][x] = ptr[x * cn + c];
+                }
             }
         }
-    }
+    });
 
     return 0;
 }
 
 /**
- * @brief Blur a color image using a 5x5 Gaussian kernel.
+ * @brief Merge the planes of an 8-bit planar image into an interleaved image.
  *
- * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop. This version of the function uses the .ptr method to access
- * pixels. It also does not loop through the kernel, but instead calculates the sum of each row and column of the kernel
- * separately.
+ * Three-plane images are merged 16 pixels at a time with byte shuffles when the CPU has SSE4.1.
  *
- * @param src The source image.
- * @param dst The destination image.
+ * @param src The planar source image.
+ * @param dst The interleaved destination image.
  * @return 0 if successful, -1 if error.
- **/
-int blur5x5_4(cv::Mat &src, cv::Mat &dst)
+ */
+int interleave(PlanarImage &src, cv::Mat &dst)
 {
-    src.copyTo(dst);
-
-    // int kernel[5][5] = {// Gaussian kernel 5x5
-    //                     {1, 2, 4, 2, 1},
-    //                     {2, 4, 8, 4, 2},
-    //                     {4, 8, 16, 8, 4},
-    //                     {2, 4, 8, 4, 2},
-    //                     {1, 2, 4, 2, 1}};
-    // int kernelSum = 100; // sum of all kernel values
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
 
-    for (int y = 2; y < src.rows - 2; y++)
+    int cn = src.channels();
+    if (src.plane(0).type() != CV_8UC1)
     {
-        // This .ptr method is faster than .at method because it stores the row as reference.
-        cv::Vec3b *ptrTwoUp = src.ptr<cv::Vec3b>(y - 2);
-        cv::Vec3b *ptrOneUp = src.ptr<cv::Vec3b>(y - 1);
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(y);
-        cv::Vec3b *ptrOneDown = src.ptr<cv::Vec3b>(y + 1);
-        cv::Vec3b *ptrTwoDown = src.ptr<cv::Vec3b>(y + 2);
+        printf("Expected an 8-bit image\n");
+        return -1;
+    }
 
-        cv::Vec3b *ptrDst = dst.ptr<cv::Vec3b>(y);
+    dst.create(src.size(), CV_8UC(cn));
 
-        for (int x = 2; x < src.cols - 2; x++)
+    parallelRows(0, dst.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
         {
-
-            for (int k = 0; k < src.channels(); k++)
+            uchar *ptrDst = dst.ptr<uchar>(y);
+            const uchar *ptrPlanes[PlanarImage::MAX_PLANES];
+            for (int c = 0; c < cn; c++)
             {
-                // ptrmd[x][k] accesses the pixel at (x, y) and color channel k
-                int sumOne = ptrTwoUp[x - 2][k] + 2 * ptrTwoUp[x - 1][k] + 4 * ptrTwoUp[x][k] + 2 * ptrTwoUp[x + 1][k] +
-                             ptrTwoUp[x + 2][k];
-                int sumTwo = 2 * ptrOneUp[x - 2][k] + 4 * ptrOneUp[x - 1][k] + 8 * ptrOneUp[x][k] +
-                             4 * ptrOneUp[x + 1][k] + 2 * ptrOneUp[x + 2][k];
-                int sumThree =
-                    4 * ptr[x - 2][k] + 8 * ptr[x - 1][k] + 16 * ptr[x][k] + 8 * ptr[x + 1][k] + 4 * ptr[x + 2][k];
-                int sumFour = 2 * ptrOneDown[x - 2][k] + 4 * ptrOneDown[x - 1][k] + 8 * ptrOneDown[x][k] +
-                              4 * ptrOneDown[x + 1][k] + 2 * ptrOneDown[x + 2][k];
-                int sumFive = ptrTwoDown[x - 2][k] + 2 * ptrTwoDown[x - 1][k] + 4 * ptrTwoDown[x][k] +
-                              2 * ptrTwoDown[x + 1][k] + ptrTwoDown[x + 2][k];
-
-                int sum = sumOne + sumTwo + sumThree + sumFour + sumFive;
-
-                sum /= 100;
+                ptrPlanes[c] = src.plane(c).ptr<uchar>(y);
+            }
 
-                ptrDst[x][k] = sum; // assign result
+            int x = 0;
+#ifdef SIMD_X86
+            if (cn == 3 && simdLevel() >= SIMD_SSE41)
+            {
+                for (; x + 16 <= dst.cols; x += 16)
+                {
+                    interleave16SSE41(ptrPlanes[0] + x, ptrPlanes[1] + x, ptrPlanes[2] + x, ptrDst + 3 * x);
+                }
+            }
+#endif
+            for (; x < dst.cols; x++)
+            {
+                for (int c = 0; c < cn; c++)
+                {
+                    ptrDst[x * cn + c] = ptrPlanes[c][x];
+                }
             }
         }
-    }
+    });
 
     return 0;
 }
 
 /**
- * @brief Blur a color image using a 1x5 Gaussian kernel.
- *
- * This function blurs a color image using a 1x5 Gaussian kernel. It does so by
- * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal). This version of the function
- * uses the .ptr method to access pixels. It also does not loop through the kernel, but instead calculates the sum of
- * each row and column of the kernel separately.
+ * @brief Planar version of blur5x5_5. Blurs each plane as a single-channel image.
  *
  * @param src The source image.
- * @param dst The destination image.
+ * @param dst The destination image. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_5(cv::Mat &src, cv::Mat &dst)
+int blur5x5Planar(PlanarImage &src, PlanarImage &dst, int borderType, FilterContext *ctx)
 {
-    src.copyTo(dst);
-
-    int kernel[5] = {1, 2, 4, 2, 1};
-    int kernelSum = 10;
-
-    // Horizontal pass
-    for (int y = 0; y < src.rows; y++)
+    if (src.empty())
     {
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(y);
-        for (int x = 2; x < src.cols - 2; x++)
-        {
-            for (int k = 0; k < src.channels(); k++)
-            {
-                int sum = ptr[x - 2][k] + 2 * ptr[x - 1][k] + 4 * ptr[x][k] + 2 * ptr[x + 1][k] + ptr[x + 2][k];
-
-                sum /= 10;
-
-                dst.ptr<cv::Vec3b>(y)[x][k] = sum;
-            }
-        }
+        printf("Frame is empty\n");
+        return -1;
     }
 
-    // Vertical pass
-    for (int y = 2; y < src.rows - 2; y++)
+    dst.create(src.size().height, src.size().width, src.channels(), src.plane(0).type());
+    for (int c = 0; c < src.channels(); c++)
     {
-        cv::Vec3b *ptr = dst.ptr<cv::Vec3b>(y);
-        for (int x = 0; x < src.cols; x++)
+        if (blur5x5_5(src.plane(c), dst.plane(c), borderType, ctx) != 0)
         {
-            for (int k = 0; k < src.channels(); k++)
-            {
-                int sum = ptr[x - 2][k] + 2 * ptr[x - 1][k] + 4 * ptr[x][k] + 2 * ptr[x + 1][k] + ptr[x + 2][k];
-
-                sum /= 10;
-
-                dst.ptr<cv::Vec3b>(y)[x][k] = sum;
-            }
+            return -1;
         }
     }
-
     return 0;
 }
 
 /**
- * @brief Blur a color image using a 3x3 Gaussian kernel.
- *
- * This function blurs a color image using a 3x3 Gaussian kernel.
+ * @brief Planar version of sobelXY3x3. Computes the gradients of each plane as a single-channel image.
  *
- * @param src The source image.
- * @param dst The destination image.
+ * @param src The 8-bit source image.
+ * @param sx The destination image for the horizontal gradient (signed short planes).
+ * @param sy The destination image for the vertical gradient (signed short planes).
  * @return 0 if successful, -1 if error.
  */
-int gauss3x3at(cv::Mat &src, cv::Mat &dst) // pass images by reference
+int sobelXY3x3Planar(PlanarImage &src, PlanarImage &sx, PlanarImage &sy)
 {
-    // allocate space for destination image
-    src.copyTo(dst); // Let's us ignore the outer boundaries
-
-    // alternative
-    // dst.create(src.size(), src.type()); // makes duplicate image, uninitialized data
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
 
-    // only calculating values for pixels where filter fits in the image.
-    for (int y = 1; y < src.rows - 1; y++) // rows
+    sx.create(src.size().height, src.size().width, src.channels(), CV_16SC1);
+    sy.create(src.size().height, src.size().width, src.channels(), CV_16SC1);
+    for (int c = 0; c < src.channels(); c++)
     {
-        for (int x = 1; x < src.cols - 1; x++) // cols
+        if (sobelXY3x3(src.plane(c), sx.plane(c), sy.plane(c)) != 0)
         {
-            for (int k = 0; k < src.channels(); k++) // color channels
-            {
-                int sum = src.at<cv::Vec3b>(y - 1, x - 1)[k] + 2 * src.at<cv::Vec3b>(y - 1, x)[k] +
-                          src.at<cv::Vec3b>(y - 1, x + 1)[k] + 2 * src.at<cv::Vec3b>(y, x - 1)[k] +
-                          4 * src.at<cv::Vec3b>(y, x)[k] + 2 * src.at<cv::Vec3b>(y, x + 1)[k] +
-                          src.at<cv::Vec3b>(y + 1, x - 1)[k] + 2 * src.at<cv::Vec3b>(y + 1, x)[k] +
-                          src.at<cv::Vec3b>(y + 1, x + 1)[k];
-
-                // normalize the value back to a range of [0 ,255]
-                sum /= 16;
-
-                dst.at<cv::Vec3b>(y, x)[k] = sum;
-            }
+            return -1;
         }
     }
-
     return 0;
 }
 
 /**
- * @brief Enhance vertical lines in an image using a 3x3 Sobel kernel.
- *
- * This function enhances vertical lines in an image using a 3x3 Sobel kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * @brief Planar version of the fused Sobel gradient magnitude.
  *
- * @param src The source image.
- * @param dst The destination image.
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param norm The norm to measure the gradient with.
+ * @param ctx Optional context that holds the copy of the source for in-place calls.
  * @return 0 if successful, -1 if error.
  */
-int sobelX3x3(cv::Mat &src, cv::Mat &dst)
+int magnitudePlanar(PlanarImage &src, PlanarImage &dst, MagnitudeNorm norm, FilterContext *ctx)
 {
-    // -1  0  1
-    // -2  0  2
-    // -1  0  1
     if (src.empty())
     {
         printf("Frame is empty\n");
         return -1;
     }
 
-    dst.create(src.size(), CV_16SC3); // Create dst with signed short type
-
-    for (int y = 1; y < src.rows - 1; y++)
+    dst.create(src.size().height, src.size().width, src.channels(), src.plane(0).type());
+    for (int c = 0; c < src.channels(); c++)
     {
-        cv::Vec3b *ptrUp = src.ptr<cv::Vec3b>(y - 1);
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(y);
-        cv::Vec3b *ptrDown = src.ptr<cv::Vec3b>(y + 1);
-        for (int x = 1; x < src.cols - 1; x++)
+        if (magnitude(src.plane(c), dst.plane(c), norm, ctx) != 0)
         {
-            for (int k = 0; k < src.channels(); k++)
-            {
-                int sum = -ptrUp[x - 1][k] - 2 * ptr[x - 1][k] - ptrDown[x - 1][k] + ptrUp[x + 1][k] +
-                          2 * ptr[x + 1][k] + ptrDown[x + 1][k];
-
-                dst.ptr<cv::Vec3s>(y)[x][k] = static_cast<short>(sum);
-            }
+            return -1;
         }
     }
     return 0;
 }
 
 /**
- * @brief Enhance horizontal lines in an image using a 3x3 Sobel kernel.
- *
- * This function enhances horizontal lines in an image using a 3x3 Sobel kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * @brief Planar version of the fused emboss effect.
  *
- * @param src The source image.
- * @param dst The destination image.
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param ctx Optional context that holds the copy of the source for in-place calls.
  * @return 0 if successful, -1 if error.
  */
-int sobelY3x3(cv::Mat &src, cv::Mat &dst)
+int embossEffectPlanar(PlanarImage &src, PlanarImage &dst, FilterContext *ctx)
 {
-    // -1 -2 -1
-    //  0  0  0
-    //  1  2  1
-
     if (src.empty())
     {
         printf("Frame is empty\n");
         return -1;
     }
 
-    dst.create(src.size(), CV_16SC3); // Create dst with signed short type
-
-    for (int y = 1; y < src.rows - 1; y++)
+    dst.create(src.size().height, src.size().width, src.channels(), src.plane(0).type());
+    for (int c = 0; c < src.channels(); c++)
     {
-        cv::Vec3b *ptrUp = src.ptr<cv::Vec3b>(y - 1);
-        cv::Vec3b *ptrDown = src.ptr<cv::Vec3b>(y + 1);
-
-        for (int x = 1; x < src.cols - 1; x++)
+        if (embossEffect(src.plane(c), dst.plane(c), ctx) != 0)
         {
-            for (int k = 0; k < src.channels(); k++)
-            {
-                int sum = -ptrUp[x - 1][k] - 2 * ptrUp[x][k] - ptrUp[x + 1][k] + ptrDown[x - 1][k] + 2 * ptrDown[x][k] +
-                          ptrDown[x + 1][k];
-
-                dst.ptr<cv::Vec3s>(y)[x][k] = static_cast<short>(sum);
-            }
+            return -1;
         }
     }
     return 0;
 }
 
 /**
- * @brief Calculate the gradient magnitude of an image.
- *
- * This function calculates the gradient magnitude of an image. It does so by
- * applying horizontal and vertical sobel filters to each pixel within a nested loop.
+ * @brief Clip a region to an image and grow it by a halo, clipped again.
  *
- * @param sx The source image with a sobel x filter applied.
- * @param sy The source image with a sobel y filter applied.
- * @param dst The destination image.
- * @return 0 if successful, -1 if error.
+ * @param size The image size.
+ * @param region The region.
+ * @param halo The number of pixels to grow the region by on every side.
+ * @param inner Set to the region clipped to the image.
+ * @param outer Set to inner grown by halo and clipped to the image.
+ * @return false if the region does not overlap the image.
  */
-int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst)
+bool regionWindow(cv::Size size, const cv::Rect &region, int halo, cv::Rect &inner, cv::Rect &outer)
 {
-
-    if (sx.empty() || sy.empty())
+    cv::Rect image(0, 0, size.width, size.height);
+    inner = region & image;
+    if (inner.empty())
     {
-        printf("Frame is empty\n");
-        return -1;
+        return false;
     }
 
-    dst.create(sx.size(), CV_8UC3); // Create dst with unsigned char type
+    outer = cv::Rect(inner.x - halo, inner.y - halo, inner.width + 2 * halo, inner.height + 2 * halo) & image;
+    return true;
+}
 
-    for (int y = 0; y < dst.rows; y++)
+/**
+ * @brief Get the scratch image filterRegions stacks the filtered windows of all regions in.
+ *
+ * @param frame The image being filtered.
+ * @param regions The regions.
+ * @param halo The halo around each region.
+ * @param ctx The context holding the image in its SCRATCH_REGIONS slot, or NULL.
+ * @param local The image to allocate when ctx is NULL. Must outlive the returned reference.
+ * @return The scratch image, as tall as the windows together and as wide as the widest, with the type of frame.
+ */
+cv::Mat &regionScratch(const cv::Mat &frame, const std::vector<cv::Rect> &regions, int halo, FilterContext *ctx,
+                       cv::Mat &local)
+{
+    int rows = 0, cols = 0;
+    cv::Rect inner, outer;
+    for (size_t i = 0; i < regions.size(); i++)
     {
-        cv::Vec3s *ptrSx = sx.ptr<cv::Vec3s>(y);
-        cv::Vec3s *ptrSy = sy.ptr<cv::Vec3s>(y);
-        cv::Vec3b *ptrDst = dst.ptr<cv::Vec3b>(y);
-        for (int x = 0; x < dst.cols; x++)
+        if (regionWindow(frame.size(), regions[i], halo, inner, outer))
         {
-            for (int k = 0; k < dst.channels(); k++)
-            {
-                int sum = sqrt(pow(ptrSx[x][k], 2) + pow(ptrSy[x][k], 2));
-
-                ptrDst[x][k] = sum;
-            }
+            rows += outer.height;
+            cols = std::max(cols, outer.width);
         }
     }
 
-    return 0;
+    return scratchImage(ctx, FilterContext::SCRATCH_REGIONS, rows, cols, frame.type(), local);
 }
 
 /**
- * @brief Calculate the gradient magnitude of an image.
- *
- * This function calculates the gradient magnitude of an image. It does so by
- * applying horizontal and vertical sobel filters to each pixel within a nested loop. This version of the function uses
- * the .ptr method to access pixels. It also does not loop through the kernel, but instead calculates the sum of each
- * row and column of the kernel separately.
- *
- * @param src The source image.
- * @param dst The destination image.
- * @return 0 if successful, -1 if error.
+ * @brief Sum of absolute differences of two byte rows over [begin, end), added to sum.
  */
-int magnitude(cv::Mat &src, cv::Mat &dst)
+static void sadRowScalar(const uchar *a, const uchar *b, int begin, int end, uint64_t &sum)
 {
-    cv::Mat sobelX;
-    cv::Mat sobelY;
-
-    sobelX3x3(src, sobelX);
-    sobelY3x3(src, sobelY);
-
-    return magnitude(sobelX, sobelY, dst);
+    uint64_t rowSum = 0;
+    for (int i = begin; i < end; i++)
+    {
+        rowSum += std::abs(a[i] - b[i]);
+    }
+    sum += rowSum;
 }
 
+#ifdef SIMD_X86
 /**
- * @brief Blur a color image using a 5x5 Gaussian kernel. Quantize the image to a specified number of levels.
- *
- * This function blurs a color image using a 5x5 Gaussian kernel. It then quantizes the image to a specified number of
- * levels. It does so by dividing the image into buckets and setting each pixel to the average value of the bucket.
+ * @brief SSE4.1 version of sadRowScalar. Processes 16 bytes per iteration.
  *
- * @param src The source image.
- * @param dst The destination image.
- * @param levels The number of levels to quantize the image to.
- * @return 0 if successful, -1 if error.
+ * @return The first byte that was not summed; the caller finishes the tail with the scalar loop.
  */
-int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels)
+SIMD_TARGET_SSE41 static int sadRowSSE41(const uchar *a, const uchar *b, int begin, int end, uint64_t &sum)
 {
-    if (src.empty())
+    int i = begin;
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16)
     {
-        printf("Frame is empty\n");
-        return -1;
+        __m128i sad =
+            _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        acc = _mm_add_epi64(acc, sad);
     }
+    sum += (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_extract_epi32(acc, 2);
+    return i;
+}
 
-    blur5x5_5(src, dst);
-
-    float buckets = 255.0 / levels;
-
-    for (int y = 0; y < dst.rows; y++)
+/**
+ * @brief AVX2 version of sadRowScalar. Processes 32 bytes per iteration.
+ *
+ * @return The first byte that was not summed.
+ */
+SIMD_TARGET_AVX2 static int sadRowAVX2(const uchar *a, const uchar *b, int begin, int end, uint64_t &sum)
+{
+    int i = begin;
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= end; i += 32)
     {
-        cv::Vec3b *ptr = dst.ptr<cv::Vec3b>(y);
-        for (int x = 0; x < dst.cols; x++)
-        {
-            for (int k = 0; k < dst.channels(); k++)
-            {
-                uchar pixel = ptr[x][k];
-                int quantized = static_cast<int>(pixel / buckets);
-                pixel = static_cast<uchar>(quantized * buckets);
-            }
-        }
+        __m256i sad =
+            _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+        acc = _mm256_add_epi64(acc, sad);
     }
-
-    return 0;
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum += (uint32_t)_mm_cvtsi128_si32(half) + (uint32_t)_mm_extract_epi32(half, 2);
+    return i;
 }
+#endif
 
 /**
- * @brief Apply an emboss effect to an image.
- *
- * This function applies an emboss effect to an image. It does so by applying a 3x3 Sobel filter to the image and
- * adding 128 to the result. It then clamps the result to the range [0, 255].
- *
- * @param sx The source image with a sobel x filter applied.
- * @param sy The source image with a sobel y filter applied.
- * @param dst The destination image.
- * @return 0 if successful, -1 if error.
+ * @brief Sum of absolute differences of two byte rows over [begin, end) using the best instruction set available.
  */
-int embossEffect(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst)
+static uint64_t sadRow(const uchar *a, const uchar *b, int begin, int end)
 {
-    if (sx.empty() || sy.empty())
+    uint64_t sum = 0;
+    int i = begin;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
     {
-        printf("Frame is empty\n");
-        return -1;
+        i = sadRowAVX2(a, b, i, end, sum);
     }
-
-    dst.create(sx.size(), CV_8UC3); // Create dst with unsigned char type
-
-    const float dirX = 0.7071f;
-    const float dirY = 0.7071f;
-    const int offset = 128;
-
-    for (int y = 0; y < dst.rows; y++)
+    if (level >= SIMD_SSE41)
     {
-        cv::Vec3s *ptrSx = sx.ptr<cv::Vec3s>(y);
-        cv::Vec3s *ptrSy = sy.ptr<cv::Vec3s>(y);
-        cv::Vec3b *ptrDst = dst.ptr<cv::Vec3b>(y);
-
-        for (int x = 0; x < dst.cols; x++)
-        {
-            for (int k = 0; k < dst.channels(); k++)
-            {
-                int val = dirX * ptrSx[x][k] + dirY * ptrSy[x][k] + offset;
-                val = std::min(std::max(val, 0), 255);
-                ptrDst[x][k] = static_cast<uchar>(val);
-            }
-        }
+        i = sadRowSSE41(a, b, i, end, sum);
     }
-
-    return 0;
+#endif
+    sadRowScalar(a, b, i, end, sum);
+    return sum;
 }
 
 /**
- * @brief Adjust the brightness of an image.
- *
- * This function adjusts the brightness of an image. It does so by multiplying each pixel by a specified value.
+ * @brief Find the tiles of an image that changed since a reference image.
  *
- * @param src The source image.
- * @param dst The destination image.
- * @param brightness The brightness value to multiply each pixel by.
+ * @param src The current image.
+ * @param reference The image to compare against, with the size and type of src.
+ * @param tileSize The tile width and height in pixels.
+ * @param threshold The largest mean absolute difference per sample of an unchanged tile.
+ * @param tiles Set to the changed tiles, in raster order. Tiles on the right and bottom edges may be smaller.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int adjustBrightness(cv::Mat &src, cv::Mat &dst, double brightness)
+int changedTiles(cv::Mat &src, cv::Mat &reference, int tileSize, double threshold, std::vector<cv::Rect> &tiles,
+                 FilterContext *ctx)
 {
+    tiles.clear();
     if (src.empty())
     {
         printf("Frame is empty\n");
         return -1;
     }
 
-    src.copyTo(dst);
-
-    for (int y = 0; y < dst.rows; ++y)
+    if (src.depth() != CV_8U || reference.size() != src.size() || reference.type() != src.type())
     {
-        for (int x = 0; x < dst.cols; ++x)
-        {
-            for (int k = 0; k < dst.channels(); k++)
-            {
-                dst.at<cv::Vec3b>(y, x)[k] = std::min(std::max(dst.at<cv::Vec3b>(y, x)[k] * brightness, 0.0), 255.0);
-            }
-        }
+        printf("Expected two 8-bit images of the same size and type\n");
+        return -1;
     }
 
-    return 0;
-}
-
-/**
- * @brief Create a negative of an image
- *
- * This function creates a negative of an image. It does so by subtracting each pixel from 255.
- *
- * @param src The source image.
- * @param dst The destination image.
- * @return 0 if successful, -1 if error.
- */
-int negativeFilter(cv::Mat &src, cv::Mat &dst)
-{
-    if (src.empty())
+    if (tileSize < 1)
     {
-        printf("Frame is empty\n");
+        printf("Expected a tile size of at least 1\n");
         return -1;
     }
 
-    src.copyTo(dst);
+    // One changed flag per tile, filled by tile rows in parallel
+    int cn = src.channels();
+    int tileRows = (src.rows + tileSize - 1) / tileSize;
+    int tileCols = (src.cols + tileSize - 1) / tileSize;
+    cv::Mat local;
+    cv::Mat &changed = scratchImage(ctx, FilterContext::SCRATCH_TEMP, tileRows, tileCols, CV_8UC1, local);
+
+    parallelRows(0, tileRows, [&](int bandBegin, int bandEnd) {
+        for (int ty = bandBegin; ty < bandEnd; ty++)
+        {
+            int y0 = ty * tileSize;
+            int y1 = std::min(y0 + tileSize, src.rows);
+            uchar *flags = changed.ptr<uchar>(ty);
+            for (int tx = 0; tx < tileCols; tx++)
+            {
+                int x0 = tx * tileSize;
+                int x1 = std::min(x0 + tileSize, src.cols);
+                uint64_t sum = 0;
+                for (int y = y0; y < y1; y++)
+                {
+                    sum += sadRow(src.ptr<uchar>(y), reference.ptr<uchar>(y), x0 * cn, x1 * cn);
+                }
+                flags[tx] = sum > threshold * (y1 - y0) * (x1 - x0) * cn;
+            }
+        }
+    });
 
-    for (int y = 0; y < dst.rows; ++y)
+    // Join each run of changed tiles in a row of tiles into one rectangle
+    for (int ty = 0; ty < tileRows; ty++)
     {
-        for (int x = 0; x < dst.cols; ++x)
+        const uchar *flags = changed.ptr<uchar>(ty);
+        int y0 = ty * tileSize;
+        int height = std::min(tileSize, src.rows - y0);
+        for (int tx = 0; tx < tileCols; tx++)
         {
-            for (int k = 0; k < dst.channels(); k++)
+            if (!flags[tx])
+            {
+                continue;
+            }
+            int first = tx;
+            while (tx + 1 < tileCols && flags[tx + 1])
             {
-                dst.at<cv::Vec3b>(y, x)[k] = 255 - dst.at<cv::Vec3b>(y, x)[k];
+                tx++;
             }
+            int x0 = first * tileSize;
+            int x1 = std::min((tx + 1) * tileSize, src.cols);
+            tiles.push_back(cv::Rect(x0, y0, x1 - x0, height));
         }
     }
 
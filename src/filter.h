@@ -2,18 +2,131 @@
 // Date: January 9, 2024
 // Purpose: Display live video using OpenCV.
 
+#include <deque>
 #include <opencv2/core.hpp>
 #include <opencv2/opencv.hpp>
+#include <vector>
 
 #ifndef FILTER_H
 #define FILTER_H
 
+class FilterContext;
+class PlanarImage;
+
+/**
+ * @brief Set the number of threads the filters split their work across.
+ *
+ * Every filter in this file splits the image into horizontal bands of rows and runs the bands on OpenCV's persistent
+ * thread pool. Stencil filters read the halo rows above and below their band directly from the source image.
+ *
+ * @param threads The number of threads. 1 runs every filter on the calling thread, 0 or less uses every worker in
+ * OpenCV's thread pool (the default).
+ * @return 0 if successful, -1 if error.
+ */
+int setFilterThreads(int threads);
+
+/**
+ * @brief Get the number of threads the filters split their work across.
+ *
+ * @return The number of threads.
+ */
+int getFilterThreads();
+
+/**
+ * @brief Set the cache budget the stencil filters size their tiles to.
+ *
+ * With a budget, blur5x5_3, blur5x5_4 and gauss3x3at work through the image in tiles whose rows of source, horizontal
+ * sums and output fit in that many bytes, instead of running each pass over whole rows of the image. Each tile
+ * recomputes the few rows of halo it shares with its neighbours. The tiles of a row band run on that band's thread.
+ *
+ * @param bytes The tile working set in bytes, e.g. the per-core L2 size. 0 or less runs the passes over whole rows.
+ * @return 0 if successful, -1 if error.
+ */
+int setFilterTileCache(int bytes);
+
+/**
+ * @brief Get the cache budget the stencil filters size their tiles to.
+ *
+ * @return The tile working set in bytes, or 0 when the filters run over whole rows.
+ */
+int getFilterTileCache();
+
+/**
+ * @brief Get the number of bands parallelRows splits a row range into.
+ *
+ * @param rows The number of rows in the range.
+ * @return The number of bands, at least 1.
+ */
+int rowBandCount(int rows);
+
+/**
+ * @brief Get the first row of one band of a row range split by parallelRows.
+ *
+ * Band band covers the rows [rowBandBegin(begin, rows, bands, band), rowBandBegin(begin, rows, bands, band + 1)).
+ *
+ * @param begin The first row of the range.
+ * @param rows The number of rows in the range.
+ * @param bands The number of bands, as returned by rowBandCount.
+ * @param band The band, from 0 to bands. Passing bands gives one past the last row.
+ * @return The first row of the band.
+ */
+int rowBandBegin(int begin, int rows, int bands, int band);
+
+/**
+ * @brief Get the band of a row range split by parallelRows that holds a row.
+ *
+ * @param begin The first row of the range.
+ * @param rows The number of rows in the range.
+ * @param bands The number of bands, as returned by rowBandCount.
+ * @param row The row, e.g. the bandBegin passed to a parallelRows body.
+ * @return The band holding row.
+ */
+int rowBandIndex(int begin, int rows, int bands, int row);
+
+/**
+ * @brief Run a row loop in parallel bands, calling body(bodyData, bandBegin, bandEnd) for each band.
+ *
+ * This is the non-template part of parallelRows, which passes the loop body through a plain pointer so that no
+ * std::function (and no heap allocation) is created per call.
+ *
+ * @param begin The first row.
+ * @param end One past the last row.
+ * @param body The function running one band.
+ * @param bodyData The pointer passed back to body.
+ */
+void parallelRowBands(int begin, int end, void (*body)(const void *bodyData, int bandBegin, int bandEnd),
+                      const void *bodyData);
+
+/**
+ * @brief Call a row loop body of type Body stored behind a plain pointer.
+ */
+template <typename Body> void callRowBand(const void *body, int bandBegin, int bandEnd)
+{
+    (*static_cast<const Body *>(body))(bandBegin, bandEnd);
+}
+
+/**
+ * @brief Run a row loop in parallel bands.
+ *
+ * Splits the rows [begin, end) into contiguous bands and runs body(bandBegin, bandEnd) for each band on OpenCV's
+ * persistent thread pool, using the number of threads set with setFilterThreads.
+ *
+ * @param begin The first row.
+ * @param end One past the last row.
+ * @param body The loop over one band of rows.
+ */
+template <typename Body> void parallelRows(int begin, int end, const Body &body)
+{
+    parallelRowBands(begin, end, callRowBand<Body>, &body);
+}
+
 /**
  * @brief Convert a color image to greyscale.
  *
  * This function converts a color image to greyscale. It does so by subtracting
  * the red value of each pixel from 255 and setting the red, green, and blue
- * values of each pixel to the resulting value.
+ * values of each pixel to the resulting value. A single-channel image is
+ * treated as its own red channel and inverted.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -25,7 +138,8 @@ int greyscale(cv::Mat &src, cv::Mat &dst);
  * @brief Convert a color image to sepia tone.
  *
  * This function converts a color image to sepia tone. It does so by applying
- * sepia coefficients to each pixel.
+ * sepia coefficients to each pixel through ColorMatrix::sepia(). A single-channel
+ * grey image gives a 3-channel sepia image.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -37,84 +151,203 @@ int sepiaTone(cv::Mat &src, cv::Mat &dst);
  * @brief Blur a color image using a 5x5 Gaussian kernel.
  *
  * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * applying the kernel to each pixel within a nested loop. Images with 1 to 4
+ * channels each run a loop instantiated for their channel count.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_1(cv::Mat &src, cv::Mat &dst);
+int blur5x5_1(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 1x5 Gaussian kernel.
  *
  * This function blurs a color image using a 1x5 Gaussian kernel. It does so by
  * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal).
+ * Images with 1 to 4 channels each run loops instantiated for their channel count.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_2(cv::Mat &src, cv::Mat &dst);
+int blur5x5_2(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 5x5 Gaussian kernel.
  *
- * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop. This version of the function
- * uses the .at method to access the pixels. It adds the values of each pixel in the kernel
- * without looping through it.
+ * This function blurs a color image using a 5x5 Gaussian kernel. It no longer has a loop of its own: the kernel is
+ * applied as two 1x5 passes by Gauss5x5Filter::apply, which gives the same result as the full 5x5 sum. Works on 8-bit,
+ * 16-bit and float images.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_3(cv::Mat &src, cv::Mat &dst);
+int blur5x5_3(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 5x5 Gaussian kernel.
  *
- * This function blurs a color image using a 5x5 Gaussian kernel. It does so by
- * applying the kernel to each pixel within a nested loop. This version of the function uses the .ptr method to access
- * pixels. It also does not loop through the kernel, but instead calculates the sum of each row and column of the kernel
- * separately.
+ * This function blurs a color image using a 5x5 Gaussian kernel. Like blur5x5_3 it delegates to
+ * Gauss5x5Filter::apply, which applies the kernel as two 1x5 passes and gives the same result as the full 5x5 sum.
+ * Works on 8-bit, 16-bit and float images.
  *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  **/
-int blur5x5_4(cv::Mat &src, cv::Mat &dst);
+int blur5x5_4(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 1x5 Gaussian kernel.
  *
  * This function blurs a color image using a 1x5 Gaussian kernel. It does so by
- * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal). This version of the function
- * uses the .ptr method to access pixels. It also does not loop through the kernel, but instead calculates the sum of
- * each row and column of the kernel separately.
+ * applying separable 1x5 filters to each pixel in two passes (horizontal and veritcal).
+ *
+ * The two passes are fused into one streaming pass that keeps a five-row ring of horizontal sums per thread, so it
+ * needs only a few rows of scratch memory and can run in place. The result is exactly the 5x5 convolution with
+ * truncating division. The passes use AVX2 or SSE4.1 when the CPU supports them, chosen at runtime, and give the same
+ * result as the scalar code. Works on 8-bit images with any number of channels. Pixels within two of the edge are
+ * filtered too, reading the pixels outside the image according to the border mode. 16-bit and float images are
+ * filtered by Gauss5x5Filter, which gives the same result in two passes.
  *
  * @param src The source image.
- * @param dst The destination image.
+ * @param dst The destination image. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blur5x5_5(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
+
+/**
+ * @brief Blur an image with the 5x5 kernel of blur5x5_5 and halve it, as one level of a Gaussian pyramid.
+ *
+ * The blur and the 2x decimation are fused: only the even rows and columns of the blur are computed, so each output
+ * pixel costs one 5x5 sum and nothing is written at full size. The result is exactly every other row and column of
+ * blur5x5_5 with the same border mode. The vertical pass uses AVX2 or SSE4.1 when the CPU supports them. Works on
+ * 8-bit images with 1 to 4 channels.
+ *
+ * @param src The source image.
+ * @param dst The destination image, (src.cols + 1) / 2 by (src.rows + 1) / 2 pixels. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blur5x5_5(cv::Mat &src, cv::Mat &dst);
+int pyrDown5x5(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 3x3 Gaussian kernel.
  *
  * This function blurs a color image using a 3x3 Gaussian kernel.
  *
+ * The kernel is applied as two 1x3 passes by Gauss3x3Filter, which gives the same result as the full 3x3 sum.
+ * Works on 8-bit, 16-bit and float images.
+ *
  * @param src The source image.
  * @param dst The destination image.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int gauss3x3at(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
+
+/**
+ * @brief Blur an image with a (2 * radius + 1) square box filter in time independent of the radius.
+ *
+ * This function blurs an image by averaging every pixel with its neighbours in a square window. It keeps running sums
+ * that add the pixel entering the window and subtract the one leaving it, first along each row and then down each
+ * column, so every pixel costs the same few additions whatever the radius. Pixels outside the image repeat the nearest
+ * edge pixel.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param radius The radius of the window. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int boxBlur(cv::Mat &src, cv::Mat &dst, int radius, FilterContext *ctx = NULL);
+
+/**
+ * @brief Blur an image with an approximate Gaussian kernel built from three box blurs.
+ *
+ * This function approximates a Gaussian blur of the given standard deviation by running boxBlur three times, with
+ * window sizes picked so the variance of the combined kernel matches sigma as closely as odd sizes allow. The cost per
+ * pixel does not depend on sigma.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param sigma The standard deviation of the Gaussian, in pixels. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int gauss3x3at(cv::Mat &src, cv::Mat &dst);
+int boxGaussianBlur(cv::Mat &src, cv::Mat &dst, double sigma, FilterContext *ctx = NULL);
+
+/**
+ * @brief Replace every pixel with the median of a (2 * radius + 1) square window, in time independent of the radius.
+ *
+ * This function removes salt-and-pepper noise while keeping edges sharp. It follows the constant-time median of
+ * Perreault and Hebert: every column keeps a histogram of the window's rows in it, updated by one pixel in and one out
+ * per row, and the window histogram is the sum of the column histograms across it, updated by one column in and one out
+ * per pixel. The histograms have 16 coarse bins and 256 fine bins. The coarse bins locate the median's group of 16
+ * values, and only that group of fine bins is brought up to date, so a pixel costs a few 16-bin additions whatever the
+ * radius. The bin additions and searches use AVX2 or SSE4.1 when the CPU supports them. Pixels outside the image
+ * repeat the nearest edge pixel. Works on 8-bit images with 1 to 4 channels.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param radius The radius of the window, from 0 to 127. 0 copies the image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int medianFilter(cv::Mat &src, cv::Mat &dst, int radius, FilterContext *ctx = NULL);
+
+/**
+ * @brief Smooth an image while keeping its edges, with a bilateral filter computed on a bilateral grid.
+ *
+ * A bilateral filter averages each pixel with the neighbours that are both close to it and close to it in intensity,
+ * so flat areas are smoothed and edges are not. Computed directly it costs a full window per pixel. This function
+ * follows the bilateral grid of Chen, Paris and Durand instead. Every pixel is added into the cell of a 3D grid at its
+ * position divided by sigmaSpace and its intensity divided by sigmaRange. The grid is blurred with a separable
+ * 1-4-6-4-1 kernel along each of its three axes, and each output pixel is read back from the grid by trilinear
+ * interpolation at the pixel's own position and intensity. The grid is small, so the cost hardly depends on the sigmas.
+ * Sigmas so small that the grid would have more cells than the image has pixels are scaled up together until it does
+ * not, so the grid never outgrows the image.
+ * The intensity of a color pixel is its luminance, and all channels are averaged with the same weights. Every step
+ * runs in parallel across the filter threads.
+ *
+ * @param src The 8-bit grey or color source image, with 1, 3 or 4 channels.
+ * @param dst The destination image. May be the same as src.
+ * @param sigmaSpace The spatial extent of the smoothing in pixels, at least 1.
+ * @param sigmaRange The intensity difference, in 8-bit levels, across which pixels are still averaged, at least 1.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int bilateralGrid(cv::Mat &src, cv::Mat &dst, double sigmaSpace, double sigmaRange, FilterContext *ctx = NULL);
 
 /**
  * @brief Enhance vertical lines in an image using a 3x3 Sobel kernel.
  *
  * This function enhances vertical lines in an image using a 3x3 Sobel kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * applying the kernel to each pixel within a nested loop. Takes an 8-bit, 16-bit or float image
+ * with 1 to 4 channels and gives a gradient image with the same channel count: signed short for
+ * 8-bit, 32-bit integer for 16-bit and float for float images. The border pixels, where the kernel
+ * does not fit, are set to 0.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -126,7 +359,10 @@ int sobelX3x3(cv::Mat &src, cv::Mat &dst);
  * @brief Enhance horizontal lines in an image using a 3x3 Sobel kernel.
  *
  * This function enhances horizontal lines in an image using a 3x3 Sobel kernel. It does so by
- * applying the kernel to each pixel within a nested loop.
+ * applying the kernel to each pixel within a nested loop. Takes an 8-bit, 16-bit or float image
+ * with 1 to 4 channels and gives a gradient image with the same channel count: signed short for
+ * 8-bit, 32-bit integer for 16-bit and float for float images. The border pixels, where the kernel
+ * does not fit, are set to 0.
  *
  * @param src The source image.
  * @param dst The destination image.
@@ -134,32 +370,65 @@ int sobelX3x3(cv::Mat &src, cv::Mat &dst);
  */
 int sobelY3x3(cv::Mat &src, cv::Mat &dst);
 
+/**
+ * @brief Compute the horizontal and vertical 3x3 Sobel gradients in one pass.
+ *
+ * This function computes the same gradients as sobelX3x3 and sobelY3x3, but reads each 3x3 neighbourhood once and
+ * writes both outputs from it, so the source is swept once instead of twice. The border pixels, where the kernel does
+ * not fit, are set to 0.
+ *
+ * @param src The 8-bit, 16-bit or float source image.
+ * @param sx The destination image for the horizontal gradient (signed short for 8-bit, 32-bit integer for 16-bit and
+ * float for float images, same number of channels as src).
+ * @param sy The destination image for the vertical gradient (same type as sx).
+ * @return 0 if successful, -1 if error.
+ */
+int sobelXY3x3(cv::Mat &src, cv::Mat &sx, cv::Mat &sy);
+
+/**
+ * @brief Norms the gradient magnitude can be measured with.
+ */
+enum MagnitudeNorm
+{
+    MAGNITUDE_L2 = 0, // sqrt(gx^2 + gy^2), rounded down
+    MAGNITUDE_L1 = 1  // |gx| + |gy|, cheaper when only the edge strength matters
+};
+
 /**
  * @brief Calculate the gradient magnitude of an image.
  *
  * This function calculates the gradient magnitude of an image. It does so by
  * applying horizontal and vertical sobel filters to each pixel within a nested loop.
  *
+ * The magnitude is computed in integers (or exact single precision square roots on the SIMD paths) and saturated to
+ * 255, so no double precision math runs per pixel. The 32-bit integer gradients of a 16-bit image give a 16-bit
+ * magnitude saturated to 65535, and float gradients a float magnitude.
+ *
  * @param sx The source image with a sobel x filter applied.
  * @param sy The source image with a sobel y filter applied.
  * @param dst The destination image.
+ * @param norm The norm to measure the gradient with.
  * @return 0 if successful, -1 if error.
  */
-int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst);
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeNorm norm = MAGNITUDE_L2);
 
 /**
  * @brief Calculate the gradient magnitude of an image.
  *
- * This function calculates the gradient magnitude of an image. It does so by
- * applying horizontal and vertical sobel filters to each pixel within a nested loop. This version of the function uses
- * the .ptr method to access pixels. It also does not loop through the kernel, but instead calculates the sum of each
- * row and column of the kernel separately.
+ * This function calculates the gradient magnitude of an image. The horizontal and vertical 3x3 sobel gradients of
+ * each pixel are computed from the three rows around it and combined with the chosen norm.
  *
- * @param src The source image.
+ * The gradients are computed and turned into a magnitude in the same pass, without writing intermediate signed short
+ * images. Border pixels are set to 0. Rows are vectorized with AVX2 or SSE4.1 when the CPU supports them. 16-bit and
+ * float images run a scalar loop templated on the pixel type and give a magnitude of the same depth.
+ *
+ * @param src The 8-bit, 16-bit or float source image.
  * @param dst The destination image.
+ * @param norm The norm to measure the gradient with.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int magnitude(cv::Mat &src, cv::Mat &dst);
+int magnitude(cv::Mat &src, cv::Mat &dst, MagnitudeNorm norm = MAGNITUDE_L2, FilterContext *ctx = NULL);
 
 /**
  * @brief Blur a color image using a 5x5 Gaussian kernel. Quantize the image to a specified number of levels.
@@ -170,15 +439,52 @@ int magnitude(cv::Mat &src, cv::Mat &dst);
  * @param src The source image.
  * @param dst The destination image.
  * @param levels The number of levels to quantize the image to.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels, FilterContext *ctx = NULL);
+
+/**
+ * @brief Turn an image into a cartoon: blur it, quantize it and draw its edges in black, in one pass.
+ *
+ * The blur is the 5x5 kernel of blur5x5_5 and the quantization that of PointOp::quantize, so away from edges the
+ * result is exactly blurQuantize. A pixel is an edge when the L1 norm of the 3x3 Sobel gradient of the blurred
+ * intensity (the luminance of a color image) is above the threshold. The three steps run on a few rows at a time while
+ * they are in cache, instead of as full passes over the frame. Works on 8-bit images with 1 to 4 channels.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @param levels The number of levels to quantize the image to.
+ * @param edgeThreshold The Sobel gradient norm above which a pixel is drawn as an edge, from 0 to 2040.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int cartoonize(cv::Mat &src, cv::Mat &dst, int levels, int edgeThreshold, FilterContext *ctx = NULL);
+
+/**
+ * @brief Sharpen an image with an unsharp mask: add back the difference between it and its 5x5 Gaussian blur.
+ *
+ * Each pixel becomes src + amount * (src - blur) where the difference is above the threshold, saturated to [0, 255].
+ * The blur of blur5x5_5, the difference and the saturating add run in one streaming pass, without writing the blurred
+ * frame, and are vectorized with AVX2 or SSE4.1 when the CPU supports them. Works on 8-bit images with any number of
+ * channels, grey included.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param amount How much of the difference to add back, from 0 to 16. 1 doubles the detail.
+ * @param threshold The largest difference from the blur left unsharpened, from 0 to 255, so flat noisy areas stay
+ * flat.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
  * @return 0 if successful, -1 if error.
  */
-int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels);
+int unsharpMask(cv::Mat &src, cv::Mat &dst, double amount, int threshold, FilterContext *ctx = NULL);
 
 /**
  * @brief Apply an emboss effect to an image.
  *
  * This function applies an emboss effect to an image. It does so by applying a 3x3 Sobel filter to the image and
- * adding 128 to the result. It then clamps the result to the range [0, 255].
+ * adding 128 to the result. It then clamps the result to the range [0, 255]. The output has the
+ * channel count of the gradients.
  *
  * @param sx The source image with a sobel x filter applied.
  * @param sy The source image with a sobel y filter applied.
@@ -187,6 +493,19 @@ int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels);
  */
 int embossEffect(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst);
 
+/**
+ * @brief Apply an emboss effect to an image.
+ *
+ * This function applies the same emboss effect as embossEffect(sx, sy, dst), but computes the Sobel gradients of each
+ * pixel on the fly instead of reading them from two signed short images. Border pixels are set to mid grey.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int embossEffect(cv::Mat &src, cv::Mat &dst, FilterContext *ctx = NULL);
+
 /**
  * @brief Adjust the brightness of an image.
  *
@@ -210,4 +529,497 @@ int adjustBrightness(cv::Mat &src, cv::Mat &dst, double brightness);
  */
 int negativeFilter(cv::Mat &src, cv::Mat &dst);
 
+
+/**
+ * @brief A per-channel point operation stored as a 256-entry lookup table.
+ *
+ * Any function of a single 8-bit channel value (negative, brightness, quantization, ...) is compiled into a table once,
+ * and applying it costs one lookup per byte. A chain of point operations composes into a single table with then(), so
+ * the whole chain is applied in one sweep over the frame instead of one sweep per operation.
+ */
+class PointOp
+{
+  public:
+    /**
+     * @brief Create the identity operation.
+     */
+    PointOp();
+
+    /**
+     * @brief Create an operation that subtracts each value from 255.
+     *
+     * @return The negative operation.
+     */
+    static PointOp negative();
+
+    /**
+     * @brief Create an operation that multiplies each value by a factor and clamps it to [0, 255].
+     *
+     * @param brightness The factor to multiply each value by.
+     * @return The brightness operation.
+     */
+    static PointOp brightness(double brightness);
+
+    /**
+     * @brief Create an operation that quantizes each value to a number of levels.
+     *
+     * @param levels The number of levels, at least 1.
+     * @return The quantize operation.
+     */
+    static PointOp quantize(int levels);
+
+    /**
+     * @brief Compose this operation with another one.
+     *
+     * @param next The operation to apply after this one.
+     * @return A single operation equivalent to applying this one and then next.
+     */
+    PointOp then(const PointOp &next) const;
+
+    /**
+     * @brief Check whether the operation leaves every value unchanged.
+     *
+     * @return true if the table is the identity.
+     */
+    bool isIdentity() const;
+
+    /**
+     * @brief Apply the operation to every channel of an 8-bit image.
+     *
+     * @param src The source image.
+     * @param dst The destination image. May be the same as src.
+     * @return 0 if successful, -1 if error.
+     */
+    int apply(cv::Mat &src, cv::Mat &dst) const;
+
+    /**
+     * @brief Apply the operation to every plane of an 8-bit planar image.
+     *
+     * @param src The source image.
+     * @param dst The destination image. May be the same as src.
+     * @return 0 if successful, -1 if error.
+     */
+    int apply(PlanarImage &src, PlanarImage &dst) const;
+
+    // table[v] is the output for input value v
+    uchar table[256];
+};
+
+
+/**
+ * @brief A 3x4 color matrix (3x3 matrix plus offset) applied to every pixel of a BGR image.
+ *
+ * Output channel i is m[i][0] * blue + m[i][1] * green + m[i][2] * red + m[i][3], saturated to [0, 255]. Sepia,
+ * luminance greyscale, channel swaps and brightness scaling are all instances. A chain of matrices multiplies out into
+ * a single matrix with then(), so stacked color effects cost one pass. The matrix is applied in 16-bit fixed point
+ * with SSE4.1 or AVX2 when the CPU supports them, with the same result on every path.
+ */
+class ColorMatrix
+{
+  public:
+    /**
+     * @brief Create the identity matrix.
+     */
+    ColorMatrix();
+
+    /**
+     * @brief Create the sepia tone matrix used by sepiaTone.
+     *
+     * @return The sepia matrix.
+     */
+    static ColorMatrix sepia();
+
+    /**
+     * @brief Create a matrix that sets every channel to the luminance of the pixel.
+     *
+     * @return The luminance greyscale matrix.
+     */
+    static ColorMatrix luminance();
+
+    /**
+     * @brief Create a matrix that reorders the channels.
+     *
+     * @param blue The source channel (0, 1 or 2) copied to the blue channel.
+     * @param green The source channel copied to the green channel.
+     * @param red The source channel copied to the red channel.
+     * @return The channel swap matrix.
+     */
+    static ColorMatrix channelSwap(int blue, int green, int red);
+
+    /**
+     * @brief Create a matrix that multiplies every channel by a factor.
+     *
+     * @param brightness The factor to multiply each channel by.
+     * @return The brightness matrix.
+     */
+    static ColorMatrix brightness(double brightness);
+
+    /**
+     * @brief Compose this matrix with another one.
+     *
+     * The result is the matrix product, so values are only saturated once at the end of the chain rather than between
+     * each matrix.
+     *
+     * @param next The matrix to apply after this one.
+     * @return A single matrix equivalent to applying this one and then next.
+     */
+    ColorMatrix then(const ColorMatrix &next) const;
+
+    /**
+     * @brief Apply the matrix to an 8-bit, 16-bit or float 3-channel image.
+     *
+     * A single-channel image is treated as grey, with equal blue, green and red, and gives a 3-channel image.
+     * 8-bit images run the fixed-point kernels; 16-bit and float images are computed in double and single precision,
+     * with the offsets scaled from 8-bit units to the range of the depth (0 to 65535, or 0 to 1 for float).
+     *
+     * @param src The source image.
+     * @param dst The destination image. May be the same as src.
+     * @return 0 if successful, -1 if error.
+     */
+    int apply(cv::Mat &src, cv::Mat &dst) const;
+
+    /**
+     * @brief Apply the matrix to an 8-bit planar image with B, G and R planes.
+     *
+     * Each output plane is a multiply-add of whole input planes, so no shuffling is needed to separate the channels.
+     * Gives the same values as the interleaved apply. A single grey plane gives B, G and R planes.
+     *
+     * @param src The source image.
+     * @param dst The destination image. May be the same as src.
+     * @return 0 if successful, -1 if error.
+     */
+    int apply(PlanarImage &src, PlanarImage &dst) const;
+
+    // m[i][j] is the weight of input channel j (B, G, R) in output channel i; m[i][3] is the offset
+    float m[3][4];
+};
+
+/**
+ * @brief Reusable output and scratch buffers for filtering a stream of frames.
+ *
+ * The filters allocate their outputs with create(), which only allocates when the size or type changes, but a fresh
+ * cv::Mat per frame and the scratch images some kernels need still cost full-size heap allocations on every frame. A
+ * FilterContext keeps those buffers alive between frames: pass it to the filters that take one, and write each stage of
+ * a pipeline into output(frame) before making that the new frame. Once the first frame has sized every buffer, a
+ * pipeline that runs the same stages each frame allocates nothing, which allocations() can confirm.
+ */
+class FilterContext
+{
+  public:
+    // Scratch slots used inside the filters. Callers can use slots from SCRATCH_USER upward for their own images.
+    enum Slot
+    {
+        SCRATCH_TEMP = 0,    // intermediate pass of a two-pass filter
+        SCRATCH_INPUT = 1,   // copy of the source for in-place calls
+        SCRATCH_REGIONS = 2, // filtered windows of filterRegions
+        SCRATCH_BANDS = 3,   // one block of working rows per row band, found with rowBandIndex
+        SCRATCH_USER = 4
+    };
+
+    /**
+     * @brief Create an empty context. Buffers are allocated on first use.
+     */
+    FilterContext();
+
+    /**
+     * @brief Get a scratch image, allocating only when the slot has never held that many bytes.
+     *
+     * @param slot The scratch slot. Images in different slots never share memory.
+     * @param rows The number of rows.
+     * @param cols The number of columns.
+     * @param type The OpenCV type.
+     * @return The scratch image. Its contents are left over from the last use of the slot, and it stays valid until the
+     * slot is requested again. Requests for other slots do not move it.
+     */
+    cv::Mat &scratch(int slot, int rows, int cols, int type);
+
+    /**
+     * @brief Get a buffer to write the next pipeline stage into.
+     *
+     * The context owns two output buffers and returns the one that does not hold frame, so a stage can read frame and
+     * write its result without an in-place copy, after which the caller sets frame to the returned buffer.
+     *
+     * @param frame The image the next stage reads.
+     * @return The output buffer.
+     */
+    cv::Mat &output(const cv::Mat &frame);
+
+    /**
+     * @brief Get the number of times a buffer of this context has been allocated or reallocated.
+     *
+     * @return The allocation count.
+     */
+    int allocations() const;
+
+  private:
+    /**
+     * @brief Count output buffers that a filter reallocated since they were last checked.
+     */
+    void countOutputAllocations() const;
+
+    std::deque<cv::Mat> scratchImages;  // views of scratchStorage with the shape last asked for
+    std::deque<cv::Mat> scratchStorage; // one growing byte buffer per slot; a deque, so adding slots moves none
+    cv::Mat outputs[2];
+    mutable const uchar *outputData[2];
+    mutable int allocationCount;
+};
+
+/**
+ * @brief An image stored as one single-channel plane per channel (B, G, R for a color image).
+ *
+ * The interleaved kernels handle all channels of a pixel in the same loop, which leaves SIMD code shuffling bytes
+ * between channels wherever a channel is treated on its own or mixed with the others. A chain of filters can instead
+ * convert the frame to planes once with deinterleave, run the planar versions of the kernels, and convert back once
+ * with interleave.
+ */
+class PlanarImage
+{
+  public:
+    // Most planes an image can have
+    static const int MAX_PLANES = 4;
+
+    /**
+     * @brief Create an empty image.
+     */
+    PlanarImage();
+
+    /**
+     * @brief Allocate the planes, only reallocating a plane when its size or type changes.
+     *
+     * @param rows The number of rows.
+     * @param cols The number of columns.
+     * @param planes The number of planes, from 1 to MAX_PLANES.
+     * @param type The single-channel OpenCV type of each plane.
+     */
+    void create(int rows, int cols, int planes, int type = CV_8UC1);
+
+    /**
+     * @brief Get one plane.
+     *
+     * @param index The plane, from 0 to channels() - 1.
+     * @return The plane.
+     */
+    cv::Mat &plane(int index);
+
+    /**
+     * @brief Get the number of planes.
+     *
+     * @return The number of planes, 0 for an empty image.
+     */
+    int channels() const;
+
+    /**
+     * @brief Get the image size.
+     *
+     * @return The size of each plane.
+     */
+    cv::Size size() const;
+
+    /**
+     * @brief Check whether the image has no planes.
+     *
+     * @return true if the image is empty.
+     */
+    bool empty() const;
+
+  private:
+    cv::Mat planes[MAX_PLANES];
+    int planeCount;
+};
+
+/**
+ * @brief Split an interleaved 8-bit image into planes.
+ *
+ * Three-channel images are split 16 pixels at a time with byte shuffles when the CPU has SSE4.1.
+ *
+ * @param src The interleaved source image, 1 to 4 channels.
+ * @param dst The planar destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int deinterleave(cv::Mat &src, PlanarImage &dst);
+
+/**
+ * @brief Merge the planes of an 8-bit planar image into an interleaved image.
+ *
+ * Three-plane images are merged 16 pixels at a time with byte shuffles when the CPU has SSE4.1.
+ *
+ * @param src The planar source image.
+ * @param dst The interleaved destination image.
+ * @return 0 if successful, -1 if error.
+ */
+int interleave(PlanarImage &src, cv::Mat &dst);
+
+/**
+ * @brief Planar version of blur5x5_5. Blurs each plane as a single-channel image.
+ *
+ * @param src The source image.
+ * @param dst The destination image. May be the same as src.
+ * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int blur5x5Planar(PlanarImage &src, PlanarImage &dst, int borderType = cv::BORDER_REFLECT_101,
+                  FilterContext *ctx = NULL);
+
+/**
+ * @brief Planar version of sobelXY3x3. Computes the gradients of each plane as a single-channel image.
+ *
+ * @param src The 8-bit source image.
+ * @param sx The destination image for the horizontal gradient (signed short planes).
+ * @param sy The destination image for the vertical gradient (signed short planes).
+ * @return 0 if successful, -1 if error.
+ */
+int sobelXY3x3Planar(PlanarImage &src, PlanarImage &sx, PlanarImage &sy);
+
+/**
+ * @brief Planar version of the fused Sobel gradient magnitude.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param norm The norm to measure the gradient with.
+ * @param ctx Optional context that holds the copy of the source for in-place calls.
+ * @return 0 if successful, -1 if error.
+ */
+int magnitudePlanar(PlanarImage &src, PlanarImage &dst, MagnitudeNorm norm = MAGNITUDE_L2, FilterContext *ctx = NULL);
+
+/**
+ * @brief Planar version of the fused emboss effect.
+ *
+ * @param src The 8-bit source image.
+ * @param dst The destination image. May be the same as src.
+ * @param ctx Optional context that holds the copy of the source for in-place calls.
+ * @return 0 if successful, -1 if error.
+ */
+int embossEffectPlanar(PlanarImage &src, PlanarImage &dst, FilterContext *ctx = NULL);
+
+/**
+ * @brief Clip a region to an image and grow it by a halo, clipped again.
+ *
+ * This is the non-template part of filterRegions.
+ *
+ * @param size The image size.
+ * @param region The region.
+ * @param halo The number of pixels to grow the region by on every side.
+ * @param inner Set to the region clipped to the image.
+ * @param outer Set to inner grown by halo and clipped to the image.
+ * @return false if the region does not overlap the image.
+ */
+bool regionWindow(cv::Size size, const cv::Rect &region, int halo, cv::Rect &inner, cv::Rect &outer);
+
+/**
+ * @brief Get the scratch image filterRegions stacks the filtered windows of all regions in.
+ *
+ * This is the non-template part of filterRegions. The windows are stacked top to bottom, each in its own rows.
+ *
+ * @param frame The image being filtered.
+ * @param regions The regions.
+ * @param halo The halo around each region.
+ * @param ctx The context holding the image in its SCRATCH_REGIONS slot, or NULL.
+ * @param local The image to allocate when ctx is NULL. Must outlive the returned reference.
+ * @return The scratch image, as tall as the windows together and as wide as the widest, with the type of frame.
+ */
+cv::Mat &regionScratch(const cv::Mat &frame, const std::vector<cv::Rect> &regions, int halo, FilterContext *ctx,
+                       cv::Mat &local);
+
+/**
+ * @brief Apply a filter only inside a list of rectangles of an image, writing the result into the image in place.
+ *
+ * Each rectangle is clipped to the image and grown by halo pixels on every side, the filter runs on that window of the
+ * image, and only the pixels inside the rectangle are written back. With a halo at least as wide as the radius of the
+ * filter's kernel, every pixel written is the one filtering the whole image gives: inside the image the halo supplies
+ * the real neighbours, and where a window meets the image edge the filter's border mode applies as usual. All windows
+ * are filtered before any is written back, so overlapping rectangles read the original pixels. The work is
+ * proportional to the area of the rectangles rather than of the image, e.g. for blurring the faces returned by
+ * detectFaces.
+ *
+ * @param frame The image, filtered in place.
+ * @param regions The rectangles to filter. Parts outside the image are ignored.
+ * @param halo The number of pixels around each rectangle the filter reads, at least its kernel radius.
+ * @param filter Called as filter(src, dst) for each window, returning 0 if successful. It must write dst with the size
+ * and type of src, e.g. [&](cv::Mat &src, cv::Mat &dst) { return blur5x5_5(src, dst); } with a halo of 2.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+template <typename Filter>
+int filterRegions(cv::Mat &frame, const std::vector<cv::Rect> &regions, int halo, const Filter &filter,
+                  FilterContext *ctx = NULL)
+{
+    if (frame.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (halo < 0)
+    {
+        printf("Expected a halo of at least 0\n");
+        return -1;
+    }
+
+    cv::Mat local;
+    cv::Mat &outputs = regionScratch(frame, regions, halo, ctx, local);
+    cv::Rect inner, outer;
+
+    // Filter every window into its own rows of the scratch image first
+    int top = 0;
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        if (!regionWindow(frame.size(), regions[i], halo, inner, outer))
+        {
+            continue;
+        }
+
+        cv::Mat window = frame(outer);
+        cv::Mat output = outputs(cv::Rect(0, top, outer.width, outer.height));
+        const uchar *outputData = output.data;
+        if (filter(window, output) != 0)
+        {
+            return -1;
+        }
+        if (output.data != outputData)
+        {
+            printf("Expected a filter that keeps the size and type of the image\n");
+            return -1;
+        }
+        top += outer.height;
+    }
+
+    // Then copy the inside of each region back into the image
+    top = 0;
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        if (!regionWindow(frame.size(), regions[i], halo, inner, outer))
+        {
+            continue;
+        }
+
+        cv::Rect filtered(inner.x - outer.x, top + inner.y - outer.y, inner.width, inner.height);
+        cv::Mat target = frame(inner);
+        outputs(filtered).copyTo(target);
+        top += outer.height;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find the tiles of an image that changed since a reference image.
+ *
+ * The images are split into tileSize x tileSize tiles and each tile is compared by the sum of absolute differences
+ * over all its samples, computed with SIMD where available. A tile counts as changed when its mean absolute
+ * difference per sample is above threshold, so small sensor noise in a static scene does not trigger it. Changed
+ * tiles next to each other in a row of tiles are returned as one rectangle.
+ *
+ * @param src The current image.
+ * @param reference The image to compare against, with the size and type of src.
+ * @param tileSize The tile width and height in pixels.
+ * @param threshold The largest mean absolute difference per sample of an unchanged tile.
+ * @param tiles Set to the changed tiles, in raster order. Tiles on the right and bottom edges may be smaller.
+ * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int changedTiles(cv::Mat &src, cv::Mat &reference, int tileSize, double threshold, std::vector<cv::Rect> &tiles,
+                 FilterContext *ctx = NULL);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,521 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Integral images (summed-area tables) of 8-bit images, with constant-time rectangle sums for box filters,
+// local statistics and Haar-like features.
+
+#include "integral.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include "filter.h"
+#include "simd.h"
+
+/**
+ * @brief Prefix sums of part of one row of 8-bit values, per channel, as 32-bit integers.
+ *
+ * @param src The source row.
+ * @param dst The destination row. dst[i] is the sum of src[j] (or its square) for j <= i in the channel of i.
+ * @param begin The first value to write. The values of the row before it are already written.
+ * @param end One past the last value to write.
+ * @param cn The number of channels (distance between values of the same channel).
+ * @param square Whether to sum the squares of the values.
+ */
+static void prefixRowScalar(const uchar *src, int32_t *dst, int begin, int end, int cn, bool square)
+{
+    for (int i = begin; i < end; i++)
+    {
+        int32_t value = square ? src[i] * src[i] : src[i];
+        dst[i] = (i < cn ? 0 : dst[i - cn]) + value;
+    }
+}
+
+/**
+ * @brief Running sum down the columns for part of one row of the table: out = prev + row.
+ *
+ * @param prev The table row above.
+ * @param row The prefix sums of the image row.
+ * @param out The table row to write.
+ * @param begin The first value to write.
+ * @param end One past the last value to write.
+ */
+template <typename Sum> static void addColumnsScalar(const Sum *prev, const int32_t *row, Sum *out, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        out[i] = prev[i] + row[i];
+    }
+}
+
+#ifdef SIMD_X86
+/**
+ * @brief SSE4.1 version of prefixRowScalar from the start of a row with 1, 2 or 4 channels. Processes 4 values per
+ * iteration.
+ *
+ * The four values are summed within the vector by adding copies of it shifted by one and two pixels, then the last
+ * sum of each channel of the vector before is broadcast and added.
+ *
+ * @return The first value not written.
+ */
+template <int CN, bool Square> SIMD_TARGET_SSE41 static int prefixRowSSE41(const uchar *src, int32_t *dst, int end)
+{
+    __m128i carry = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= end; i += 4)
+    {
+        int32_t bytes;
+        memcpy(&bytes, src + i, sizeof(bytes));
+        __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+        if (Square)
+        {
+            v = _mm_mullo_epi32(v, v);
+        }
+        if (CN == 1)
+        {
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        }
+        else if (CN == 2)
+        {
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        }
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+
+        if (CN == 1)
+        {
+            carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        else if (CN == 2)
+        {
+            carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        else
+        {
+            carry = v;
+        }
+    }
+    return i;
+}
+
+/**
+ * @brief SSE4.1 version of prefixRowScalar from the start of a row with 3 channels. Processes one pixel per iteration.
+ *
+ * The channels of a pixel fill three lanes of a running sum vector. The fourth lane spills into the first channel of
+ * the next pixel, which the next iteration overwrites, so the last pixel is left to the scalar loop.
+ *
+ * @return The first value not written.
+ */
+template <bool Square> SIMD_TARGET_SSE41 static int prefixRowBGRSSE41(const uchar *src, int32_t *dst, int end)
+{
+    __m128i sum = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= end; i += 3)
+    {
+        int32_t bytes;
+        memcpy(&bytes, src + i, sizeof(bytes));
+        __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+        if (Square)
+        {
+            v = _mm_mullo_epi32(v, v);
+        }
+        sum = _mm_add_epi32(sum, v);
+        _mm_storeu_si128((__m128i *)(dst + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief SSE4.1 version of addColumnsScalar for 32-bit sums. Processes 4 values per iteration.
+ *
+ * @return The first value not written.
+ */
+SIMD_TARGET_SSE41 static int addColumnsSSE41(const int32_t *prev, const int32_t *row, int32_t *out, int begin, int end)
+{
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(prev + i)),
+                                    _mm_loadu_si128((const __m128i *)(row + i)));
+        _mm_storeu_si128((__m128i *)(out + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief SSE4.1 version of addColumnsScalar for 64-bit sums. Processes 2 values per iteration.
+ *
+ * @return The first value not written.
+ */
+SIMD_TARGET_SSE41 static int addColumnsSSE41(const int64_t *prev, const int32_t *row, int64_t *out, int begin, int end)
+{
+    int i = begin;
+    for (; i + 2 <= end; i += 2)
+    {
+        __m128i wide = _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i *)(row + i)));
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(prev + i)), wide);
+        _mm_storeu_si128((__m128i *)(out + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief AVX2 version of addColumnsScalar for 32-bit sums. Processes 8 values per iteration.
+ *
+ * @return The first value not written.
+ */
+SIMD_TARGET_AVX2 static int addColumnsAVX2(const int32_t *prev, const int32_t *row, int32_t *out, int begin, int end)
+{
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(prev + i)),
+                                       _mm256_loadu_si256((const __m256i *)(row + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), sum);
+    }
+    return i;
+}
+
+/**
+ * @brief AVX2 version of addColumnsScalar for 64-bit sums. Processes 4 values per iteration.
+ *
+ * @return The first value not written.
+ */
+SIMD_TARGET_AVX2 static int addColumnsAVX2(const int64_t *prev, const int32_t *row, int64_t *out, int begin, int end)
+{
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256i wide = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(row + i)));
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(prev + i)), wide);
+        _mm256_storeu_si256((__m256i *)(out + i), sum);
+    }
+    return i;
+}
+#endif
+
+/**
+ * @brief Prefix sums of one row of 8-bit values using the best instruction set available.
+ */
+static void prefixRow(const uchar *src, int32_t *dst, int width, int cn, bool square)
+{
+    int i = 0;
+#ifdef SIMD_X86
+    if (simdLevel() >= SIMD_SSE41)
+    {
+        switch (cn * 2 + square)
+        {
+        case 2:
+            i = prefixRowSSE41<1, false>(src, dst, width);
+            break;
+        case 3:
+            i = prefixRowSSE41<1, true>(src, dst, width);
+            break;
+        case 4:
+            i = prefixRowSSE41<2, false>(src, dst, width);
+            break;
+        case 5:
+            i = prefixRowSSE41<2, true>(src, dst, width);
+            break;
+        case 6:
+            i = prefixRowBGRSSE41<false>(src, dst, width);
+            break;
+        case 7:
+            i = prefixRowBGRSSE41<true>(src, dst, width);
+            break;
+        case 8:
+            i = prefixRowSSE41<4, false>(src, dst, width);
+            break;
+        case 9:
+            i = prefixRowSSE41<4, true>(src, dst, width);
+            break;
+        }
+    }
+#endif
+    prefixRowScalar(src, dst, i, width, cn, square);
+}
+
+/**
+ * @brief Running sum down the columns for part of one row of the table using the best instruction set available.
+ */
+template <typename Sum> static void addColumns(const Sum *prev, const int32_t *row, Sum *out, int begin, int end)
+{
+    int i = begin;
+#ifdef SIMD_X86
+    SimdLevel level = simdLevel();
+    if (level >= SIMD_AVX2)
+    {
+        i = addColumnsAVX2(prev, row, out, i, end);
+    }
+    if (level >= SIMD_SSE41)
+    {
+        i = addColumnsSSE41(prev, row, out, i, end);
+    }
+#endif
+    addColumnsScalar(prev, row, out, i, end);
+}
+
+/**
+ * @brief Build one integral table from an image.
+ *
+ * The row pass writes the prefix sums of every image row to rowSums in parallel over rows. The column pass then adds
+ * them down the table in parallel over strips of columns, each strip walking all the rows.
+ *
+ * @param src The 8-bit source image.
+ * @param square Whether to sum the squares of the values.
+ * @param rowSums The buffer for the row pass, src.rows * src.cols * src.channels() values.
+ * @param table The table, (src.rows + 1) * (src.cols + 1) * src.channels() values.
+ */
+template <typename Sum>
+static void buildTable(const cv::Mat &src, bool square, std::vector<int32_t> &rowSums, std::vector<Sum> &table)
+{
+    int cn = src.channels();
+    int width = src.cols * cn; // values per image row
+    int stride = width + cn;   // values per table row, with the zero column on the left
+
+    parallelRows(0, src.rows, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            prefixRow(src.ptr<uchar>(y), &rowSums[(size_t)y * width], width, cn, square);
+        }
+    });
+
+    std::fill(table.begin(), table.begin() + stride, 0);
+    parallelRows(0, width, [&](int i0, int i1) {
+        for (int y = 0; y < src.rows; y++)
+        {
+            Sum *out = &table[(size_t)(y + 1) * stride + cn];
+            if (i0 == 0)
+            {
+                std::fill(out - cn, out, 0);
+            }
+            addColumns(out - stride, &rowSums[(size_t)y * width], out, i0, i1);
+        }
+    });
+}
+
+/**
+ * @brief Create an empty integral image.
+ */
+IntegralImage::IntegralImage() : cn(1), wideTable(false), squaresBuilt(false)
+{
+}
+
+/**
+ * @brief Build the tables of an image.
+ *
+ * The sums are kept in 32 bits when rows * cols * 255 fits, which holds up to about 8 million pixels, so a 4K frame
+ * still gets the narrow table. The row pass always sums in 32 bits, since one row of squares fits for images up to
+ * 33024 pixels wide, and the column pass widens the squares to 64 bits.
+ *
+ * @param src The 8-bit source image with 1 to 4 channels.
+ * @param squares Whether to also build the table of squared values, needed by squareSum and variance.
+ * @param wide Whether to keep the sums in 64 bits even when 32 bits are enough.
+ * @return 0 if successful, -1 if error.
+ */
+int IntegralImage::build(cv::Mat &src, bool squares, bool wide)
+{
+    imageSize = cv::Size();
+    squaresBuilt = false;
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (src.depth() != CV_8U || src.channels() > 4)
+    {
+        printf("Expected an 8-bit image with 1 to 4 channels\n");
+        return -1;
+    }
+
+    if (squares && src.cols > INT32_MAX / (255 * 255))
+    {
+        printf("Expected an image at most %d pixels wide\n", INT32_MAX / (255 * 255));
+        return -1;
+    }
+
+    cn = src.channels();
+    wideTable = wide || (int64_t)src.rows * src.cols * 255 > INT32_MAX;
+    size_t tableSize = (size_t)(src.rows + 1) * (src.cols + 1) * cn;
+    size_t rowSumsSize = (size_t)src.rows * src.cols * cn;
+
+    // The buffers only grow, so rebuilding for frames of the same size does not allocate
+    if (rowSums.size() < rowSumsSize)
+    {
+        rowSums.resize(rowSumsSize);
+    }
+    if (wideTable)
+    {
+        if (wideSums.size() < tableSize)
+        {
+            wideSums.resize(tableSize);
+        }
+        buildTable(src, false, rowSums, wideSums);
+    }
+    else
+    {
+        if (narrowSums.size() < tableSize)
+        {
+            narrowSums.resize(tableSize);
+        }
+        buildTable(src, false, rowSums, narrowSums);
+    }
+    if (squares)
+    {
+        if (squareSums.size() < tableSize)
+        {
+            squareSums.resize(tableSize);
+        }
+        buildTable(src, true, rowSums, squareSums);
+    }
+
+    imageSize = src.size();
+    squaresBuilt = squares;
+    return 0;
+}
+
+/**
+ * @brief Get the size of the image the tables were built from.
+ *
+ * @return The image size, empty before the first build.
+ */
+cv::Size IntegralImage::size() const
+{
+    return imageSize;
+}
+
+/**
+ * @brief Get the number of channels of the image the tables were built from.
+ *
+ * @return The number of channels.
+ */
+int IntegralImage::channels() const
+{
+    return cn;
+}
+
+/**
+ * @brief Check whether the sums are kept in 64 bits.
+ *
+ * @return true for 64-bit sums, false for 32-bit sums.
+ */
+bool IntegralImage::isWide() const
+{
+    return wideTable;
+}
+
+/**
+ * @brief Check whether the table of squared values was built.
+ *
+ * @return true if squareSum and variance can be used.
+ */
+bool IntegralImage::hasSquares() const
+{
+    return squaresBuilt;
+}
+
+/**
+ * @brief Clip a rectangle to the image and get the table offsets of its four corners for a channel.
+ *
+ * @param rect The rectangle.
+ * @param channel The channel.
+ * @param offsets The offsets of the top left, top right, bottom left and bottom right corners.
+ * @return The number of pixels in the clipped rectangle, 0 if it is empty or the channel does not exist.
+ */
+int IntegralImage::corners(const cv::Rect &rect, int channel, size_t offsets[4]) const
+{
+    cv::Rect clipped = rect & cv::Rect(0, 0, imageSize.width, imageSize.height);
+    if (clipped.width <= 0 || clipped.height <= 0 || channel < 0 || channel >= cn)
+    {
+        return 0;
+    }
+
+    size_t stride = (size_t)(imageSize.width + 1) * cn;
+    size_t top = clipped.y * stride + channel;
+    size_t bottom = (clipped.y + clipped.height) * stride + channel;
+    size_t left = (size_t)clipped.x * cn;
+    size_t right = (size_t)(clipped.x + clipped.width) * cn;
+    offsets[0] = top + left;
+    offsets[1] = top + right;
+    offsets[2] = bottom + left;
+    offsets[3] = bottom + right;
+    return clipped.width * clipped.height;
+}
+
+/**
+ * @brief Get the sum of one channel over a rectangle.
+ *
+ * @param rect The rectangle, clipped to the image.
+ * @param channel The channel.
+ * @return The sum, 0 for a rectangle outside the image.
+ */
+int64_t IntegralImage::sum(const cv::Rect &rect, int channel) const
+{
+    size_t offsets[4];
+    if (corners(rect, channel, offsets) == 0)
+    {
+        return 0;
+    }
+
+    if (wideTable)
+    {
+        return wideSums[offsets[3]] - wideSums[offsets[1]] - wideSums[offsets[2]] + wideSums[offsets[0]];
+    }
+    return (int64_t)narrowSums[offsets[3]] - narrowSums[offsets[1]] - narrowSums[offsets[2]] + narrowSums[offsets[0]];
+}
+
+/**
+ * @brief Get the sum of the squares of one channel over a rectangle.
+ *
+ * @param rect The rectangle, clipped to the image.
+ * @param channel The channel.
+ * @return The sum of squares, 0 for a rectangle outside the image or if the squares were not built.
+ */
+int64_t IntegralImage::squareSum(const cv::Rect &rect, int channel) const
+{
+    size_t offsets[4];
+    if (!squaresBuilt || corners(rect, channel, offsets) == 0)
+    {
+        return 0;
+    }
+
+    return squareSums[offsets[3]] - squareSums[offsets[1]] - squareSums[offsets[2]] + squareSums[offsets[0]];
+}
+
+/**
+ * @brief Get the mean of one channel over a rectangle.
+ *
+ * @param rect The rectangle, clipped to the image.
+ * @param channel The channel.
+ * @return The mean, 0 for a rectangle outside the image.
+ */
+double IntegralImage::mean(const cv::Rect &rect, int channel) const
+{
+    size_t offsets[4];
+    int area = corners(rect, channel, offsets);
+    return area > 0 ? (double)sum(rect, channel) / area : 0.0;
+}
+
+/**
+ * @brief Get the variance of one channel over a rectangle.
+ *
+ * Computed as the mean of the squares less the square of the mean, clamped to 0 against rounding.
+ *
+ * @param rect The rectangle, clipped to the image.
+ * @param channel The channel.
+ * @return The variance, 0 for a rectangle outside the image or if the squares were not built.
+ */
+double IntegralImage::variance(const cv::Rect &rect, int channel) const
+{
+    size_t offsets[4];
+    int area = corners(rect, channel, offsets);
+    if (!squaresBuilt || area == 0)
+    {
+        return 0.0;
+    }
+
+    double mean = (double)sum(rect, channel) / area;
+    return std::max((double)squareSum(rect, channel) / area - mean * mean, 0.0);
+}
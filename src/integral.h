@@ -0,0 +1,123 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Integral images (summed-area tables) of 8-bit images, with constant-time rectangle sums for box filters,
+// local statistics and Haar-like features.
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <vector>
+
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+/**
+ * @brief The integral image of an 8-bit image, and optionally of its squares.
+ *
+ * Entry (y, x) of the table holds the sum of the pixels above and to the left of pixel (y, x), per channel, so the
+ * table has one more row and column than the image and the sum over any rectangle takes four reads. The sums are kept
+ * in 32 bits when no sum of the image can overflow them and in 64 bits otherwise, and the squared sums always in 64
+ * bits. The table is built in two passes: prefix sums along each row, vectorized with SSE4.1 and run in parallel over
+ * rows, then a running sum down the columns, vectorized with SSE4.1 or AVX2 and run in parallel over column strips.
+ * The tables keep their buffers between builds, so rebuilding one for every frame of a video does not allocate.
+ */
+class IntegralImage
+{
+  public:
+    /**
+     * @brief Create an empty integral image.
+     */
+    IntegralImage();
+
+    /**
+     * @brief Build the tables of an image.
+     *
+     * @param src The 8-bit source image with 1 to 4 channels.
+     * @param squares Whether to also build the table of squared values, needed by squareSum and variance.
+     * @param wide Whether to keep the sums in 64 bits even when 32 bits are enough.
+     * @return 0 if successful, -1 if error.
+     */
+    int build(cv::Mat &src, bool squares = false, bool wide = false);
+
+    /**
+     * @brief Get the size of the image the tables were built from.
+     *
+     * @return The image size, empty before the first build.
+     */
+    cv::Size size() const;
+
+    /**
+     * @brief Get the number of channels of the image the tables were built from.
+     *
+     * @return The number of channels.
+     */
+    int channels() const;
+
+    /**
+     * @brief Check whether the sums are kept in 64 bits.
+     *
+     * @return true for 64-bit sums, false for 32-bit sums.
+     */
+    bool isWide() const;
+
+    /**
+     * @brief Check whether the table of squared values was built.
+     *
+     * @return true if squareSum and variance can be used.
+     */
+    bool hasSquares() const;
+
+    /**
+     * @brief Get the sum of one channel over a rectangle.
+     *
+     * @param rect The rectangle, clipped to the image.
+     * @param channel The channel.
+     * @return The sum, 0 for a rectangle outside the image.
+     */
+    int64_t sum(const cv::Rect &rect, int channel = 0) const;
+
+    /**
+     * @brief Get the sum of the squares of one channel over a rectangle.
+     *
+     * @param rect The rectangle, clipped to the image.
+     * @param channel The channel.
+     * @return The sum of squares, 0 for a rectangle outside the image or if the squares were not built.
+     */
+    int64_t squareSum(const cv::Rect &rect, int channel = 0) const;
+
+    /**
+     * @brief Get the mean of one channel over a rectangle.
+     *
+     * @param rect The rectangle, clipped to the image.
+     * @param channel The channel.
+     * @return The mean, 0 for a rectangle outside the image.
+     */
+    double mean(const cv::Rect &rect, int channel = 0) const;
+
+    /**
+     * @brief Get the variance of one channel over a rectangle.
+     *
+     * @param rect The rectangle, clipped to the image.
+     * @param channel The channel.
+     * @return The variance, 0 for a rectangle outside the image or if the squares were not built.
+     */
+    double variance(const cv::Rect &rect, int channel = 0) const;
+
+  private:
+    /**
+     * @brief Clip a rectangle to the image and get the table offsets of its four corners for a channel.
+     *
+     * @return The number of pixels in the clipped rectangle, 0 if it is empty.
+     */
+    int corners(const cv::Rect &rect, int channel, size_t offsets[4]) const;
+
+    std::vector<int32_t> narrowSums;  // the sums when they fit in 32 bits
+    std::vector<int64_t> wideSums;    // the sums when they do not
+    std::vector<int64_t> squareSums;  // the squared sums, when built
+    std::vector<int32_t> rowSums;     // prefix sums of each row, the first pass of a build
+    cv::Size imageSize;
+    int cn;
+    bool wideTable;
+    bool squaresBuilt;
+};
+
+#endif
@@ -0,0 +1,70 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Compile-time properties of the pixel depths the templated filter kernels run on.
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+#ifndef PIXEL_TRAITS_H
+#define PIXEL_TRAITS_H
+
+/**
+ * @brief Types and constants of one pixel depth.
+ *
+ * Each kernel templated on the pixel type T reads its accumulators from here, so the widths are fixed at compile time
+ * and chosen per depth to hold the largest sum the kernel can produce:
+ *
+ * - Gradient holds a 3x3 Sobel gradient, up to 4 times the largest pixel value either way.
+ * - Real holds the products behind a gradient magnitude or a color matrix. It is a double for 16-bit pixels, where the
+ *   square of an 18-bit gradient overflows 32 bits, and stays a float for float pixels.
+ *
+ * MAX is the largest pixel value, used to size the integer sums. Float images are taken to hold values in [0, 1].
+ */
+template <typename T> struct PixelTraits;
+
+template <> struct PixelTraits<uchar>
+{
+    typedef short Gradient;
+    typedef float Real;
+    static const int DEPTH = CV_8U;
+    static const int GRADIENT_DEPTH = CV_16S;
+    static const int64_t MAX = 255;
+
+    /**
+     * @brief Scale of a value given in 8-bit units, such as a color matrix offset, in this depth.
+     */
+    static Real unit()
+    {
+        return 1.0f;
+    }
+};
+
+template <> struct PixelTraits<ushort>
+{
+    typedef int Gradient;
+    typedef double Real;
+    static const int DEPTH = CV_16U;
+    static const int GRADIENT_DEPTH = CV_32S;
+    static const int64_t MAX = 65535;
+
+    static Real unit()
+    {
+        return 65535.0 / 255.0;
+    }
+};
+
+template <> struct PixelTraits<float>
+{
+    typedef float Gradient;
+    typedef float Real;
+    static const int DEPTH = CV_32F;
+    static const int GRADIENT_DEPTH = CV_32F;
+    static const int64_t MAX = 1;
+
+    static Real unit()
+    {
+        return 1.0f / 255.0f;
+    }
+};
+
+#endif
@@ -0,0 +1,96 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Gaussian pyramids built with the fused blur-and-decimate filter, shared between the stages that need
+// smaller copies of a frame.
+
+#include "pyramid.h"
+#include <cstdio>
+
+/**
+ * @brief Create an empty pyramid.
+ */
+GaussianPyramid::GaussianPyramid() : count(0)
+{
+}
+
+/**
+ * @brief Build the levels of the pyramid from an image.
+ *
+ * @param src The 8-bit source image with 1 to 4 channels, which becomes level 0 without being copied.
+ * @param levels The number of levels, including level 0.
+ * @param borderType How pixels outside each level are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE or
+ * cv::BORDER_CONSTANT (zero).
+ * @param ctx Optional context that provides the scratch buffers, so repeated builds do not allocate.
+ * @return 0 if successful, -1 if error.
+ */
+int GaussianPyramid::build(cv::Mat &src, int levels, int borderType, FilterContext *ctx)
+{
+    count = 0;
+    if (src.empty())
+    {
+        printf("Frame is empty\n");
+        return -1;
+    }
+
+    if (levels < 1)
+    {
+        printf("Expected at least one level\n");
+        return -1;
+    }
+
+    if ((int)images.size() < levels)
+    {
+        images.resize(levels);
+    }
+
+    images[0] = src;
+    for (int i = 1; i < levels; i++)
+    {
+        if (pyrDown5x5(images[i - 1], images[i], borderType, ctx) != 0)
+        {
+            return -1;
+        }
+    }
+
+    count = levels;
+    return 0;
+}
+
+/**
+ * @brief Get the number of levels built.
+ *
+ * @return The number of levels, 0 before the first build.
+ */
+int GaussianPyramid::levels() const
+{
+    return count;
+}
+
+/**
+ * @brief Get one level of the pyramid.
+ *
+ * @param index The level, from 0 (the source image) to levels() - 1. Level i is (cols + 2^i - 1) / 2^i pixels wide.
+ * @return The level image. It stays valid until the next build.
+ */
+cv::Mat &GaussianPyramid::level(int index)
+{
+    return images[index];
+}
+
+/**
+ * @brief Get the number of levels a pyramid needs to reach the smallest size still at least minWidth wide.
+ *
+ * @param width The width of level 0.
+ * @param minWidth The smallest width a level may have.
+ * @return The number of levels, at least 1.
+ */
+int GaussianPyramid::levelCount(int width, int minWidth)
+{
+    int levels = 1;
+    while (width > 1 && (width + 1) / 2 >= minWidth)
+    {
+        width = (width + 1) / 2;
+        levels++;
+    }
+    return levels;
+}
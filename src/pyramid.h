@@ -0,0 +1,72 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Gaussian pyramids built with the fused blur-and-decimate filter, shared between the stages that need
+// smaller copies of a frame.
+
+#include <opencv2/core.hpp>
+#include <vector>
+
+#include "filter.h"
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+/**
+ * @brief A Gaussian pyramid: an image and successively halved copies of it.
+ *
+ * Level 0 is the source image itself and each further level is built from the one above by pyrDown5x5, which blurs
+ * with the 1-2-4-2-1 kernel of blur5x5_5 and keeps every other row and column in one pass. Face detection, preview
+ * downscaling and multi-scale effects can then read the level they need from one pyramid instead of each resizing
+ * the frame. The levels keep their buffers between builds, so rebuilding a pyramid for every frame of a video does
+ * not allocate.
+ */
+class GaussianPyramid
+{
+  public:
+    /**
+     * @brief Create an empty pyramid.
+     */
+    GaussianPyramid();
+
+    /**
+     * @brief Build the levels of the pyramid from an image.
+     *
+     * @param src The 8-bit source image with 1 to 4 channels, which becomes level 0 without being copied.
+     * @param levels The number of levels, including level 0.
+     * @param borderType How pixels outside each level are read: cv::BORDER_REFLECT_101 (default), cv::BORDER_REPLICATE
+     * or cv::BORDER_CONSTANT (zero).
+     * @param ctx Optional context that provides the scratch buffers, so repeated builds do not allocate.
+     * @return 0 if successful, -1 if error.
+     */
+    int build(cv::Mat &src, int levels, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL);
+
+    /**
+     * @brief Get the number of levels built.
+     *
+     * @return The number of levels, 0 before the first build.
+     */
+    int levels() const;
+
+    /**
+     * @brief Get one level of the pyramid.
+     *
+     * @param index The level, from 0 (the source image) to levels() - 1. Level i is (cols + 2^i - 1) / 2^i pixels wide.
+     * @return The level image. It stays valid until the next build.
+     */
+    cv::Mat &level(int index);
+
+    /**
+     * @brief Get the number of levels a pyramid needs to reach the smallest size still at least minWidth wide.
+     *
+     * @param width The width of level 0.
+     * @param minWidth The smallest width a level may have.
+     * @return The number of levels, at least 1.
+     */
+    static int levelCount(int width, int minWidth);
+
+  private:
+    std::vector<cv::Mat> images; // the levels, kept allocated when a later build uses fewer
+    int count;
+};
+
+#endif
@@ -0,0 +1,422 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Compile-time separable convolution for small integer kernels.
+
+#include <algorithm>
+#include <cstring>
+#include <opencv2/core.hpp>
+#include <type_traits>
+
+#include "filter.h"
+#include "pixelTraits.h"
+
+#ifndef SEPARABLE_FILTER_H
+#define SEPARABLE_FILTER_H
+
+/**
+ * @brief Check that a border mode is one the filter kernels implement.
+ *
+ * @param borderType The OpenCV border mode.
+ * @return true for cv::BORDER_REPLICATE, cv::BORDER_REFLECT_101 and cv::BORDER_CONSTANT.
+ */
+inline bool isBorderSupported(int borderType)
+{
+    return borderType == cv::BORDER_REPLICATE || borderType == cv::BORDER_REFLECT_101 ||
+           borderType == cv::BORDER_CONSTANT;
+}
+
+/**
+ * @brief Map a pixel index that may fall outside [0, len) back into the image.
+ *
+ * Indexes inside the image are returned without a call into OpenCV, so the edge loops stay cheap.
+ *
+ * @param p The pixel index.
+ * @param len The image size along that axis.
+ * @param borderType The OpenCV border mode.
+ * @return The source index, or -1 for a cv::BORDER_CONSTANT pixel, which reads as 0.
+ */
+inline int borderIndex(int p, int len, int borderType)
+{
+    return (unsigned)p < (unsigned)len ? p : cv::borderInterpolate(p, len, borderType);
+}
+
+/**
+ * @brief Get a scratch image from a context, or allocate it in local when there is no context.
+ *
+ * @param ctx The context, or NULL.
+ * @param slot The context scratch slot.
+ * @param rows The number of rows.
+ * @param cols The number of columns.
+ * @param type The OpenCV type.
+ * @param local The image to allocate when ctx is NULL. Must outlive the returned reference.
+ * @return The scratch image.
+ */
+inline cv::Mat &scratchImage(FilterContext *ctx, int slot, int rows, int cols, int type, cv::Mat &local)
+{
+    if (ctx != NULL)
+    {
+        return ctx->scratch(slot, rows, cols, type);
+    }
+    local.create(rows, cols, type);
+    return local;
+}
+
+/**
+ * @brief Get the image a stencil filter should read from.
+ *
+ * Stencil filters read rows owned by other bands, so an in-place call works on a copy of the source, kept in the
+ * context when there is one.
+ *
+ * @param src The source image.
+ * @param dst The destination image.
+ * @param ctx The context, or NULL.
+ * @return src itself, or a copy of it when src and dst share memory.
+ */
+inline cv::Mat stencilInput(cv::Mat &src, cv::Mat &dst, FilterContext *ctx)
+{
+    if (src.data != dst.data)
+    {
+        return src;
+    }
+
+    cv::Mat local;
+    cv::Mat &copy = scratchImage(ctx, FilterContext::SCRATCH_INPUT, src.rows, src.cols, src.type(), local);
+    src.copyTo(copy);
+    return copy;
+}
+
+/**
+ * @brief Fully unrolled dot product of the taps with samples step elements apart.
+ *
+ * Each tap is a template argument, so the recursion inlines into a fixed sequence of multiplies by constants.
+ */
+template <int Index, int... Taps> struct SeparableTaps;
+
+template <int Index> struct SeparableTaps<Index>
+{
+    static const int sum = 0;
+    static const int absSum = 0;
+    static const bool nonNegative = true;
+
+    template <typename Acc, typename T> static inline Acc dot(const T *, int)
+    {
+        return 0;
+    }
+};
+
+template <int Index, int Tap, int... Rest> struct SeparableTaps<Index, Tap, Rest...>
+{
+    typedef SeparableTaps<Index + 1, Rest...> Next;
+
+    static const int sum = Tap + Next::sum;
+    static const int absSum = (Tap < 0 ? -Tap : Tap) + Next::absSum;
+    static const bool nonNegative = Tap >= 0 && Next::nonNegative;
+
+    template <typename Acc, typename T> static inline Acc dot(const T *p, int step)
+    {
+        return Tap * static_cast<Acc>(p[Index * step]) + Next::template dot<Acc>(p, step);
+    }
+};
+
+/**
+ * @brief Separable 2D convolution with a small integer kernel fixed at compile time.
+ *
+ * The 2D kernel is the outer product of Taps with itself. The horizontal pass keeps full precision in a 16-bit buffer
+ * (32-bit when the sums might not fit), and the vertical pass divides once by the kernel sum. That division is by a
+ * compile-time constant, so it compiles to a shift when the sum is a power of two and to a multiply and shift
+ * otherwise. Results match the direct 2D convolution of the border-extended image with a truncating division exactly.
+ *
+ * Both passes run over whole rows as flat arrays, so the same code handles any channel count and the inner loops have
+ * no branches for the compiler to trip over when vectorizing. Where the kernel hangs over the edge of the image,
+ * separate edge loops read the missing pixels according to the border mode.
+ *
+ * The passes are templated on the pixel type, so 8-bit, 16-bit and float images each get their own loops. The sums are
+ * sized for the depth by Accumulator, so the 8-bit loops are the same as before and 16-bit images do not overflow.
+ *
+ * When the sums of the whole image would not fit in the budget set by setFilterTileCache, the image is filtered in
+ * cache-sized tiles instead, each running both passes before moving on. An in-place call then works from a copy of
+ * the source, since the tiles read halo pixels that neighbouring tiles overwrite.
+ *
+ * Adding a kernel takes one line, e.g. typedef SeparableFilter<1, 6, 15, 20, 15, 6, 1> Binomial7x7Filter;
+ */
+template <int... Taps> class SeparableFilter
+{
+    typedef SeparableTaps<0, Taps...> Kernel;
+
+  public:
+    static const int SIZE = sizeof...(Taps);
+    static const int RADIUS = SIZE / 2;
+    static const int SUM = Kernel::sum;
+
+    static_assert(SIZE % 2 == 1, "SeparableFilter needs an odd number of taps");
+    static_assert(SUM > 0, "SeparableFilter needs taps with a positive sum");
+
+    /**
+     * @brief Accumulator types for pixels of type T.
+     *
+     * Sum holds a horizontal sum and is stored in the scratch rows: 16-bit when the sums of non-negative taps over
+     * 8-bit pixels fit (a tap sum up to 257), 32-bit for other integer sums and float for float pixels. Acc holds a 2D
+     * sum, 64-bit when the product of a 16-bit pixel with both tap sums would overflow 32 bits.
+     */
+    template <typename T> struct Accumulator
+    {
+        static const bool isFloat = std::is_floating_point<T>::value;
+        static const int64_t MAX_SUM = PixelTraits<T>::MAX * Kernel::absSum;
+
+        typedef typename std::conditional<
+            isFloat, float,
+            typename std::conditional<Kernel::nonNegative && MAX_SUM <= 65535, ushort, int>::type>::type Sum;
+        typedef typename std::conditional<isFloat, float,
+                                          typename std::conditional<MAX_SUM * Kernel::absSum <= INT32_MAX, int,
+                                                                    int64_t>::type>::type Acc;
+
+        static const int SUM_DEPTH = isFloat ? CV_32F : sizeof(Sum) == sizeof(ushort) ? CV_16U : CV_32S;
+
+        static_assert(isFloat || MAX_SUM <= INT32_MAX, "SeparableFilter horizontal sums must fit in 32 bits");
+    };
+
+    /**
+     * @brief Filter an 8-bit, 16-bit or float image.
+     *
+     * @param src The source image.
+     * @param dst The destination image. May be the same as src.
+     * @param borderType How pixels outside the image are read: cv::BORDER_REFLECT_101, cv::BORDER_REPLICATE or
+     * cv::BORDER_CONSTANT (zero).
+     * @param ctx Optional context that provides the scratch buffers, so repeated calls do not allocate.
+     * @return 0 if successful, -1 if error.
+     */
+    static int apply(cv::Mat &src, cv::Mat &dst, int borderType = cv::BORDER_REFLECT_101, FilterContext *ctx = NULL)
+    {
+        if (src.empty())
+        {
+            printf("Frame is empty\n");
+            return -1;
+        }
+
+        if (!isBorderSupported(borderType))
+        {
+            printf("Unsupported border type\n");
+            return -1;
+        }
+
+        switch (src.depth())
+        {
+        case CV_8U:
+            return applyDepth<uchar>(src, dst, borderType, ctx);
+        case CV_16U:
+            return applyDepth<ushort>(src, dst, borderType, ctx);
+        case CV_32F:
+            return applyDepth<float>(src, dst, borderType, ctx);
+        default:
+            printf("Expected an 8-bit, 16-bit or float image\n");
+            return -1;
+        }
+    }
+
+  private:
+    // Output rows a tile aims for, so the halo rows it recomputes stay a small fraction of its work
+    static const int TILE_ROWS = 64;
+
+    /**
+     * @brief Filter an image with pixels of type T, whole rows at a time or in tiles.
+     */
+    template <typename T> static int applyDepth(cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+    {
+        typedef typename Accumulator<T>::Sum Sum;
+        typedef typename Accumulator<T>::Acc Acc;
+
+        // Tile the image when the sums of the whole image would not fit in the cache budget
+        dst.create(src.size(), src.type());
+        size_t tempBytes = (size_t)(src.rows + 1) * src.cols * src.channels() * sizeof(Sum);
+        if (getFilterTileCache() > 0 && tempBytes > (size_t)getFilterTileCache())
+        {
+            cv::Mat input = stencilInput(src, dst, ctx);
+            applyTiled<T>(input, dst, borderType, ctx);
+            return 0;
+        }
+
+        int rows = src.rows;
+        int cn = src.channels();
+        int width = src.cols * cn; // row length in values
+
+        // Horizontal pass over every row, plus a zero row read for a constant border. The vertical pass only reads
+        // temp, so src and dst may be the same image.
+        cv::Mat local;
+        cv::Mat &temp =
+            scratchImage(ctx, FilterContext::SCRATCH_TEMP, rows + 1, width, Accumulator<T>::SUM_DEPTH, local);
+        memset(temp.ptr<Sum>(rows), 0, width * sizeof(Sum));
+        parallelRows(0, rows, [&](int y0, int y1) {
+            for (int y = y0; y < y1; y++)
+            {
+                horizontalRow(src.ptr<T>(y), temp.ptr<Sum>(y), 0, src.cols, src.cols, cn, borderType);
+            }
+        });
+
+        // Vertical pass. Rows outside the image are mirrored or replicated, or read from the zero row.
+        parallelRows(0, rows, [&](int y0, int y1) {
+            const int taps[SIZE] = {Taps...};
+            int step = static_cast<int>(temp.step1());
+            for (int y = y0; y < y1; y++)
+            {
+                T *ptrDst = dst.ptr<T>(y);
+
+                if (y >= RADIUS && y < rows - RADIUS)
+                {
+                    verticalRow(temp.ptr<Sum>(y - RADIUS), ptrDst, width, step);
+                    continue;
+                }
+
+                const Sum *window[SIZE];
+                for (int k = 0; k < SIZE; k++)
+                {
+                    int row = borderIndex(y + k - RADIUS, rows, borderType);
+                    window[k] = temp.ptr<Sum>(row < 0 ? rows : row);
+                }
+                for (int i = 0; i < width; i++)
+                {
+                    Acc sum = 0;
+                    for (int k = 0; k < SIZE; k++)
+                    {
+                        sum += taps[k] * static_cast<Acc>(window[k][i]);
+                    }
+                    ptrDst[i] = cv::saturate_cast<T>(sum / (SUM * SUM));
+                }
+            }
+        });
+
+        return 0;
+    }
+
+    /**
+     * @brief Filter an image tile by tile, with tiles sized to the cache budget set by setFilterTileCache.
+     *
+     * A tile first runs the horizontal pass over its rows plus RADIUS halo rows above and below, then the vertical
+     * pass over the resulting sums, so the sums never leave the cache. Halo rows outside the image are mapped by the
+     * border mode when the sums are computed, which leaves the vertical pass without edge cases. The tiles are
+     * written in place of dst, so src must not share memory with it.
+     */
+    template <typename T> static void applyTiled(const cv::Mat &src, cv::Mat &dst, int borderType, FilterContext *ctx)
+    {
+        typedef typename Accumulator<T>::Sum Sum;
+
+        int rows = src.rows;
+        int cn = src.channels();
+        int pixelBytes = static_cast<int>((sizeof(Sum) + 2 * sizeof(T)) * cn); // sums, source and output per pixel
+        int tileCache = getFilterTileCache();
+        int tileCols = std::min(src.cols, std::max(tileCache / (pixelBytes * (TILE_ROWS + 2 * RADIUS)), 16));
+        int tileRows = std::max(tileCache / (pixelBytes * tileCols) - 2 * RADIUS, 1);
+        int bands = rowBandCount(rows);
+
+        cv::Mat local;
+        cv::Mat &temp = scratchImage(ctx, FilterContext::SCRATCH_TEMP, bands * (tileRows + 2 * RADIUS), tileCols * cn,
+                                     Accumulator<T>::SUM_DEPTH, local);
+        int step = static_cast<int>(temp.step1());
+
+        parallelRows(0, rows, [&](int y0, int y1) {
+            int base = rowBandIndex(0, rows, bands, y0) * (tileRows + 2 * RADIUS); // this band's rows of temp
+            for (int ty0 = y0; ty0 < y1; ty0 += tileRows)
+            {
+                int ty1 = std::min(ty0 + tileRows, y1);
+                for (int tx0 = 0; tx0 < src.cols; tx0 += tileCols)
+                {
+                    int tx1 = std::min(tx0 + tileCols, src.cols);
+
+                    for (int j = 0; j < ty1 - ty0 + 2 * RADIUS; j++)
+                    {
+                        Sum *ptrTemp = temp.ptr<Sum>(base + j);
+                        int row = borderIndex(ty0 + j - RADIUS, rows, borderType);
+                        if (row < 0)
+                        {
+                            memset(ptrTemp, 0, (tx1 - tx0) * cn * sizeof(Sum));
+                            continue;
+                        }
+                        horizontalRow(src.ptr<T>(row), ptrTemp, tx0, tx1, src.cols, cn, borderType);
+                    }
+
+                    for (int y = ty0; y < ty1; y++)
+                    {
+                        verticalRow(temp.ptr<Sum>(base + y - ty0), dst.ptr<T>(y) + tx0 * cn, (tx1 - tx0) * cn, step);
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief Vertical pass over one output row, given the top row of its window of sums.
+     */
+    template <typename T, typename Sum> static void verticalRow(const Sum *top, T *dst, int width, int step)
+    {
+        typedef typename Accumulator<T>::Acc Acc;
+        for (int i = 0; i < width; i++)
+        {
+            dst[i] = cv::saturate_cast<T>(Kernel::template dot<Acc>(top + i, step) / (SUM * SUM));
+        }
+    }
+
+    /**
+     * @brief Unnormalized horizontal pass over the pixels [x0, x1) of a row, including the pixels where the kernel
+     * hangs over the edge. dst[0] holds the first channel of pixel x0.
+     */
+    template <typename T, typename Sum>
+    static void horizontalRow(const T *src, Sum *dst, int x0, int x1, int cols, int cn, int borderType)
+    {
+        typedef typename Accumulator<T>::Acc Acc;
+
+        int left = std::min(std::max(RADIUS, x0), x1);           // first pixel the kernel fits over
+        int right = std::max(std::min(cols - RADIUS, x1), left); // first pixel past the ones it fits over
+
+        for (int i = left * cn; i < right * cn; i++)
+        {
+            dst[i - x0 * cn] = static_cast<Sum>(Kernel::template dot<Acc>(src + i - RADIUS * cn, cn));
+        }
+
+        for (int x = x0; x < left; x++)
+        {
+            edgePixel(src, dst + (x - x0) * cn, x, cols, cn, borderType);
+        }
+        for (int x = right; x < x1; x++)
+        {
+            edgePixel(src, dst + (x - x0) * cn, x, cols, cn, borderType);
+        }
+    }
+
+    /**
+     * @brief Unnormalized horizontal sum at one pixel near the edge, reading outside pixels by the border mode.
+     * Writes the cn sums of pixel x to dst.
+     */
+    template <typename T, typename Sum>
+    static void edgePixel(const T *src, Sum *dst, int x, int cols, int cn, int borderType)
+    {
+        typedef typename Accumulator<T>::Acc Acc;
+
+        const int taps[SIZE] = {Taps...};
+        for (int c = 0; c < cn; c++)
+        {
+            Acc sum = 0;
+            for (int k = 0; k < SIZE; k++)
+            {
+                int col = borderIndex(x + k - RADIUS, cols, borderType);
+                if (col >= 0)
+                {
+                    sum += taps[k] * static_cast<Acc>(src[col * cn + c]);
+                }
+            }
+            dst[c] = static_cast<Sum>(sum);
+        }
+    }
+};
+
+// Definitions of the constants that are bound to references, e.g. by std::max, which C++11 needs outside the class
+template <int... Taps> const int SeparableFilter<Taps...>::SIZE;
+template <int... Taps> const int SeparableFilter<Taps...>::RADIUS;
+template <int... Taps> const int SeparableFilter<Taps...>::SUM;
+template <int... Taps> const int SeparableFilter<Taps...>::TILE_ROWS;
+
+// Kernels used by the filters
+typedef SeparableFilter<1, 2, 1> Gauss3x3Filter;
+typedef SeparableFilter<1, 2, 4, 2, 1> Gauss5x5Filter;
+typedef SeparableFilter<1, 4, 6, 4, 1> Binomial5x5Filter;
+typedef SeparableFilter<1, 6, 15, 20, 15, 6, 1> Binomial7x7Filter;
+
+#endif
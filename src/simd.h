@@ -0,0 +1,45 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Runtime CPU feature dispatch for the SIMD filter kernels.
+
+#include <opencv2/core.hpp>
+
+#ifndef SIMD_H
+#define SIMD_H
+
+// The SIMD kernels are written with x86 intrinsics and compiled per function with a target attribute, so a single
+// binary carries every code path and picks one at runtime. Other architectures only get the scalar kernels.
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/**
+ * @brief Instruction set levels the filter kernels can dispatch to.
+ */
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE41 = 1,
+    SIMD_AVX2 = 2
+};
+
+/**
+ * @brief Get the best instruction set level supported by this CPU.
+ *
+ * The level is detected once through OpenCV, so setting OPENCV_CPU_DISABLE=AVX2 (or SSE4_1) in the environment
+ * forces a lower path for testing.
+ *
+ * @return The detected SIMD level.
+ */
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = cv::checkHardwareSupport(CV_CPU_AVX2)     ? SIMD_AVX2
+                                   : cv::checkHardwareSupport(CV_CPU_SSE4_1) ? SIMD_SSE41
+                                                                             : SIMD_SCALAR;
+    return level;
+}
+
+#endif
@@ -14,14 +14,7 @@
 #include <cstring> // C/C++ functions for working with strings
 #include <sys/time.h>
 
-#include "filter.h"
-
-// prototypes for the functions to test
-int blur5x5_1(cv::Mat &src, cv::Mat &dst);
-int blur5x5_2(cv::Mat &src, cv::Mat &dst);
-int blur5x5_3(cv::Mat &src, cv::Mat &dst);
-int blur5x5_4(cv::Mat &src, cv::Mat &dst);
-int blur5x5_5(cv::Mat &src, cv::Mat &dst);
+#include "filter.h" // prototypes for the functions to test
 
 // returns a double which gives time in seconds
 double getTime()
@@ -32,6 +25,65 @@ double getTime()
     return (cur.tv_sec + cur.tv_usec / 1000000.0);
 }
 
+// times blur5x5_5 on a random frame with 1, 2, 4 and 8 filter threads and prints the speedup over 1 thread
+void timeThreads(int cols, int rows, int Ntimes)
+{
+    const int threadCounts[4] = {1, 2, 4, 8};
+    cv::Mat src(rows, cols, CV_8UC3);
+    cv::Mat dst;
+    FilterContext ctx; // keeps the scratch and output buffers across calls, so only the filter is timed
+    cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    printf("Thread scaling of blur5x5_5 at %dx%d, CPUs: %d\n", cols, rows, cv::getNumberOfCPUs());
+    double oneThread = 0.0;
+    for (int t = 0; t < 4; t++)
+    {
+        // the OpenCV pool and the filter bands both get the thread count
+        cv::setNumThreads(threadCounts[t]);
+        setFilterThreads(threadCounts[t]);
+        blur5x5_5(src, dst, cv::BORDER_REFLECT_101, &ctx); // warm up the pool at this size
+
+        double startTime = getTime();
+        for (int i = 0; i < Ntimes; i++)
+        {
+            blur5x5_5(src, dst, cv::BORDER_REFLECT_101, &ctx);
+        }
+        double difference = (getTime() - startTime) / Ntimes;
+        if (t == 0)
+        {
+            oneThread = difference;
+        }
+        printf("  %d threads: %.4lf seconds per image, speedup %.2f\n", threadCounts[t], difference,
+               oneThread / difference);
+    }
+
+    // back to the default thread counts
+    cv::setNumThreads(-1);
+    setFilterThreads(0);
+}
+
+// times medianFilter with the given radius on the image scaled to 720p, with all the filter threads, and prints the
+// frame rate against the 30 fps a live video needs
+void timeMedian(cv::Mat &src, int radius, int Ntimes)
+{
+    cv::Mat frame;
+    cv::Mat dst;
+    FilterContext ctx; // keeps the histograms across calls, so only the filter is timed
+    cv::resize(src, frame, cv::Size(1280, 720), 0, 0, cv::INTER_AREA);
+    medianFilter(frame, dst, radius, &ctx); // warm up the pool and the histograms
+
+    double startTime = getTime();
+    for (int i = 0; i < Ntimes; i++)
+    {
+        medianFilter(frame, dst, radius, &ctx);
+    }
+    double difference = (getTime() - startTime) / Ntimes;
+
+    printf("Median radius %d at %dx%d, %d threads: %.4lf seconds per image, %.1f fps (%s 30 fps)\n", radius,
+           frame.cols, frame.rows, getFilterThreads(), difference, 1.0 / difference,
+           difference <= 1.0 / 30.0 ? "at least" : "below");
+}
+
 // argc is # of command line parameters (including program name), argv is the array of strings
 // This executable is expecting the name of an image on the command line.
 
@@ -175,6 +227,16 @@ int main(int argc, char *argv[])
     printf("Time per image (5): %.4lf seconds\n", difference);
     printf("Total time (5): %.4lf seconds\n", endTime - startTime);
 
+    //////////////////////////////
+    // thread scaling of version 5 at 1080p and 4K
+    timeThreads(1920, 1080, Ntimes);
+    timeThreads(3840, 2160, Ntimes);
+
+    //////////////////////////////
+    // real-time check of the median filter at 720p, at the radius of vidDisplay's denoise key and at a large one
+    timeMedian(src, 2, Ntimes);
+    timeMedian(src, 15, Ntimes);
+
     // terminate the program
     printf("Terminating\n");
 
@@ -0,0 +1,121 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Time the one-pass cartoonize against the 5x5 blur it is built on.
+//
+// Usage: cartoon.exe [iterations] [image filename]
+//
+// Runs blur5x5_5 and cartoonize over random 1080p and 4K frames, or over the given image, with a filter context so
+// neither allocates, and prints the best time per frame of several rounds and the cost of cartoonize relative to the
+// blur. Each frame is timed on one thread, where the extra arithmetic of the edge test and quantization shows most,
+// and on all the filter threads, as vidDisplay runs it, where both filters share the memory bandwidth. The blur,
+// quantization and edge test are expected to cost at most CARTOON_TARGET times the blur alone.
+
+#include "opencv2/opencv.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "filter.h"
+
+// Largest cost of cartoonize relative to blur5x5_5
+static const double CARTOON_TARGET = 1.3;
+
+// Rounds each filter is timed over; the best round is reported, which leaves out most of the scheduling noise
+static const int ROUNDS = 15;
+
+// returns a double which gives time in seconds
+double getTime()
+{
+    struct timeval cur;
+
+    gettimeofday(&cur, NULL);
+    return (cur.tv_sec + cur.tv_usec / 1000000.0);
+}
+
+/**
+ * @brief Time blur5x5_5 and cartoonize over a frame and print their cost.
+ *
+ * @param src The source frame.
+ * @param threads The number of threads to run the filters on, or 0 for the default of all of them.
+ * @param iterations The number of frames per round.
+ * @param ctx The filter context the filters share.
+ */
+static void runFrame(cv::Mat &src, int threads, int iterations, FilterContext &ctx)
+{
+    cv::Mat dst;
+
+    // the OpenCV pool and the filter bands both get the thread count
+    cv::setNumThreads(threads > 0 ? threads : -1);
+    setFilterThreads(threads);
+
+    double blurTime = 1e9;
+    double cartoonTime = 1e9;
+
+    // warm up the thread pool and the scratch buffers
+    blur5x5_5(src, dst, cv::BORDER_REFLECT_101, &ctx);
+    cartoonize(src, dst, 10, 100, &ctx);
+
+    // The rounds alternate between the filters so that both see the same machine load
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        double startTime = getTime();
+        for (int i = 0; i < iterations; i++)
+        {
+            blur5x5_5(src, dst, cv::BORDER_REFLECT_101, &ctx);
+        }
+        blurTime = std::min(blurTime, (getTime() - startTime) / iterations);
+
+        startTime = getTime();
+        for (int i = 0; i < iterations; i++)
+        {
+            cartoonize(src, dst, 10, 100, &ctx);
+        }
+        cartoonTime = std::min(cartoonTime, (getTime() - startTime) / iterations);
+    }
+
+    double ratio = cartoonTime / blurTime;
+    printf("%dx%d, %d threads: blur5x5_5 %.3f ms, cartoonize %.3f ms, ratio %.2f (target %.2f) %s\n", src.cols,
+           src.rows, getFilterThreads(), 1000.0 * blurTime, 1000.0 * cartoonTime, ratio, CARTOON_TARGET,
+           ratio <= CARTOON_TARGET ? "ok" : "over");
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    if (iterations < 1)
+    {
+        printf("Usage %s [iterations] [image filename]\n", argv[0]);
+        exit(-1);
+    }
+
+    FilterContext ctx;
+    if (argc > 2)
+    {
+        cv::Mat src = cv::imread(argv[2]);
+        if (src.data == NULL)
+        {
+            printf("Unable to read image %s\n", argv[2]);
+            exit(-1);
+        }
+        runFrame(src, 1, iterations, ctx);
+        runFrame(src, 0, iterations, ctx);
+    }
+    else
+    {
+        // Random frames smoothed twice, so the quantization and edge test see image-like content
+        const int sizes[2][2] = {{1920, 1080}, {3840, 2160}};
+        for (int s = 0; s < 2; s++)
+        {
+            cv::Mat src(sizes[s][1], sizes[s][0], CV_8UC3);
+            cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+            blur5x5_5(src, src);
+            blur5x5_5(src, src);
+            runFrame(src, 1, iterations, ctx);
+            runFrame(src, 0, iterations, ctx);
+        }
+    }
+
+    printf("Terminating\n");
+    return (0);
+}
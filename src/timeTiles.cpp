@@ -0,0 +1,228 @@
+// Author: Kevin Heleodoro
+// Date: October 16, 2026
+// Purpose: Compare the cache behaviour of the row-major and tiled stencil filters at 4K and 8K.
+//
+// Usage: tiles.exe [iterations] [tile cache bytes]
+//
+// Runs blur5x5_4 and gauss3x3at over random 4K and 8K frames, once with the passes over whole rows and once in
+// cache-sized tiles, and prints the time per frame with the L1 data cache and last-level cache misses counted by the
+// Linux perf events. The counters read n/a where perf events are not available.
+
+#include "opencv2/opencv.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "filter.h"
+
+// returns a double which gives time in seconds
+double getTime()
+{
+    struct timeval cur;
+
+    gettimeofday(&cur, NULL);
+    return (cur.tv_sec + cur.tv_usec / 1000000.0);
+}
+
+/**
+ * @brief A hardware cache-miss counter for the calling process, on all its threads.
+ */
+class CacheCounter
+{
+  public:
+    /**
+     * @brief Open the counter.
+     *
+     * @param config The PERF_TYPE_HW_CACHE event config.
+     */
+    explicit CacheCounter(unsigned long long config) : fd(-1), error(ENOSYS)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1; // count the filter worker threads too
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        error = fd < 0 ? errno : 0;
+#endif
+    }
+
+    ~CacheCounter()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+#endif
+    }
+
+    /**
+     * @brief Reset the count and start counting.
+     */
+    void start()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /**
+     * @brief Stop counting.
+     *
+     * @return The number of events since start, or -1 if the counter is not available.
+     */
+    long long stop()
+    {
+        long long count = -1;
+#ifdef __linux__
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+            {
+                count = -1;
+            }
+        }
+#endif
+        return count;
+    }
+
+    /**
+     * @brief Get the reason the counter could not be opened.
+     *
+     * @return The error message, or NULL if the counter is available.
+     */
+    const char *unavailable() const
+    {
+        return fd >= 0 ? NULL : strerror(error);
+    }
+
+  private:
+    int fd;
+    int error; // errno of a failed perf_event_open
+};
+
+// Cache events read per run: L1 data cache read misses and last-level cache read misses
+#ifdef __linux__
+static const unsigned long long L1D_READ_MISS =
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+static const unsigned long long LLC_READ_MISS =
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+#else
+static const unsigned long long L1D_READ_MISS = 0;
+static const unsigned long long LLC_READ_MISS = 0;
+#endif
+
+/**
+ * @brief Print a per-frame count, or n/a when the counter is not available.
+ */
+static void printCount(const char *name, long long count, int iterations)
+{
+    if (count < 0)
+    {
+        printf("  %s %12s", name, "n/a");
+        return;
+    }
+    printf("  %s %12lld", name, count / iterations);
+}
+
+/**
+ * @brief Time one filter over a frame and count its cache misses.
+ *
+ * @param name The filter name to print.
+ * @param filter The filter.
+ * @param src The source frame.
+ * @param tileCache The tile cache budget to run with, 0 for whole rows.
+ * @param iterations The number of frames to average over.
+ */
+static void runFilter(const char *name, int (*filter)(cv::Mat &, cv::Mat &), cv::Mat &src, int tileCache,
+                      int iterations)
+{
+    cv::Mat dst;
+    CacheCounter l1Misses(L1D_READ_MISS);
+    CacheCounter llcMisses(LLC_READ_MISS);
+
+    setFilterTileCache(tileCache);
+    filter(src, dst); // warm up the thread pool and allocate dst
+
+    l1Misses.start();
+    llcMisses.start();
+    double startTime = getTime();
+    for (int i = 0; i < iterations; i++)
+    {
+        filter(src, dst);
+    }
+    double endTime = getTime();
+    long long l1 = l1Misses.stop();
+    long long llc = llcMisses.stop();
+
+    double frameTime = 1000.0 * (endTime - startTime) / iterations;
+    printf("%-11s %-10s %8.2f ms", name, tileCache > 0 ? "tiled" : "row-major", frameTime);
+    printCount("L1D misses", l1, iterations);
+    printCount("LLC misses", llc, iterations);
+    printf("\n");
+}
+
+static int blur5x5_4Default(cv::Mat &src, cv::Mat &dst)
+{
+    return blur5x5_4(src, dst);
+}
+
+static int gauss3x3atDefault(cv::Mat &src, cv::Mat &dst)
+{
+    return gauss3x3at(src, dst);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    int tileCache = argc > 2 ? atoi(argv[2]) : getFilterTileCache();
+    if (iterations < 1 || tileCache < 1)
+    {
+        printf("Usage %s [iterations] [tile cache bytes]\n", argv[0]);
+        exit(-1);
+    }
+
+    // Say once why the counters read n/a: ENOENT when the CPU has no cache events, as in most virtual machines, and
+    // EACCES or EPERM when kernel.perf_event_paranoid is above 2
+    CacheCounter probe(L1D_READ_MISS);
+    if (probe.unavailable() != NULL)
+    {
+        printf("Cache miss counters not available: %s\n", probe.unavailable());
+    }
+
+    const int sizes[2][2] = {{3840, 2160}, {7680, 4320}};
+    for (int s = 0; s < 2; s++)
+    {
+        cv::Mat src(sizes[s][1], sizes[s][0], CV_8UC3);
+        cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+
+        printf("%dx%d, %d threads, %d byte tiles, per frame:\n", src.cols, src.rows, getFilterThreads(), tileCache);
+        runFilter("blur5x5_4", blur5x5_4Default, src, 0, iterations);
+        runFilter("blur5x5_4", blur5x5_4Default, src, tileCache, iterations);
+        runFilter("gauss3x3at", gauss3x3atDefault, src, 0, iterations);
+        runFilter("gauss3x3at", gauss3x3atDefault, src, tileCache, iterations);
+    }
+
+    printf("Terminating\n");
+    return (0);
+}
@@ -14,6 +14,15 @@
 
 #include "faceDetect.h"
 #include "filter.h"
+#include "pyramid.h"
+
+// Width the filters run at in preview mode. Wider captures are downscaled to it for display.
+static const int PREVIEW_WIDTH = 640;
+
+// Incremental mode compares frames in tiles of this size, and counts a tile as changed when its mean absolute
+// difference per sample is above the threshold, so camera noise in a static scene does not rerun the filters.
+static const int CHANGE_TILE_SIZE = 16;
+static const double CHANGE_THRESHOLD = 3.0;
 
 /**
  * @brief Get the current date and time as a formatted string.
@@ -46,7 +55,7 @@ std::string getCurrentDateTimeStamp()
  */
 void drawMenu(cv::Mat &commandMat, const std::vector<std::string> &commands, int selectedCommand)
 {
-    commandMat = cv::Mat::zeros(500, 300, CV_8UC3);
+    commandMat = cv::Mat::zeros(680, 300, CV_8UC3);
     for (int i = 0; i < commands.size(); ++i)
     {
         cv::Scalar textColor = (i == selectedCommand) ? cv::Scalar(0, 255, 0) : cv::Scalar(255, 255, 255);
@@ -54,6 +63,52 @@ void drawMenu(cv::Mat &commandMat, const std::vector<std::string> &commands, int
     }
 }
 
+/**
+ * @brief Area of a rectangle grown by a margin on every side.
+ */
+static long long windowArea(const cv::Rect &rect, int margin)
+{
+    return (long long)(rect.width + 2 * margin) * (rect.height + 2 * margin);
+}
+
+/**
+ * @brief Group rectangles into clusters that are cheaper to filter together than apart.
+ *
+ * Each rectangle is filtered over a window grown by a margin, so two nearby rectangles are joined when the window of
+ * their bounding box is no larger than their two windows together. Joining repeats until no pair of clusters
+ * qualifies, which keeps distant changes in windows of their own while the rows of one moving object end up in one.
+ *
+ * @param rects The rectangles, e.g. the changed tiles from changedTiles.
+ * @param margin The margin each window is grown by.
+ * @param clusters Set to the bounding boxes of the clusters.
+ */
+static void clusterRects(const std::vector<cv::Rect> &rects, int margin, std::vector<cv::Rect> &clusters)
+{
+    clusters.assign(rects.begin(), rects.end());
+    bool joined = true;
+    while (joined)
+    {
+        joined = false;
+        for (size_t i = 0; i < clusters.size(); i++)
+        {
+            for (size_t j = i + 1; j < clusters.size();)
+            {
+                cv::Rect both = clusters[i] | clusters[j];
+                if (windowArea(both, margin) <= windowArea(clusters[i], margin) + windowArea(clusters[j], margin))
+                {
+                    clusters[i] = both;
+                    clusters.erase(clusters.begin() + j);
+                    joined = true;
+                }
+                else
+                {
+                    j++;
+                }
+            }
+        }
+    }
+}
+
 /**
  * @brief Uses OpenCV to display live video.
  *
@@ -70,7 +125,16 @@ void drawMenu(cv::Mat &commandMat, const std::vector<std::string> &commands, int
 int main(int argc, char *argv[])
 {
     cv::VideoCapture *capdev;
-    cv::Mat frame, commandMat;
+    cv::Mat capture, previewCapture, frame, commandMat;
+
+    // Output and scratch buffers reused across frames, so the filter stages do not allocate per frame
+    FilterContext filterContext;
+
+    // Planar copies of the frame for chains of filters with planar versions, written alternately like the outputs
+    PlanarImage planarFrames[2];
+
+    // Pyramids of the capture, for preview downscaling, and of the grey frame, for face detection
+    GaussianPyramid capturePyramid, greyPyramid;
 
     capdev = new cv::VideoCapture(0);
     if (!capdev->isOpened())
@@ -90,7 +154,9 @@ int main(int argc, char *argv[])
     std::vector<std::string> commandText = {
         "Commands:",          "'q': quit",        "'s': screen shot", "'g': greyscale", "'h': alternate grayscale",
         "'p': sepia tone",    "'b': blur",        "'x': sobel x",     "'y': sobel y",   "'m': gradient magnitude",
-        "'l': blur quantize", "'f': face detect", "'e': emboss",      "'n': negative",  "'+ or -': brightness"};
+        "'l': blur quantize", "'f': face detect", "'e': emboss",      "'n': negative",  "'+ or -': brightness",
+        "'r': preview",       "'v': blur faces",  "'i': incremental", "'d': denoise",   "'a': bilateral smooth",
+        "'c': cartoon",       "'u': sharpen"};
     int selectedCommand = -1;
 
     // Text properties
@@ -109,41 +175,123 @@ int main(int argc, char *argv[])
     bool gradientMagnitude = false;
     bool blurQuantized = false;
     bool faceDetect = false;
+    bool blurFaces = false;
     bool emboss = false;
     bool negative = false;
+    bool denoise = false;
+    bool bilateral = false;
+    bool cartoon = false;
+    bool sharpen = false;
     double brightness = 1.0;
 
-    for (;;)
-    {
-        *capdev >> frame;
-        if (frame.empty())
+    // Radius of the median filter that removes salt-and-pepper noise before the other filters
+    const int denoiseRadius = 2;
+
+    // Range sigma of the bilateral smoothing, in 8-bit intensity levels. Its spatial sigma follows the frame width.
+    const double bilateralSigmaRange = 25.0;
+
+    // Quantization levels and edge threshold (L1 Sobel norm of the blurred intensity) of the cartoon effect
+    const int cartoonLevels = 10;
+    const int cartoonEdgeThreshold = 100;
+
+    // Unsharp mask amount, and the largest difference from the blur left alone so camera noise is not sharpened
+    const double sharpenAmount = 1.0;
+    const int sharpenThreshold = 4;
+
+    // Preview mode runs the filters on a downscaled frame, and at full resolution only for a screen capture
+    bool preview = true;
+
+    // Incremental mode keeps the filtered frame and the input it was made from, and reruns the filters only around
+    // the tiles of the input that changed. Any command clears the cache, since it may change the filters.
+    bool incremental = false;
+    bool cacheValid = false;
+    cv::Mat previousInput, cachedFrame, incrementalFrame;
+    std::vector<cv::Rect> changed, clusters;
+
+    // Run the enabled filters over one captured frame, leaving the result in frame
+    auto filterFrame = [&](cv::Mat &input) {
+        frame = input;
+
+        // When two or more filters with planar versions are on, the frame is split into planes before the first of
+        // them and only merged back when a filter without a planar version, or the display, needs it.
+        bool planarChain = emboss + blurQuantized + gradientMagnitude + sepia + blur >= 2;
+        int planar = -1; // the planar frame holding the current frame, or -1 while frame holds it
+        auto toPlanar = [&]() {
+            if (planar < 0 && deinterleave(frame, planarFrames[0]) == 0)
+            {
+                planar = 0;
+            }
+            return planar >= 0;
+        };
+        auto toInterleaved = [&]() {
+            if (planar >= 0)
+            {
+                cv::Mat &mergedFrame = filterContext.output(frame);
+                interleave(planarFrames[planar], mergedFrame);
+                frame = mergedFrame;
+                planar = -1;
+            }
+        };
+
+        // Point operations (negative, quantize, brightness) are composed into one lookup table and applied in a
+        // single pass, either right before a filter that needs the real pixel values or before display.
+        PointOp pointOps;
+        auto applyPointOps = [&]() {
+            if (!pointOps.isIdentity())
+            {
+                if (planar >= 0)
+                {
+                    pointOps.apply(planarFrames[planar], planarFrames[planar]);
+                }
+                else
+                {
+                    pointOps.apply(frame, frame);
+                }
+                pointOps = PointOp();
+            }
+        };
+
+        // Denoise
+        if (denoise)
         {
-            printf("frame is empty\n");
-            break;
+            cv::Mat &denoiseFrame = filterContext.output(frame);
+            if (medianFilter(frame, denoiseFrame, denoiseRadius, &filterContext) == 0)
+            {
+                frame = denoiseFrame;
+            }
         }
 
-        // Negative
-        if (negative)
+        // Sharpen, after the denoising so the noise it removes is not sharpened
+        if (sharpen)
         {
-            cv::Mat negativeFrame;
-            int negativeColor = negativeFilter(frame, negativeFrame);
-            if (negativeColor == 0)
+            cv::Mat &sharpenFrame = filterContext.output(frame);
+            if (unsharpMask(frame, sharpenFrame, sharpenAmount, sharpenThreshold, &filterContext) == 0)
             {
-                frame = negativeFrame;
+                frame = sharpenFrame;
             }
         }
 
+        // Negative
+        if (negative)
+        {
+            pointOps = pointOps.then(PointOp::negative());
+        }
+
         // Emboss
         if (emboss)
         {
-            cv::Mat sobelXFrame;
-            cv::Mat sobelYFrame;
-            int sobelXColor = sobelX3x3(frame, sobelXFrame);
-            int sobelYColor = sobelY3x3(frame, sobelYFrame);
-            if (sobelXColor == 0 && sobelYColor == 0)
+            applyPointOps();
+            if (planarChain && toPlanar())
             {
-                cv::Mat embossFrame;
-                int embossColor = embossEffect(sobelXFrame, sobelYFrame, embossFrame);
+                if (embossEffectPlanar(planarFrames[planar], planarFrames[1 - planar], &filterContext) == 0)
+                {
+                    planar = 1 - planar;
+                }
+            }
+            else
+            {
+                cv::Mat &embossFrame = filterContext.output(frame);
+                int embossColor = embossEffect(frame, embossFrame, &filterContext);
                 if (embossColor == 0)
                 {
                     frame = embossFrame;
@@ -151,39 +299,75 @@ int main(int argc, char *argv[])
             }
         }
 
-        // Detect faces
-        if (faceDetect)
+        // Detect faces, and blur them or draw boxes around them
+        if (faceDetect || blurFaces)
         {
-            cv::Mat greyFrame;
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &greyFrame = filterContext.scratch(FilterContext::SCRATCH_USER, frame.rows, frame.cols, CV_8UC1);
             cv::cvtColor(frame, greyFrame, cv::COLOR_BGR2GRAY);
             std::vector<cv::Rect> faces;
-            detectFaces(greyFrame, faces);
-            drawBoxes(frame, faces);
+            if (greyPyramid.build(greyFrame, 2, cv::BORDER_REFLECT_101, &filterContext) == 0)
+            {
+                detectFaces(greyPyramid, faces);
+            }
+
+            if (blurFaces)
+            {
+                // Only the face boxes are filtered, the halo lets the blur read the pixels around them
+                int radius = std::max(1, frame.cols / 40);
+                auto faceBlur = [&](cv::Mat &src, cv::Mat &dst) { return boxBlur(src, dst, radius, &filterContext); };
+                filterRegions(frame, faces, radius, faceBlur, &filterContext);
+            }
+
+            if (faceDetect)
+            {
+                drawBoxes(frame, faces);
+            }
         }
 
         // Blur quantize
         if (blurQuantized)
         {
-            cv::Mat blurQuantizeFrame;
+            applyPointOps();
             int levels = 10;
-            int blurQuantizeColor = blurQuantize(frame, blurQuantizeFrame, levels);
-            if (blurQuantizeColor == 0)
+            if (planarChain && toPlanar())
+            {
+                PlanarImage &src = planarFrames[planar];
+                if (blur5x5Planar(src, planarFrames[1 - planar], cv::BORDER_REFLECT_101, &filterContext) == 0)
+                {
+                    planar = 1 - planar;
+                    pointOps = pointOps.then(PointOp::quantize(levels));
+                }
+            }
+            else
             {
-                frame = blurQuantizeFrame;
+                cv::Mat &blurQuantizeFrame = filterContext.output(frame);
+                int blurQuantizeColor = blur5x5_5(frame, blurQuantizeFrame, cv::BORDER_REFLECT_101, &filterContext);
+                if (blurQuantizeColor == 0)
+                {
+                    frame = blurQuantizeFrame;
+                    pointOps = pointOps.then(PointOp::quantize(levels));
+                }
             }
         }
 
         // Gradient magnitude
         if (gradientMagnitude)
         {
-            cv::Mat sobelXFrame;
-            cv::Mat sobelYFrame;
-            int sobelXColor = sobelX3x3(frame, sobelXFrame);
-            int sobelYColor = sobelY3x3(frame, sobelYFrame);
-            if (sobelXColor == 0 && sobelYColor == 0)
+            applyPointOps();
+            if (planarChain && toPlanar())
             {
-                cv::Mat gradientMagnitudeFrame;
-                int gradientMagnitudeColor = magnitude(sobelXFrame, sobelYFrame, gradientMagnitudeFrame);
+                PlanarImage &src = planarFrames[planar];
+                if (magnitudePlanar(src, planarFrames[1 - planar], MAGNITUDE_L2, &filterContext) == 0)
+                {
+                    planar = 1 - planar;
+                }
+            }
+            else
+            {
+                cv::Mat &gradientMagnitudeFrame = filterContext.output(frame);
+                int gradientMagnitudeColor = magnitude(frame, gradientMagnitudeFrame, MAGNITUDE_L2, &filterContext);
                 if (gradientMagnitudeColor == 0)
                 {
                     frame = gradientMagnitudeFrame;
@@ -194,7 +378,10 @@ int main(int argc, char *argv[])
         // Sobel X
         if (sobelX)
         {
-            cv::Mat sobelXFrame;
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &sobelXFrame = filterContext.scratch(FilterContext::SCRATCH_USER + 1, frame.rows, frame.cols,
+                                                         CV_16SC(frame.channels()));
             int sobelXColor = sobelX3x3(frame, sobelXFrame);
             if (sobelXColor == 0)
             {
@@ -206,7 +393,10 @@ int main(int argc, char *argv[])
         // Sobel Y
         if (sobelY)
         {
-            cv::Mat sobelYFrame;
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &sobelYFrame = filterContext.scratch(FilterContext::SCRATCH_USER + 1, frame.rows, frame.cols,
+                                                         CV_16SC(frame.channels()));
             int sobelYColor = sobelY3x3(frame, sobelYFrame);
             if (sobelYColor == 0)
             {
@@ -218,13 +408,19 @@ int main(int argc, char *argv[])
         // Regular grayscale
         if (gray)
         {
-            cv::cvtColor(frame, frame, cv::COLOR_BGR2GRAY);
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &grayFrame = filterContext.output(frame);
+            cv::cvtColor(frame, grayFrame, cv::COLOR_BGR2GRAY);
+            frame = grayFrame;
         }
 
         // Alternate grayscale
         if (altGray)
         {
-            cv::Mat grayFrame;
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &grayFrame = filterContext.output(frame);
             int grayColor = greyscale(frame, grayFrame);
             if (grayColor == 0)
             {
@@ -235,26 +431,87 @@ int main(int argc, char *argv[])
         // Sepia tone
         if (sepia)
         {
-            cv::Mat sepiaFrame;
-            int sepiaColor = sepiaTone(frame, sepiaFrame);
-            if (sepiaColor == 0)
+            applyPointOps();
+            if (planarChain && toPlanar())
             {
-                frame = sepiaFrame;
+                if (ColorMatrix::sepia().apply(planarFrames[planar], planarFrames[1 - planar]) == 0)
+                {
+                    planar = 1 - planar;
+                }
+            }
+            else
+            {
+                cv::Mat &sepiaFrame = filterContext.output(frame);
+                int sepiaColor = sepiaTone(frame, sepiaFrame);
+                if (sepiaColor == 0)
+                {
+                    frame = sepiaFrame;
+                }
             }
         }
 
         // Blur
         if (blur)
         {
-            cv::Mat blurFrame;
-            int blurColor = blur5x5_4(frame, blurFrame);
-            if (blurColor == 0)
+            applyPointOps();
+            if (planarChain && toPlanar())
+            {
+                PlanarImage &src = planarFrames[planar];
+                if (blur5x5Planar(src, planarFrames[1 - planar], cv::BORDER_REFLECT_101, &filterContext) == 0)
+                {
+                    planar = 1 - planar;
+                }
+            }
+            else
+            {
+                cv::Mat &blurFrame = filterContext.output(frame);
+                int blurColor = blur5x5_5(frame, blurFrame, cv::BORDER_REFLECT_101, &filterContext);
+                if (blurColor == 0)
+                {
+                    frame = blurFrame;
+                }
+            }
+        }
+
+        // Bilateral smoothing
+        if (bilateral)
+        {
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &bilateralFrame = filterContext.output(frame);
+            double sigmaSpace = std::max(1.0, frame.cols / 80.0);
+            if (bilateralGrid(frame, bilateralFrame, sigmaSpace, bilateralSigmaRange, &filterContext) == 0)
             {
-                frame = blurFrame;
+                frame = bilateralFrame;
             }
         }
 
-        // Display brightness
+        // Cartoon: blur, quantize and black edges in one pass, after the bilateral smoothing when both are on
+        if (cartoon)
+        {
+            applyPointOps();
+            toInterleaved();
+            cv::Mat &cartoonFrame = filterContext.output(frame);
+            if (cartoonize(frame, cartoonFrame, cartoonLevels, cartoonEdgeThreshold, &filterContext) == 0)
+            {
+                frame = cartoonFrame;
+            }
+        }
+
+        // Adjust brightness
+        pointOps = pointOps.then(PointOp::brightness(brightness));
+        applyPointOps();
+        toInterleaved();
+    };
+
+    // Number of pixels around a pixel of frame the enabled filters read, added up over the chain
+    auto filterHalo = [&]() {
+        return emboss + gradientMagnitude + sobelX + sobelY + 2 * (blur + blurQuantized + sharpen) + 3 * cartoon +
+               denoise * denoiseRadius;
+    };
+
+    // Draw the brightness overlay on frame
+    auto drawBrightness = [&]() {
         std::stringstream brightnessStream;
         brightnessStream << "Brightness: " << std::fixed << std::setprecision(2) << brightness;
         std::string brightnessText = brightnessStream.str();
@@ -264,20 +521,105 @@ int main(int argc, char *argv[])
         int centerX = frame.cols / 2;
         cv::putText(frame, brightnessText, cv::Point(centerX, startY), cv::FONT_HERSHEY_SIMPLEX, 0.5,
                     cv::Scalar(255, 255, 255), thickness, lineType);
+    };
+
+    // Run the enabled filters over one captured frame, leaving the result, with the brightness overlay, in frame
+    auto processFrame = [&](cv::Mat &input) {
+        filterFrame(input);
+        drawBrightness();
+    };
+
+    // Update the cached filtered frame from one captured frame, rerunning the filters only on the windows around the
+    // clusters of changed tiles, and leave a copy of it with the brightness overlay in frame. Face detection looks at
+    // the whole frame, and the bilateral grid cells are laid out from the frame origin, so both always run the full
+    // chain.
+    auto processFrameIncremental = [&](cv::Mat &input) {
+        if (!cacheValid || faceDetect || blurFaces || bilateral || previousInput.size() != input.size() ||
+            previousInput.type() != input.type())
+        {
+            input.copyTo(previousInput);
+            filterFrame(input);
+            frame.copyTo(cachedFrame);
+            cacheValid = !faceDetect && !blurFaces && !bilateral;
+        }
+        else if (changedTiles(input, previousInput, CHANGE_TILE_SIZE, CHANGE_THRESHOLD, changed, &filterContext) == 0)
+        {
+            for (size_t i = 0; i < changed.size(); i++)
+            {
+                cv::Mat reference = previousInput(changed[i]);
+                input(changed[i]).copyTo(reference);
+            }
 
-        // Adjust brightness
-        cv::Mat brightenedFrame;
-        int brightnessAdjusted = adjustBrightness(frame, brightenedFrame, brightness);
-        if (brightnessAdjusted == 0)
+            // A changed pixel reaches output pixels up to the halo away, which in turn read pixels up to the halo
+            // further out. Each cluster is filtered over its own window, so changes far apart do not rerun the
+            // filters over the frame between them.
+            int halo = filterHalo();
+            clusterRects(changed, 2 * halo, clusters);
+            for (size_t i = 0; i < clusters.size(); i++)
+            {
+                cv::Rect inner, update, window;
+                if (!regionWindow(input.size(), clusters[i], halo, inner, update) ||
+                    !regionWindow(input.size(), clusters[i], 2 * halo, inner, window))
+                {
+                    continue;
+                }
+
+                cv::Mat windowInput = input(window);
+                filterFrame(windowInput);
+                cv::Mat target = cachedFrame(update);
+                frame(cv::Rect(update.x - window.x, update.y - window.y, update.width, update.height)).copyTo(target);
+            }
+        }
+
+        cachedFrame.copyTo(incrementalFrame);
+        frame = incrementalFrame;
+        drawBrightness();
+    };
+
+    for (;;)
+    {
+        // Capture into a buffer of its own, so it never aliases a filter output from the previous frame
+        *capdev >> capture;
+        if (capture.empty())
+        {
+            printf("frame is empty\n");
+            break;
+        }
+
+        // In preview mode the filters run on a downscaled copy of the capture, which is all the window needs
+        bool downscaled = preview && capture.cols > PREVIEW_WIDTH;
+        if (downscaled)
+        {
+            cv::Size previewSize(PREVIEW_WIDTH, cvRound(capture.rows * (double)PREVIEW_WIDTH / capture.cols));
+
+            // Halve the capture down a pyramid while it stays at least as wide as the preview, then resize the rest
+            int levels = GaussianPyramid::levelCount(capture.cols, PREVIEW_WIDTH);
+            bool built = capturePyramid.build(capture, levels, cv::BORDER_REFLECT_101, &filterContext) == 0;
+            cv::Mat &nearest = built ? capturePyramid.level(levels - 1) : capture;
+            cv::resize(nearest, previewCapture, previewSize, 0, 0, cv::INTER_AREA);
+        }
+        cv::Mat &input = downscaled ? previewCapture : capture;
+        if (incremental)
         {
-            frame = brightenedFrame;
+            processFrameIncremental(input);
+        }
+        else
+        {
+            processFrame(input);
         }
 
         drawMenu(commandMat, commandText, selectedCommand);
         cv::imshow("Commands", commandMat);
         // Display frame
         cv::imshow("Video", frame);
-        char key = cv::waitKey(10);
+        int keyCode = cv::waitKey(10); // -1 when no key was pressed
+
+        // Any command may change the filters, so the next incremental frame runs them over the whole frame
+        if (keyCode != -1)
+        {
+            cacheValid = false;
+        }
+        char key = (char)keyCode;
 
         // Quit program
         if (key == 'q')
@@ -290,9 +632,20 @@ int main(int argc, char *argv[])
         if (key == 's')
         {
             selectedCommand = 2;
+
+            // A preview frame is downscaled, so run the filters again on the full capture for the saved image. The
+            // preview is copied first, since the full-resolution pass reuses the output buffers it lives in.
+            cv::Mat shownFrame = frame;
+            if (downscaled)
+            {
+                shownFrame = frame.clone();
+                processFrame(capture);
+            }
+
             // Get current timestamp and save screen capture
             std::string currentDateTimeStamp = getCurrentDateTimeStamp();
             cv::imwrite(currentDateTimeStamp + "_screen_capture.jpg", frame);
+            frame = shownFrame;
             cv::waitKey(500); // Wait for .5 seconds
 
             // Display screen captured text
@@ -494,6 +847,55 @@ int main(int argc, char *argv[])
             selectedCommand = 14;
             brightness -= 0.1;
         }
+
+        // Toggle preview resolution
+        if (key == 'r')
+        {
+            selectedCommand = 15;
+            preview = !preview;
+        }
+
+        // Toggle face blurring
+        if (key == 'v')
+        {
+            selectedCommand = 16;
+            blurFaces = !blurFaces;
+        }
+
+        // Toggle incremental filtering of changed tiles
+        if (key == 'i')
+        {
+            selectedCommand = 17;
+            incremental = !incremental;
+        }
+
+        // Toggle the median denoising filter
+        if (key == 'd')
+        {
+            selectedCommand = 18;
+            denoise = !denoise;
+        }
+
+        // Toggle the edge-preserving bilateral smoothing
+        if (key == 'a')
+        {
+            selectedCommand = 19;
+            bilateral = !bilateral;
+        }
+
+        // Toggle the cartoon effect
+        if (key == 'c')
+        {
+            selectedCommand = 20;
+            cartoon = !cartoon;
+        }
+
+        // Toggle the unsharp mask sharpening
+        if (key == 'u')
+        {
+            selectedCommand = 21;
+            sharpen = !sharpen;
+        }
     }
 
     delete capdev;